@@ -0,0 +1,526 @@
+// *****************************************************************************************************************************
+// gl_bvh.hpp
+// OpenGL Rendering
+// Bounding volume hierarchy over instance bounds (binned SAH build, refit, frustum and box queries)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_BVH_HPP
+#define GL_BVH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "gl_camera.hpp"
+#include "gl_stats.hpp"
+
+#define BVH_BINS 16				// SAH bins per axis
+#define BVH_LEAF_SIZE 4			// Nodes with this many instances or fewer are always leaves
+#define BVH_MAX_LEAF_SIZE 16	// Larger nodes are always split
+
+// BVH NODE
+// Every node covers the contiguous range [first, first + count) of the instance index array,
+// so a subtree fully inside the frustum is accepted without visiting it
+struct BVHNode
+{
+	float min[3];
+	float max[3];
+	uint32_t first;
+	uint32_t count;
+	uint32_t left;				// Children are left and left + 1 (0: leaf, the root is never a child)
+};
+
+// Transform an axis-aligned box by a column-major 4x4 matrix (Arvo)
+// out_min, out_max = box enclosing the transformed box
+void BVHTransformBox(const float min[3], const float max[3], const GLfloat m[16], float out_min[3], float out_max[3])
+{
+	for (int row = 0; row < 3; row++)
+	{
+		out_min[row] = out_max[row] = m[12 + row];
+		for (int col = 0; col < 3; col++)
+		{
+			float a = m[col * 4 + row] * min[col];
+			float b = m[col * 4 + row] * max[col];
+			out_min[row] += std::min(a, b);
+			out_max[row] += std::max(a, b);
+		}
+	}
+}
+
+// BVH BUILD REFERENCE
+// Instance box, centroid and id, partitioned along with the tree during a build so every pass reads memory in order
+struct BVHBuildRef
+{
+	float min[3];
+	float max[3];
+	float centroid[3];
+	uint32_t id;
+};
+
+// INSTANCE BVH
+// Instances are given as boxes (mins / maxs: 3 floats per instance, e.g. model bounds transformed with BVHTransformBox)
+class InstanceBVH
+{
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> indices;		// Instance ids, grouped by leaf
+	std::vector<float> inst_min;		// 3 per instance
+	std::vector<float> inst_max;
+	std::vector<BVHBuildRef> refs;		// Build scratch (released after build)
+	std::vector<std::pair<uint32_t, uint32_t>> stack;	// Traversal scratch (node, active plane mask)
+
+	void fitNode(BVHNode& node) const;
+	void fitRefs(BVHNode& node) const;
+	void subdivide(uint32_t node_index);
+public:
+	void build(const float* mins, const float* maxs, size_t count);
+	void refit(const float* mins, const float* maxs);
+	void clear() { nodes.clear(); indices.clear(); inst_min.clear(); inst_max.clear(); refs.clear(); }
+
+	template <typename T>
+	size_t cullFrustum(const Frustum<T>& frustum, std::vector<uint32_t>& visible);
+	size_t queryBox(const float min[3], const float max[3], std::vector<uint32_t>& out);
+
+	size_t numInstances() const { return indices.size(); }
+	size_t numNodes() const { return nodes.size(); }
+	const std::vector<BVHNode>& getNodes() const { return nodes; }
+	const std::vector<uint32_t>& getIndices() const { return indices; }
+};
+
+// Set node bounds from its instances
+void InstanceBVH::fitNode(BVHNode& node) const
+{
+	for (int c = 0; c < 3; c++)
+	{
+		node.min[c] = FLT_MAX;
+		node.max[c] = -FLT_MAX;
+	}
+	for (uint32_t i = node.first; i < node.first + node.count; i++)
+	{
+		const float* lo = &this->inst_min[this->indices[i] * 3];
+		const float* hi = &this->inst_max[this->indices[i] * 3];
+		for (int c = 0; c < 3; c++)
+		{
+			node.min[c] = std::min(node.min[c], lo[c]);
+			node.max[c] = std::max(node.max[c], hi[c]);
+		}
+	}
+}
+
+// Set node bounds from the build references in its range
+void InstanceBVH::fitRefs(BVHNode& node) const
+{
+	for (int c = 0; c < 3; c++)
+	{
+		node.min[c] = FLT_MAX;
+		node.max[c] = -FLT_MAX;
+	}
+	for (uint32_t i = node.first; i < node.first + node.count; i++)
+	{
+		const BVHBuildRef& ref = this->refs[i];
+		for (int c = 0; c < 3; c++)
+		{
+			node.min[c] = std::min(node.min[c], ref.min[c]);
+			node.max[c] = std::max(node.max[c], ref.max[c]);
+		}
+	}
+}
+
+// Return: half surface area of a box (SAH cost weight)
+float BVHHalfArea(const float min[3], const float max[3])
+{
+	float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+	if (dx < 0 || dy < 0 || dz < 0)
+		return 0;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+// Build from instance boxes (replaces any previous tree)
+void InstanceBVH::build(const float* mins, const float* maxs, size_t count)
+{
+	this->clear();
+	if (count == 0)
+		return;
+
+	this->inst_min.assign(mins, mins + count * 3);
+	this->inst_max.assign(maxs, maxs + count * 3);
+	this->refs.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		BVHBuildRef& ref = this->refs[i];
+		for (int k = 0; k < 3; k++)
+		{
+			ref.min[k] = mins[i * 3 + k];
+			ref.max[k] = maxs[i * 3 + k];
+			ref.centroid[k] = (ref.min[k] + ref.max[k]) * 0.5f;
+		}
+		ref.id = uint32_t(i);
+	}
+
+	this->nodes.reserve(count * 2);
+	this->nodes.push_back(BVHNode());
+	this->nodes[0].first = 0;
+	this->nodes[0].count = uint32_t(count);
+	this->nodes[0].left = 0;
+	this->fitRefs(this->nodes[0]);
+
+	// Depth-first with an explicit stack (children are always stored after their parent)
+	std::vector<uint32_t> pending(1, 0);
+	while (!pending.empty())
+	{
+		uint32_t node = pending.back();
+		pending.pop_back();
+		this->subdivide(node);
+		if (this->nodes[node].left)
+		{
+			pending.push_back(this->nodes[node].left + 1);
+			pending.push_back(this->nodes[node].left);
+		}
+	}
+
+	this->indices.resize(count);
+	for (size_t i = 0; i < count; i++)
+		this->indices[i] = this->refs[i].id;
+	std::vector<BVHBuildRef>().swap(this->refs);
+}
+
+// Split a node by binned SAH over centroids (leaves the node a leaf if splitting does not pay off)
+void InstanceBVH::subdivide(uint32_t node_index)
+{
+	BVHNode node = this->nodes[node_index];
+	if (node.count <= BVH_LEAF_SIZE)
+		return;
+
+	// Centroid bounds
+	float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint32_t i = node.first; i < node.first + node.count; i++)
+	{
+		const float* c = this->refs[i].centroid;
+		for (int k = 0; k < 3; k++)
+		{
+			cmin[k] = std::min(cmin[k], c[k]);
+			cmax[k] = std::max(cmax[k], c[k]);
+		}
+	}
+
+	struct Bin
+	{
+		float min[3], max[3];
+		uint32_t count;
+	};
+
+	// Bin all three axes in one pass over the instances
+	Bin bins[3][BVH_BINS];
+	float scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = cmax[axis] - cmin[axis];
+		scale[axis] = extent > 0 ? BVH_BINS / extent : 0.0f;
+		for (Bin& b : bins[axis])
+		{
+			b.count = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				b.min[k] = FLT_MAX;
+				b.max[k] = -FLT_MAX;
+			}
+		}
+	}
+	for (uint32_t i = node.first; i < node.first + node.count; i++)
+	{
+		const BVHBuildRef& ref = this->refs[i];
+		const float* c = ref.centroid;
+		const float* lo = ref.min;
+		const float* hi = ref.max;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			Bin& bin = bins[axis][std::min(BVH_BINS - 1, int((c[axis] - cmin[axis]) * scale[axis]))];
+			bin.count++;
+			for (int k = 0; k < 3; k++)
+			{
+				bin.min[k] = std::min(bin.min[k], lo[k]);
+				bin.max[k] = std::max(bin.max[k], hi[k]);
+			}
+		}
+	}
+
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (scale[axis] == 0)
+			continue;
+
+		// Sweep from the right, then evaluate splits from the left
+		float right_area[BVH_BINS];
+		uint32_t right_count[BVH_BINS];
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		uint32_t n = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--)
+		{
+			n += bins[axis][b].count;
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = std::min(lo[k], bins[axis][b].min[k]);
+				hi[k] = std::max(hi[k], bins[axis][b].max[k]);
+			}
+			right_count[b] = n;
+			right_area[b] = BVHHalfArea(lo, hi);
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = FLT_MAX;
+			hi[k] = -FLT_MAX;
+		}
+		n = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++)
+		{
+			n += bins[axis][b].count;
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = std::min(lo[k], bins[axis][b].min[k]);
+				hi[k] = std::max(hi[k], bins[axis][b].max[k]);
+			}
+			if (n == 0 || right_count[b + 1] == 0)
+				continue;
+			float cost = n * BVHHalfArea(lo, hi) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	uint32_t mid;
+	if (best_axis >= 0)
+	{
+		// Stay a leaf if no split beats testing every instance (unless the leaf would be too large)
+		float leaf_cost = node.count * BVHHalfArea(node.min, node.max);
+		if (best_cost >= leaf_cost && node.count <= BVH_MAX_LEAF_SIZE)
+			return;
+
+		BVHBuildRef* begin = &this->refs[node.first];
+		BVHBuildRef* split = std::partition(begin, begin + node.count, [&](const BVHBuildRef& ref)
+		{
+			return std::min(BVH_BINS - 1, int((ref.centroid[best_axis] - cmin[best_axis]) * scale[best_axis])) < best_split;
+		});
+		mid = uint32_t(split - begin);
+	}
+	else
+	{
+		// All centroids equal: split in half if too large for a leaf
+		if (node.count <= BVH_MAX_LEAF_SIZE)
+			return;
+		mid = node.count / 2;
+	}
+
+	uint32_t left = uint32_t(this->nodes.size());
+	this->nodes.push_back(BVHNode());
+	this->nodes.push_back(BVHNode());
+	this->nodes[left].first = node.first;
+	this->nodes[left].count = mid;
+	this->nodes[left].left = 0;
+	this->nodes[left + 1].first = node.first + mid;
+	this->nodes[left + 1].count = node.count - mid;
+	this->nodes[left + 1].left = 0;
+	if (best_axis >= 0)
+	{
+		// Child bounds are the unions of the bins on each side of the split
+		for (int b = 0; b < BVH_BINS; b++)
+		{
+			BVHNode& child = this->nodes[b < best_split ? left : left + 1];
+			if (b == 0 || b == best_split)
+			{
+				std::memcpy(child.min, bins[best_axis][b].min, sizeof(child.min));
+				std::memcpy(child.max, bins[best_axis][b].max, sizeof(child.max));
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				child.min[k] = std::min(child.min[k], bins[best_axis][b].min[k]);
+				child.max[k] = std::max(child.max[k], bins[best_axis][b].max[k]);
+			}
+		}
+	}
+	else
+	{
+		this->fitRefs(this->nodes[left]);
+		this->fitRefs(this->nodes[left + 1]);
+	}
+	this->nodes[node_index].left = left;
+}
+
+// Update instance boxes and node bounds without changing the tree (for moving instances)
+// mins, maxs = new boxes for the same instances as build(); rebuild when the tree quality degrades
+void InstanceBVH::refit(const float* mins, const float* maxs)
+{
+	std::memcpy(this->inst_min.data(), mins, this->inst_min.size() * sizeof(float));
+	std::memcpy(this->inst_max.data(), maxs, this->inst_max.size() * sizeof(float));
+
+	// Children are stored after parents: reverse order visits children first
+	for (size_t n = this->nodes.size(); n-- > 0;)
+	{
+		BVHNode& node = this->nodes[n];
+		if (!node.left)
+		{
+			this->fitNode(node);
+			continue;
+		}
+
+		const BVHNode& a = this->nodes[node.left];
+		const BVHNode& b = this->nodes[node.left + 1];
+		for (int c = 0; c < 3; c++)
+		{
+			node.min[c] = std::min(a.min[c], b.min[c]);
+			node.max[c] = std::max(a.max[c], b.max[c]);
+		}
+	}
+}
+
+// Find instances whose boxes intersect the frustum
+// Planes a box is fully inside are not tested again below it; a subtree inside all planes is accepted as a whole.
+// visible = output instance ids (cleared first)
+// Return: number of visible instances (also added to the frame's visible / culled counts)
+template <typename T>
+size_t InstanceBVH::cullFrustum(const Frustum<T>& frustum, std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	if (this->nodes.empty())
+		return 0;
+
+	float planes[6][4];
+	for (int p = 0; p < 6; p++)
+	{
+		for (int k = 0; k < 4; k++)
+			planes[p][k] = float(frustum.planes[p][k]);
+	}
+
+	// Return: -1 outside, else the plane mask still to test
+	auto classify = [&](const float* lo, const float* hi, uint32_t mask) -> int
+	{
+		for (int p = 0; p < 6; p++)
+		{
+			if (!(mask & (1u << p)))
+				continue;
+			const float* pl = planes[p];
+			float far_d = pl[3], near_d = pl[3];
+			for (int k = 0; k < 3; k++)
+			{
+				far_d += pl[k] * (pl[k] > 0 ? hi[k] : lo[k]);	// Corner furthest along the normal
+				near_d += pl[k] * (pl[k] > 0 ? lo[k] : hi[k]);
+			}
+			if (far_d < 0)
+				return -1;
+			if (near_d >= 0)
+				mask &= ~(1u << p);
+		}
+		return int(mask);
+	};
+
+	this->stack.clear();
+	this->stack.push_back({ 0u, 0x3Fu });
+	while (!this->stack.empty())
+	{
+		uint32_t n = this->stack.back().first;
+		uint32_t mask = this->stack.back().second;
+		this->stack.pop_back();
+
+		const BVHNode& node = this->nodes[n];
+		int result = classify(node.min, node.max, mask);
+		if (result < 0)
+			continue;
+
+		if (result == 0)
+		{
+			visible.insert(visible.end(), this->indices.begin() + node.first,
+				this->indices.begin() + node.first + node.count);
+		}
+		else if (node.left)
+		{
+			this->stack.push_back({ node.left + 1, uint32_t(result) });
+			this->stack.push_back({ node.left, uint32_t(result) });
+		}
+		else
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				uint32_t id = this->indices[i];
+				if (classify(&this->inst_min[id * 3], &this->inst_max[id * 3], uint32_t(result)) >= 0)
+					visible.push_back(id);
+			}
+		}
+	}
+
+	RendFrameStats& stats = FrameStats::get().counters();
+	stats.visible += visible.size();
+	stats.culled += this->indices.size() - visible.size();
+	return visible.size();
+}
+
+// Find instances whose boxes overlap a box
+// out = output instance ids (cleared first)
+// Return: number of instances found
+size_t InstanceBVH::queryBox(const float min[3], const float max[3], std::vector<uint32_t>& out)
+{
+	out.clear();
+	if (this->nodes.empty())
+		return 0;
+
+	auto overlaps = [&](const float* lo, const float* hi)
+	{
+		return lo[0] <= max[0] && hi[0] >= min[0] && lo[1] <= max[1] && hi[1] >= min[1] &&
+			lo[2] <= max[2] && hi[2] >= min[2];
+	};
+
+	this->stack.clear();
+	this->stack.push_back({ 0u, 0u });
+	while (!this->stack.empty())
+	{
+		const BVHNode& node = this->nodes[this->stack.back().first];
+		this->stack.pop_back();
+		if (!overlaps(node.min, node.max))
+			continue;
+
+		if (node.left)
+		{
+			this->stack.push_back({ node.left + 1, 0u });
+			this->stack.push_back({ node.left, 0u });
+		}
+		else
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				uint32_t id = this->indices[i];
+				if (overlaps(&this->inst_min[id * 3], &this->inst_max[id * 3]))
+					out.push_back(id);
+			}
+		}
+	}
+
+	return out.size();
+}
+
+// Copy the transforms of selected instances (e.g. cullFrustum results) for Model::drawInstanced
+// transforms = all instance matrices (16 floats each)
+// out = packed matrices of the selected instances
+void BVHGatherTransforms(const GLfloat* transforms, const std::vector<uint32_t>& ids, std::vector<GLfloat>& out)
+{
+	out.resize(ids.size() * 16);
+	for (size_t i = 0; i < ids.size(); i++)
+		std::memcpy(&out[i * 16], transforms + size_t(ids[i]) * 16, 16 * sizeof(GLfloat));
+}
+
+#endif
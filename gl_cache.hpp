@@ -0,0 +1,225 @@
+// *****************************************************************************************************************************
+// gl_cache.hpp
+// OpenGL Rendering
+// On-disk cache helpers (hashing, file stamps, memory-mapped files)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_CACHE_HPP
+#define GL_CACHE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+// 64-bit FNV-1a hash
+// data = bytes to hash
+// size = number of bytes
+// seed = previous hash value, to chain multiple buffers
+// Return: hash value
+uint64_t CacheHash(const void* data, size_t size, uint64_t seed = CACHE_HASH_SEED)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t CacheHash(const std::string& str, uint64_t seed = CACHE_HASH_SEED)
+{
+	return CacheHash(str.data(), str.size(), seed);
+}
+
+// Source file stamp used to detect stale cache entries
+struct CacheFileStamp
+{
+	int64_t mtime = 0;		// Last write time (file clock ticks)
+	uint64_t size = 0;		// File size in bytes
+};
+
+// Get modification time and size of a file
+// Return: true if the file exists
+bool CacheGetFileStamp(const std::string& path, CacheFileStamp& stamp)
+{
+	std::error_code ec;
+
+	auto time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+	auto size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return false;
+
+	stamp.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+	stamp.size = static_cast<uint64_t>(size);
+
+	return true;
+}
+
+// Return: ID of the current process
+uint64_t CacheProcessID()
+{
+#ifdef _WIN32
+	return uint64_t(GetCurrentProcessId());
+#else
+	return uint64_t(getpid());
+#endif
+}
+
+// Write a buffer to disk through a temporary file so readers never see a partial file
+// The temporary name includes the process ID, so processes writing the same cache entry do not share it.
+// Return: true on success
+bool CacheWriteFile(const std::string& path, const void* data, size_t size)
+{
+	std::string tmp_path = path + "." + std::to_string(CacheProcessID()) + ".tmp";
+	std::error_code ec;
+
+	{
+		std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write(static_cast<const char*>(data), size);
+		if (!file)
+			return false;
+	}
+
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+
+	return true;
+}
+
+// MAPPED FILE
+// Read-only memory mapping of an entire file
+class MappedFile
+{
+private:
+	const unsigned char* ptr = nullptr;
+	size_t len = 0;
+#ifdef _WIN32
+	HANDLE file_handle = INVALID_HANDLE_VALUE;
+	HANDLE map_handle = nullptr;
+#endif
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return ptr != nullptr; }
+	const unsigned char* data() const { return ptr; }
+	size_t size() const { return len; }
+};
+
+// Map file into memory (read-only)
+// Return: true on success
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	map_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!map_handle)
+	{
+		close();
+		return false;
+	}
+
+	ptr = static_cast<const unsigned char*>(MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0));
+	if (!ptr)
+	{
+		close();
+		return false;
+	}
+	len = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* mem = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	// Mapping stays valid after the descriptor is closed
+	if (mem == MAP_FAILED)
+		return false;
+
+	ptr = static_cast<const unsigned char*>(mem);
+	len = static_cast<size_t>(st.st_size);
+#endif
+
+	return true;
+}
+
+// Unmap file
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (ptr)
+		UnmapViewOfFile(ptr);
+	if (map_handle)
+		CloseHandle(map_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+	map_handle = nullptr;
+	file_handle = INVALID_HANDLE_VALUE;
+#else
+	if (ptr)
+		munmap(const_cast<unsigned char*>(ptr), len);
+#endif
+	ptr = nullptr;
+	len = 0;
+}
+
+#endif
@@ -9,6 +9,8 @@
 #ifndef GL_CAMERA_HPP
 #define GL_CAMERA_HPP
 
+#include <cmath>
+
 #include "vec.hpp"
 #include "mat.hpp"
 
@@ -17,6 +19,17 @@
 // TODO: MAYBE add function to generate perspective projection matrix? / view + perspective?
 // TODO: Switch to Quaternions to avoid Gimbal Lock?
 
+// FRUSTUM
+// Six planes (a, b, c, d) with normals pointing inward: a point p is inside when a*p.x + b*p.y + c*p.z + d >= 0
+// Order: left, right, bottom, top, near, far
+template <typename T = float>
+struct Frustum
+{
+	T planes[6][4];
+};
+
+template <typename T> Frustum<T> FrustumFromMatrix(Mat4<T> view_proj);
+
 template <typename T = float>
 class Camera
 {
@@ -48,6 +61,8 @@ public:
 	Vec3<T> getCamRight();
 	Vec3<T> getCamUp();
 	Mat4<T> getLookAt();
+	Frustum<T> getFrustum(Mat4<T> projection);
+	void screenRay(T x, T y, T width, T height, Mat4<T> projection, Vec3<T>& origin, Vec3<T>& dir);
 
 	void moveGlobal(Vec3<T> t);
 	void movePos(Vec3<T> t);
@@ -216,6 +231,32 @@ Mat4<T> Camera<T>::getLookAt()
 	}
 }
 
+// Get world space view frustum
+// projection = projection matrix used with getLookAt()
+template <typename T>
+Frustum<T> Camera<T>::getFrustum(Mat4<T> projection)
+{
+	return FrustumFromMatrix(projection * getLookAt());
+}
+
+// Get world space picking ray through a screen position (perspective projection)
+// x, y = window coordinates (origin at the top left), width / height = window size
+// projection = projection matrix used with getLookAt()
+// origin = camera position, dir = normalized ray direction
+template <typename T>
+void Camera<T>::screenRay(T x, T y, T width, T height, Mat4<T> projection, Vec3<T>& origin, Vec3<T>& dir)
+{
+	T ndc_x = 2 * x / width - 1;
+	T ndc_y = 1 - 2 * y / height;
+
+	// View space direction at z = -1 (column 2 holds the off-center terms)
+	T view_x = (ndc_x + projection[2].x) / projection[0].x;
+	T view_y = (ndc_y + projection[2].y) / projection[1].y;
+
+	origin = this->pos;
+	dir = (getCamRight() * view_x + getCamUp() * view_y - getCamDir()).norm();
+}
+
 // Move entire camera in global coordinates
 // t = move vector
 template <typename T>
@@ -356,4 +397,45 @@ Mat4<T> LookAt(Vec3<T> pos, Vec3<T> target, Vec3<T> up)
 	return lookat_mat;
 }
 
+// Extract frustum planes from a view-projection matrix (Gribb / Hartmann)
+// Planes are in the space the matrix transforms from (world space for projection * look-at)
+// Returns: frustum with normalized planes
+template <typename T>
+Frustum<T> FrustumFromMatrix(Mat4<T> view_proj)
+{
+	// Rows of the matrix (operator[] gives columns)
+	T rows[4][4];
+	for (int col = 0; col < 4; col++)
+	{
+		Vec4<T> c = view_proj[col];
+		rows[0][col] = c.x;
+		rows[1][col] = c.y;
+		rows[2][col] = c.z;
+		rows[3][col] = c.w;
+	}
+
+	Frustum<T> frustum;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			frustum.planes[axis * 2][k] = rows[3][k] + rows[axis][k];		// -w <= x / y / z
+			frustum.planes[axis * 2 + 1][k] = rows[3][k] - rows[axis][k];	// x / y / z <= w
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		T* p = frustum.planes[i];
+		T len = T(std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+		if (len > 0)
+		{
+			for (int k = 0; k < 4; k++)
+				p[k] /= len;
+		}
+	}
+
+	return frustum;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+// *****************************************************************************************************************************
+// gl_cull.hpp
+// OpenGL Rendering
+// Frustum culling of bounding spheres (SoA arrays, SSE / AVX)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_CULL_HPP
+#define GL_CULL_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#if defined(__AVX__)
+#define CULL_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULL_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include "gl_camera.hpp"
+
+// CULL SPHERES
+// Bounding spheres in structure-of-arrays layout (one array per component, so SIMD lanes load consecutive spheres)
+struct CullSpheres
+{
+	std::vector<float> x, y, z, r;
+
+	void clear() { x.clear(); y.clear(); z.clear(); r.clear(); }
+	size_t size() const { return x.size(); }
+	void push(float cx, float cy, float cz, float radius)
+	{
+		x.push_back(cx);
+		y.push_back(cy);
+		z.push_back(cz);
+		r.push_back(radius);
+	}
+};
+
+// Test spheres against a frustum
+// visible = output flags (1: intersects or inside the frustum), one per sphere
+// Return: number of visible spheres
+template <typename T>
+size_t RendCullSpheres(const Frustum<T>& frustum, const CullSpheres& spheres, uint8_t* visible)
+{
+	const size_t count = spheres.size();
+	const float* sx = spheres.x.data();
+	const float* sy = spheres.y.data();
+	const float* sz = spheres.z.data();
+	const float* sr = spheres.r.data();
+
+	float planes[6][4];
+	for (int p = 0; p < 6; p++)
+	{
+		for (int k = 0; k < 4; k++)
+			planes[p][k] = float(frustum.planes[p][k]);
+	}
+
+	size_t num_visible = 0;
+	size_t i = 0;
+
+#if defined(CULL_USE_AVX)
+	// 8 spheres per iteration: visible if distance > -radius for all planes
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(sx + i);
+		__m256 y = _mm256_loadu_ps(sy + i);
+		__m256 z = _mm256_loadu_ps(sz + i);
+		__m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(sr + i));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p][0])),
+				_mm256_mul_ps(y, _mm256_set1_ps(planes[p][1]))),
+				_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planes[p][2])), _mm256_set1_ps(planes[p][3])));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GT_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8; k++)
+		{
+			visible[i + k] = uint8_t((mask >> k) & 1);
+			num_visible += (mask >> k) & 1;
+		}
+	}
+#elif defined(CULL_USE_SSE)
+	// 4 spheres per iteration
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(sx + i);
+		__m128 y = _mm_loadu_ps(sy + i);
+		__m128 z = _mm_loadu_ps(sz + i);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(sr + i));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p][0])),
+				_mm_mul_ps(y, _mm_set1_ps(planes[p][1]))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p][2])), _mm_set1_ps(planes[p][3])));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, neg_r));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++)
+		{
+			visible[i + k] = uint8_t((mask >> k) & 1);
+			num_visible += (mask >> k) & 1;
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+			inside = planes[p][0] * sx[i] + planes[p][1] * sy[i] + planes[p][2] * sz[i] + planes[p][3] > -sr[i];
+		visible[i] = uint8_t(inside);
+		num_visible += inside;
+	}
+
+	return num_visible;
+}
+
+#endif
@@ -0,0 +1,464 @@
+// *****************************************************************************************************************************
+// gl_geometry.hpp
+// OpenGL Rendering
+// Geometry pool: shared vertex / index megabuffers per vertex format, sub-allocated by meshes
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_GEOMETRY_HPP
+#define GL_GEOMETRY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "gl_state.hpp"
+
+#define GEOMETRY_NO_SLOT 0xFFFFFFFFu
+#define GEOMETRY_MIN_VERTICES (64 * 1024)	// Initial buffer capacities
+#define GEOMETRY_MIN_INDICES (256 * 1024)
+
+// RANGE ALLOCATOR
+// First-fit free list over [0, capacity) in element units, free blocks coalesced on release
+class GeometryAllocator
+{
+private:
+	std::map<uint32_t, uint32_t> free_blocks;	// Offset -> size
+	uint32_t capacity = 0;
+	uint32_t used = 0;
+public:
+	void reset(uint32_t new_capacity, uint32_t used_prefix);
+	void grow(uint32_t new_capacity);
+	uint32_t allocate(uint32_t size);
+	void release(uint32_t offset, uint32_t size);
+
+	uint32_t getCapacity() const { return capacity; }
+	uint32_t getUsed() const { return used; }
+	uint32_t getLargestFree() const;
+	size_t numFreeBlocks() const { return free_blocks.size(); }
+};
+
+// Reset to a single used prefix [0, used_prefix) followed by free space
+void GeometryAllocator::reset(uint32_t new_capacity, uint32_t used_prefix)
+{
+	this->free_blocks.clear();
+	this->capacity = new_capacity;
+	this->used = used_prefix;
+	if (used_prefix < new_capacity)
+		this->free_blocks[used_prefix] = new_capacity - used_prefix;
+}
+
+// Extend capacity (new space is merged with a free block at the end)
+void GeometryAllocator::grow(uint32_t new_capacity)
+{
+	if (new_capacity <= this->capacity)
+		return;
+
+	uint32_t old_capacity = this->capacity;
+	uint32_t added = new_capacity - old_capacity;
+	this->capacity = new_capacity;
+
+	if (!this->free_blocks.empty())
+	{
+		auto last = std::prev(this->free_blocks.end());
+		if (last->first + last->second == old_capacity)
+		{
+			last->second += added;
+			return;
+		}
+	}
+	this->free_blocks[old_capacity] = added;
+}
+
+// Return: offset of size elements, GEOMETRY_NO_SLOT if no block is large enough
+uint32_t GeometryAllocator::allocate(uint32_t size)
+{
+	for (auto it = this->free_blocks.begin(); it != this->free_blocks.end(); ++it)
+	{
+		if (it->second < size)
+			continue;
+
+		uint32_t offset = it->first;
+		uint32_t remaining = it->second - size;
+		this->free_blocks.erase(it);
+		if (remaining > 0)
+			this->free_blocks[offset + size] = remaining;
+		this->used += size;
+		return offset;
+	}
+
+	return GEOMETRY_NO_SLOT;
+}
+
+// Return a range to the free list
+void GeometryAllocator::release(uint32_t offset, uint32_t size)
+{
+	if (size == 0)
+		return;
+	this->used -= size;
+
+	auto next = this->free_blocks.lower_bound(offset);
+
+	// Merge with following block
+	if (next != this->free_blocks.end() && offset + size == next->first)
+	{
+		size += next->second;
+		next = this->free_blocks.erase(next);
+	}
+
+	// Merge with preceding block
+	if (next != this->free_blocks.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+
+	this->free_blocks[offset] = size;
+}
+
+uint32_t GeometryAllocator::getLargestFree() const
+{
+	uint32_t largest = 0;
+	for (const auto& block : this->free_blocks)
+		largest = std::max(largest, block.second);
+	return largest;
+}
+
+// GEOMETRY SLOT
+// Ranges of one mesh within a geometry buffer (in vertices / indices)
+struct GeometrySlot
+{
+	uint32_t vertex_offset;		// Base vertex for glDrawElementsBaseVertex
+	uint32_t num_vertices;
+	uint32_t index_offset;
+	uint32_t num_indices;
+	bool live;
+};
+
+// GEOMETRY BUFFER
+// One VAO with a vertex buffer and an index buffer shared by all meshes of one vertex layout and index type
+class GeometryBuffer
+{
+private:
+	GLuint VAO = 0, VBO = 0, EBO = 0;
+	GLsizei vertex_size;
+	GLenum index_type;
+	GLsizei index_size;
+	void (*setup_attribs)();		// Sets vertex attribute pointers for the bound VAO / VBO
+
+	GeometryAllocator vertex_alloc;
+	GeometryAllocator index_alloc;
+	std::vector<GeometrySlot> slots;
+	std::vector<uint32_t> free_slots;
+
+	void rebuild(uint32_t vertex_capacity, uint32_t index_capacity, bool compact);
+public:
+	uint64_t instance_serial = 0;	// InstanceBuffer::getSerial() of the buffer bound to the VAO's per-instance attributes
+
+	GeometryBuffer(GLsizei vertex_size, GLenum index_type, void (*setup_attribs)());
+	GeometryBuffer(const GeometryBuffer&) = delete;
+	GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+	void deleteObjects();
+
+	uint32_t allocate(const void* vertex_data, size_t num_vertices, const void* index_data, size_t num_indices);
+	void release(uint32_t slot);
+	void defragment();
+
+	GLuint getVAO() const { return VAO; }
+	GLsizei getVertexSize() const { return vertex_size; }
+	GLenum getIndexType() const { return index_type; }
+	GLsizei getIndexSize() const { return index_size; }
+	const GeometrySlot& getSlot(uint32_t slot) const { return slots[slot]; }
+	const GeometryAllocator& getVertexAllocator() const { return vertex_alloc; }
+	const GeometryAllocator& getIndexAllocator() const { return index_alloc; }
+};
+
+GeometryBuffer::GeometryBuffer(GLsizei vertex_size, GLenum index_type, void (*setup_attribs)())
+	: vertex_size(vertex_size), index_type(index_type), setup_attribs(setup_attribs)
+{
+	this->index_size = index_type == GL_UNSIGNED_SHORT ? GLsizei(sizeof(GLushort)) : GLsizei(sizeof(GLuint));
+	glGenVertexArrays(1, &this->VAO);
+}
+
+// Delete the VAO and buffers (needs the context; the destructor makes no GL calls, so it is safe after teardown)
+void GeometryBuffer::deleteObjects()
+{
+	if (this->VAO)
+		StateCache::get().deleteVertexArray(this->VAO);
+	if (this->VBO)
+		StateCache::get().deleteBuffer(this->VBO);
+	if (this->EBO)
+		StateCache::get().deleteBuffer(this->EBO);
+	this->VAO = this->VBO = this->EBO = 0;
+}
+
+// Upload a mesh into the shared buffers (grows them when full)
+// Return: slot id, GEOMETRY_NO_SLOT on failure
+uint32_t GeometryBuffer::allocate(const void* vertex_data, size_t num_vertices, const void* index_data, size_t num_indices)
+{
+	if (num_vertices > 0x7FFFFFFF || num_indices > 0x7FFFFFFF)
+		return GEOMETRY_NO_SLOT;
+
+	uint32_t vertex_offset = this->vertex_alloc.allocate(uint32_t(num_vertices));
+	uint32_t index_offset = this->index_alloc.allocate(uint32_t(num_indices));
+
+	if (vertex_offset == GEOMETRY_NO_SLOT || index_offset == GEOMETRY_NO_SLOT)
+	{
+		if (vertex_offset != GEOMETRY_NO_SLOT)
+			this->vertex_alloc.release(vertex_offset, uint32_t(num_vertices));
+		if (index_offset != GEOMETRY_NO_SLOT)
+			this->index_alloc.release(index_offset, uint32_t(num_indices));
+
+		// Grow geometrically (at least enough for this mesh at the end)
+		uint64_t vertex_capacity = std::max<uint64_t>(GEOMETRY_MIN_VERTICES,
+			std::max<uint64_t>(uint64_t(this->vertex_alloc.getCapacity()) * 2, this->vertex_alloc.getCapacity() + num_vertices));
+		uint64_t index_capacity = std::max<uint64_t>(GEOMETRY_MIN_INDICES,
+			std::max<uint64_t>(uint64_t(this->index_alloc.getCapacity()) * 2, this->index_alloc.getCapacity() + num_indices));
+		if (vertex_capacity > 0xFFFFFFFFull || index_capacity > 0xFFFFFFFFull)
+			return GEOMETRY_NO_SLOT;
+		this->rebuild(uint32_t(vertex_capacity), uint32_t(index_capacity), false);
+
+		vertex_offset = this->vertex_alloc.allocate(uint32_t(num_vertices));
+		index_offset = this->index_alloc.allocate(uint32_t(num_indices));
+		if (vertex_offset == GEOMETRY_NO_SLOT || index_offset == GEOMETRY_NO_SLOT)
+		{
+			fprintf(stderr, "GeometryBuffer: allocation of %zu vertices / %zu indices failed\n", num_vertices, num_indices);
+			return GEOMETRY_NO_SLOT;
+		}
+	}
+
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, this->VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, GLintptr(vertex_offset) * this->vertex_size, GLsizeiptr(num_vertices) * this->vertex_size,
+		vertex_data);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+	StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);		// Not GL_ELEMENT_ARRAY_BUFFER (would change VAO state)
+	glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(index_offset) * this->index_size, GLsizeiptr(num_indices) * this->index_size,
+		index_data);
+	StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	uint32_t slot;
+	if (!this->free_slots.empty())
+	{
+		slot = this->free_slots.back();
+		this->free_slots.pop_back();
+	}
+	else
+	{
+		slot = uint32_t(this->slots.size());
+		this->slots.emplace_back();
+	}
+	this->slots[slot] = { vertex_offset, uint32_t(num_vertices), index_offset, uint32_t(num_indices), true };
+
+	return slot;
+}
+
+// Free a mesh's ranges
+void GeometryBuffer::release(uint32_t slot)
+{
+	GeometrySlot& s = this->slots[slot];
+	if (!s.live)
+		return;
+
+	this->vertex_alloc.release(s.vertex_offset, s.num_vertices);
+	this->index_alloc.release(s.index_offset, s.num_indices);
+	s.live = false;
+	this->free_slots.push_back(slot);
+}
+
+// Pack all live ranges to the start of new buffers (slot ids stay valid, offsets change)
+void GeometryBuffer::defragment()
+{
+	if (this->vertex_alloc.numFreeBlocks() <= 1 && this->index_alloc.numFreeBlocks() <= 1)
+		return;
+
+	this->rebuild(this->vertex_alloc.getCapacity(), this->index_alloc.getCapacity(), true);
+}
+
+// Reallocate buffers and copy contents on the GPU
+// compact = pack live slots (otherwise offsets are kept and the whole old range is copied)
+void GeometryBuffer::rebuild(uint32_t vertex_capacity, uint32_t index_capacity, bool compact)
+{
+	GLuint new_vbo, new_ebo;
+	glGenBuffers(1, &new_vbo);
+	glGenBuffers(1, &new_ebo);
+
+	StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+	glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(vertex_capacity) * this->vertex_size, nullptr, GL_STATIC_DRAW);
+	StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_ebo);
+	glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(index_capacity) * this->index_size, nullptr, GL_STATIC_DRAW);
+
+	if (this->VBO)
+	{
+		if (compact)
+		{
+			// Copy live slots into packed ranges
+			uint32_t vertex_end = 0, index_end = 0;
+			for (GeometrySlot& s : this->slots)
+			{
+				if (!s.live)
+					continue;
+
+				StateCache::get().bindBuffer(GL_COPY_READ_BUFFER, this->VBO);
+				StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(s.vertex_offset) * this->vertex_size,
+					GLintptr(vertex_end) * this->vertex_size, GLsizeiptr(s.num_vertices) * this->vertex_size);
+				StateCache::get().bindBuffer(GL_COPY_READ_BUFFER, this->EBO);
+				StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_ebo);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(s.index_offset) * this->index_size,
+					GLintptr(index_end) * this->index_size, GLsizeiptr(s.num_indices) * this->index_size);
+
+				s.vertex_offset = vertex_end;
+				s.index_offset = index_end;
+				vertex_end += s.num_vertices;
+				index_end += s.num_indices;
+			}
+			this->vertex_alloc.reset(vertex_capacity, vertex_end);
+			this->index_alloc.reset(index_capacity, index_end);
+		}
+		else
+		{
+			StateCache::get().bindBuffer(GL_COPY_READ_BUFFER, this->VBO);
+			StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+				GLsizeiptr(this->vertex_alloc.getCapacity()) * this->vertex_size);
+			StateCache::get().bindBuffer(GL_COPY_READ_BUFFER, this->EBO);
+			StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, new_ebo);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+				GLsizeiptr(this->index_alloc.getCapacity()) * this->index_size);
+			this->vertex_alloc.grow(vertex_capacity);
+			this->index_alloc.grow(index_capacity);
+		}
+
+		StateCache::get().deleteBuffer(this->VBO);
+		StateCache::get().deleteBuffer(this->EBO);
+	}
+	else
+	{
+		this->vertex_alloc.reset(vertex_capacity, 0);
+		this->index_alloc.reset(index_capacity, 0);
+	}
+	StateCache::get().bindBuffer(GL_COPY_READ_BUFFER, 0);
+	StateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	this->VBO = new_vbo;
+	this->EBO = new_ebo;
+
+	// Re-point the VAO at the new buffers (instance attributes are re-pointed on next instanced draw)
+	StateCache::get().bindVertexArray(this->VAO);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, this->VBO);
+	StateCache::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+	this->setup_attribs();
+	StateCache::get().bindVertexArray(0);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+	this->instance_serial = 0;
+}
+
+// GEOMETRY POOL
+// Process-wide set of geometry buffers, one per (vertex layout, index type)
+class GeometryPool
+{
+private:
+	struct Entry
+	{
+		uint32_t layout;			// Caller-defined layout id (with vertex size)
+		GLsizei vertex_size;
+		GLenum index_type;
+		std::unique_ptr<GeometryBuffer> buffer;
+	};
+	std::vector<Entry> buffers;
+	std::vector<std::unique_ptr<GeometryBuffer>> released;	// Kept for GeometryRanges that outlive release()
+
+	GeometryPool() {}
+public:
+	static GeometryPool& get()
+	{
+		static GeometryPool instance;
+		return instance;
+	}
+
+	GeometryBuffer& getBuffer(uint32_t layout, GLsizei vertex_size, GLenum index_type, void (*setup_attribs)());
+	void defragment();
+	void release();
+	size_t numBuffers() const { return buffers.size(); }
+};
+
+// Get (or create) the buffer for a vertex layout and index type
+// setup_attribs = sets vertex attribute pointers (used when the buffer is created or reallocated)
+GeometryBuffer& GeometryPool::getBuffer(uint32_t layout, GLsizei vertex_size, GLenum index_type, void (*setup_attribs)())
+{
+	for (Entry& entry : this->buffers)
+	{
+		if (entry.layout == layout && entry.vertex_size == vertex_size && entry.index_type == index_type)
+			return *entry.buffer;
+	}
+
+	this->buffers.push_back({ layout, vertex_size, index_type,
+		std::unique_ptr<GeometryBuffer>(new GeometryBuffer(vertex_size, index_type, setup_attribs)) });
+	return *this->buffers.back().buffer;
+}
+
+// Delete all GL objects of the pool; call before destroying the context (the static instance is destroyed after it)
+// Meshes still holding a GeometryRange can be destroyed afterwards but not drawn; new meshes get new buffers
+void GeometryPool::release()
+{
+	for (Entry& entry : this->buffers)
+	{
+		entry.buffer->deleteObjects();
+		this->released.push_back(std::move(entry.buffer));
+	}
+	this->buffers.clear();
+	StateCache::get().bindVertexArray(0);
+}
+
+// Compact all buffers (e.g. after unloading models)
+void GeometryPool::defragment()
+{
+	for (Entry& entry : this->buffers)
+		entry.buffer->defragment();
+}
+
+// GEOMETRY RANGE
+// Owning handle to a slot in a geometry buffer (released on destruction)
+class GeometryRange
+{
+private:
+	GeometryBuffer* buffer = nullptr;
+	uint32_t slot = GEOMETRY_NO_SLOT;
+public:
+	GeometryRange() {}
+	GeometryRange(GeometryBuffer* buffer, uint32_t slot) : buffer(buffer), slot(slot) {}
+	GeometryRange(const GeometryRange&) = delete;
+	GeometryRange(GeometryRange&& other) noexcept : buffer(other.buffer), slot(other.slot) { other.buffer = nullptr; }
+	GeometryRange& operator=(const GeometryRange&) = delete;
+	GeometryRange& operator=(GeometryRange&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (buffer)
+				buffer->release(slot);
+			buffer = other.buffer;
+			slot = other.slot;
+			other.buffer = nullptr;
+		}
+		return *this;
+	}
+	~GeometryRange() { if (buffer) buffer->release(slot); }
+
+	explicit operator bool() const { return buffer != nullptr; }
+	GeometryBuffer* getBuffer() const { return buffer; }
+	const GeometrySlot& getSlot() const { return buffer->getSlot(slot); }
+};
+
+#endif
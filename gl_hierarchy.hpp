@@ -0,0 +1,279 @@
+// *****************************************************************************************************************************
+// gl_hierarchy.hpp
+// OpenGL Rendering
+// Transform hierarchy (flat parent-before-child arrays, incremental world transform updates)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_HIERARCHY_HPP
+#define GL_HIERARCHY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "vec.hpp"
+#include "mat.hpp"
+
+// NODE TRANSFORM
+// Column-major 4x4 matrix (element [col * 4 + row]), directly uploadable with glUniformMatrix4fv when T = float
+template <typename T = float>
+struct NodeTransform
+{
+	T m[16];
+};
+
+// Return: identity transform
+template <typename T>
+NodeTransform<T> NodeTransformIdentity()
+{
+	NodeTransform<T> out = {};
+	out.m[0] = out.m[5] = out.m[10] = out.m[15] = 1;
+	return out;
+}
+
+// out = a * b (out may not alias a or b)
+template <typename T>
+void NodeTransformMul(const NodeTransform<T>& a, const NodeTransform<T>& b, NodeTransform<T>& out)
+{
+	for (int col = 0; col < 4; col++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			out.m[col * 4 + row] = a.m[row] * b.m[col * 4] + a.m[4 + row] * b.m[col * 4 + 1] +
+				a.m[8 + row] * b.m[col * 4 + 2] + a.m[12 + row] * b.m[col * 4 + 3];
+		}
+	}
+}
+
+// Convert from Mat4 (columns)
+template <typename T>
+NodeTransform<T> NodeTransformFromMat4(Mat4<T> mat)
+{
+	NodeTransform<T> out;
+	for (int col = 0; col < 4; col++)
+	{
+		Vec4<T> c = mat[col];
+		out.m[col * 4] = c.x;
+		out.m[col * 4 + 1] = c.y;
+		out.m[col * 4 + 2] = c.z;
+		out.m[col * 4 + 3] = c.w;
+	}
+	return out;
+}
+
+// Transform a point (w = 1)
+template <typename T>
+Vec3<T> NodeTransformPoint(const NodeTransform<T>& t, const Vec3<T>& p)
+{
+	return Vec3<T>(t.m[0] * p.x + t.m[4] * p.y + t.m[8] * p.z + t.m[12],
+		t.m[1] * p.x + t.m[5] * p.y + t.m[9] * p.z + t.m[13],
+		t.m[2] * p.x + t.m[6] * p.y + t.m[10] * p.z + t.m[14]);
+}
+
+// Invert an affine transform (bottom row 0 0 0 1)
+// Return: false if the upper 3x3 is singular (out is unchanged)
+template <typename T>
+bool NodeTransformInverse(const NodeTransform<T>& t, NodeTransform<T>& out)
+{
+	const T* m = t.m;
+	T c00 = m[5] * m[10] - m[9] * m[6];
+	T c01 = m[9] * m[2] - m[1] * m[10];
+	T c02 = m[1] * m[6] - m[5] * m[2];
+	T det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+	if (det == 0)
+		return false;
+	T inv = T(1) / det;
+
+	NodeTransform<T> r = {};
+	r.m[0] = c00 * inv;
+	r.m[1] = c01 * inv;
+	r.m[2] = c02 * inv;
+	r.m[4] = (m[8] * m[6] - m[4] * m[10]) * inv;
+	r.m[5] = (m[0] * m[10] - m[8] * m[2]) * inv;
+	r.m[6] = (m[4] * m[2] - m[0] * m[6]) * inv;
+	r.m[8] = (m[4] * m[9] - m[8] * m[5]) * inv;
+	r.m[9] = (m[8] * m[1] - m[0] * m[9]) * inv;
+	r.m[10] = (m[0] * m[5] - m[4] * m[1]) * inv;
+	for (int row = 0; row < 3; row++)
+		r.m[12 + row] = -(r.m[row] * m[12] + r.m[4 + row] * m[13] + r.m[8 + row] * m[14]);
+	r.m[15] = 1;
+
+	out = r;
+	return true;
+}
+
+// Transform a direction (w = 0)
+template <typename T>
+Vec3<T> NodeTransformVector(const NodeTransform<T>& t, const Vec3<T>& v)
+{
+	return Vec3<T>(t.m[0] * v.x + t.m[4] * v.y + t.m[8] * v.z,
+		t.m[1] * v.x + t.m[5] * v.y + t.m[9] * v.z,
+		t.m[2] * v.x + t.m[6] * v.y + t.m[10] * v.z);
+}
+
+// Return: largest axis scale of the upper 3x3
+template <typename T>
+T NodeTransformMaxScale(const NodeTransform<T>& t)
+{
+	T scale = 0;
+	for (int col = 0; col < 3; col++)
+	{
+		const T* c = &t.m[col * 4];
+		scale = std::max(scale, T(std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2])));
+	}
+	return scale;
+}
+
+// NODE DATA
+// CPU-side node description (import / cache), listed parent before child with contiguous subtrees
+template <typename T = float>
+struct NodeData
+{
+	int32_t parent;					// Index of parent node (-1: root)
+	std::string name;
+	NodeTransform<T> local;			// Relative to parent
+	std::vector<uint32_t> meshes;	// Indices of meshes drawn at this node
+};
+
+// TRANSFORM HIERARCHY
+// Nodes are stored in depth-first (pre-)order, so every subtree is the contiguous range [i, i + subtree_size[i]).
+// setLocal() only records a dirty root; update() recomputes each dirty subtree in one linear pass,
+// so a frame costs time proportional to the number of nodes below changed transforms.
+template <typename T = float>
+class TransformHierarchy
+{
+private:
+	std::vector<int32_t> parent;
+	std::vector<uint32_t> subtree_size;		// Including the node itself
+	std::vector<NodeTransform<T>> local;
+	std::vector<NodeTransform<T>> world;
+	std::vector<uint8_t> dirty;				// Local transform changed since last update
+	std::vector<uint32_t> dirty_roots;		// Nodes with dirty set (unordered, unique)
+
+	void updateRange(uint32_t first, uint32_t end);
+public:
+	void clear();
+	void reserve(size_t count);
+	int32_t addNode(int32_t parent_index, const NodeTransform<T>& local_transform);
+
+	size_t size() const { return parent.size(); }
+	int32_t getParent(uint32_t i) const { return parent[i]; }
+	uint32_t getSubtreeSize(uint32_t i) const { return subtree_size[i]; }
+	const NodeTransform<T>& getLocal(uint32_t i) const { return local[i]; }
+	const NodeTransform<T>& getWorld(uint32_t i) const { return world[i]; }	// Valid after update()
+	bool isDirty() const { return !dirty_roots.empty(); }
+
+	void setLocal(uint32_t i, const NodeTransform<T>& local_transform);
+	size_t update();
+};
+
+template <typename T>
+void TransformHierarchy<T>::clear()
+{
+	parent.clear();
+	subtree_size.clear();
+	local.clear();
+	world.clear();
+	dirty.clear();
+	dirty_roots.clear();
+}
+
+template <typename T>
+void TransformHierarchy<T>::reserve(size_t count)
+{
+	parent.reserve(count);
+	subtree_size.reserve(count);
+	local.reserve(count);
+	world.reserve(count);
+	dirty.reserve(count);
+}
+
+// Append a node (depth-first order: parent must be the last node or one of its ancestors)
+// Return: node index, -1 if the order would break subtree contiguity
+template <typename T>
+int32_t TransformHierarchy<T>::addNode(int32_t parent_index, const NodeTransform<T>& local_transform)
+{
+	uint32_t index = static_cast<uint32_t>(this->parent.size());
+
+	if (parent_index >= 0 && (uint32_t(parent_index) >= index || parent_index + this->subtree_size[parent_index] != index))
+	{
+		fprintf(stderr, "TransformHierarchy: node %u added out of depth-first order\n", index);
+		return -1;
+	}
+
+	this->parent.push_back(parent_index);
+	this->subtree_size.push_back(1);
+	this->local.push_back(local_transform);
+	this->dirty.push_back(0);
+
+	NodeTransform<T> world_transform = local_transform;
+	if (parent_index >= 0)
+		NodeTransformMul(this->world[parent_index], local_transform, world_transform);
+	this->world.push_back(world_transform);
+
+	for (int32_t p = parent_index; p >= 0; p = this->parent[p])
+		this->subtree_size[p]++;
+
+	return static_cast<int32_t>(index);
+}
+
+// Set local transform (world transforms of the subtree are updated by the next update())
+template <typename T>
+void TransformHierarchy<T>::setLocal(uint32_t i, const NodeTransform<T>& local_transform)
+{
+	this->local[i] = local_transform;
+	if (!this->dirty[i])
+	{
+		this->dirty[i] = 1;
+		this->dirty_roots.push_back(i);
+	}
+}
+
+// Recompute world transforms of all dirty subtrees
+// Return: number of nodes recomputed
+template <typename T>
+size_t TransformHierarchy<T>::update()
+{
+	if (this->dirty_roots.empty())
+		return 0;
+
+	// Ascending order: a dirty node inside an already recomputed subtree is skipped
+	std::sort(this->dirty_roots.begin(), this->dirty_roots.end());
+
+	size_t count = 0;
+	uint32_t done_end = 0;
+	for (uint32_t root : this->dirty_roots)
+	{
+		this->dirty[root] = 0;
+		if (root < done_end)
+			continue;
+
+		done_end = root + this->subtree_size[root];
+		this->updateRange(root, done_end);
+		count += this->subtree_size[root];
+	}
+	this->dirty_roots.clear();
+
+	return count;
+}
+
+// Recompute world transforms for nodes [first, end) (parents outside the range must be current)
+template <typename T>
+void TransformHierarchy<T>::updateRange(uint32_t first, uint32_t end)
+{
+	for (uint32_t i = first; i < end; i++)
+	{
+		int32_t p = this->parent[i];
+		if (p < 0)
+			this->world[i] = this->local[i];
+		else
+			NodeTransformMul(this->world[p], this->local[i], this->world[i]);
+	}
+}
+
+#endif
@@ -0,0 +1,244 @@
+// *****************************************************************************************************************************
+// gl_indirect.hpp
+// OpenGL Rendering
+// Multi-draw indirect submission (one glMultiDrawElementsIndirect per geometry buffer and material)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_INDIRECT_HPP
+#define GL_INDIRECT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "gl_geometry.hpp"
+
+#define INDIRECT_DRAW_BINDING 2		// Shader storage binding of the per-draw data
+
+// DRAW COMMAND
+// Layout defined by GL for GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+// DRAW DATA
+// Per-draw shader storage entry (std430), read in the shader at indirect_draw_base + gl_DrawIDARB
+struct IndirectDrawData
+{
+	GLfloat model[16];				// Column-major model matrix
+	GLfloat dequant_scale[4];		// Compact position dequantization (xyz), identity for float vertices
+	GLfloat dequant_offset[4];
+	GLuint material[4];				// x = material index, yzw unused
+};
+
+// Vertex shader helpers for the indirect path (insert after the #version line; requires GLSL 4.30)
+// indirectDraw() replaces the "model" and "mesh_dequant" uniforms of the regular path
+const char INDIRECT_GLSL[] =
+	"#extension GL_ARB_shader_draw_parameters : require\n"
+	"struct IndirectDraw\n"
+	"{\n"
+	"	mat4 model;\n"
+	"	vec4 dequant_scale;\n"
+	"	vec4 dequant_offset;\n"
+	"	uvec4 material;\n"
+	"};\n"
+	"layout(std430, binding = 2) readonly buffer IndirectDraws\n"
+	"{\n"
+	"	IndirectDraw indirect_draws[];\n"
+	"};\n"
+	"uniform uint indirect_draw_base;\n"
+	"IndirectDraw indirectDraw()\n"
+	"{\n"
+	"	return indirect_draws[indirect_draw_base + uint(gl_DrawIDARB)];\n"
+	"}\n"
+	"vec3 indirectDecodePosition(IndirectDraw d, vec3 q)\n"
+	"{\n"
+	"	return d.dequant_scale.xyz * q + d.dequant_offset.xyz;\n"
+	"}\n";
+
+// Check for glMultiDrawElementsIndirect, shader storage buffers (GL 4.3) and gl_DrawIDARB
+// Return: true if the indirect path can be used with the current context
+bool RendIsIndirectSupported()
+{
+	static int supported = -1;
+
+	if (supported < 0)
+	{
+		supported = GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters ? 1 : 0;
+	}
+
+	return supported == 1;
+}
+
+// INDIRECT BATCH
+// Collects draws for one frame, then sorts them by geometry buffer and material and issues
+// one multi-draw per run. Storage is reused between frames (no allocations once capacities settle).
+class IndirectBatch
+{
+private:
+	struct Item
+	{
+		GeometryBuffer* buffer;
+		uint32_t material;
+		uint32_t index;				// Into commands / draw_data (submission order)
+	};
+	std::vector<Item> items;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<IndirectDrawData> draw_data;
+	std::vector<DrawElementsIndirectCommand> sorted_commands;
+	std::vector<IndirectDrawData> sorted_data;
+
+	GLuint command_buffer = 0;
+	GLuint data_buffer = 0;
+	size_t capacity = 0;			// In draws, for both buffers
+
+	void upload();
+public:
+	IndirectBatch() {}
+	IndirectBatch(const IndirectBatch&) = delete;
+	IndirectBatch(IndirectBatch&& other) noexcept;
+	IndirectBatch& operator=(const IndirectBatch&) = delete;
+	IndirectBatch& operator=(IndirectBatch&&) = delete;
+	~IndirectBatch();
+
+	void clear() { items.clear(); commands.clear(); draw_data.clear(); }
+	size_t size() const { return items.size(); }
+	void add(GeometryBuffer* buffer, const GeometrySlot& slot, GLuint first_index, GLuint num_indices, uint32_t material,
+		const IndirectDrawData& data);
+
+	template <typename BindMaterial>
+	size_t submit(GLint draw_base_location, BindMaterial bind_material);
+};
+
+IndirectBatch::IndirectBatch(IndirectBatch&& other) noexcept
+	: items(std::move(other.items)), commands(std::move(other.commands)), draw_data(std::move(other.draw_data)),
+	sorted_commands(std::move(other.sorted_commands)), sorted_data(std::move(other.sorted_data)),
+	command_buffer(other.command_buffer), data_buffer(other.data_buffer), capacity(other.capacity)
+{
+	other.command_buffer = 0;
+	other.data_buffer = 0;
+	other.capacity = 0;
+}
+
+IndirectBatch::~IndirectBatch()
+{
+	if (this->command_buffer)
+		StateCache::get().deleteBuffer(this->command_buffer);
+	if (this->data_buffer)
+		StateCache::get().deleteBuffer(this->data_buffer);
+}
+
+// Queue a draw of index range [first_index, first_index + num_indices) of a pooled mesh (relative to its slot)
+void IndirectBatch::add(GeometryBuffer* buffer, const GeometrySlot& slot, GLuint first_index, GLuint num_indices,
+	uint32_t material, const IndirectDrawData& data)
+{
+	DrawElementsIndirectCommand cmd;
+	cmd.count = num_indices;
+	cmd.instance_count = 1;
+	cmd.first_index = slot.index_offset + first_index;
+	cmd.base_vertex = GLint(slot.vertex_offset);
+	cmd.base_instance = 0;
+
+	this->items.push_back({ buffer, material, uint32_t(this->commands.size()) });
+	this->commands.push_back(cmd);
+	this->draw_data.push_back(data);
+}
+
+// Sort queued draws and upload commands / draw data
+void IndirectBatch::upload()
+{
+	std::sort(this->items.begin(), this->items.end(), [](const Item& a, const Item& b)
+	{
+		if (a.buffer != b.buffer)
+			return std::less<GeometryBuffer*>()(a.buffer, b.buffer);
+		return a.material < b.material;
+	});
+
+	size_t count = this->items.size();
+	this->sorted_commands.resize(count);
+	this->sorted_data.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		this->sorted_commands[i] = this->commands[this->items[i].index];
+		this->sorted_data[i] = this->draw_data[this->items[i].index];
+	}
+
+	if (!this->command_buffer)
+	{
+		glGenBuffers(1, &this->command_buffer);
+		glGenBuffers(1, &this->data_buffer);
+	}
+
+	// Grow geometrically; re-specifying the store orphans data still in use by earlier draws
+	if (count > this->capacity)
+		this->capacity = std::max(count, this->capacity * 2);
+
+	StateCache::get().bindBuffer(GL_DRAW_INDIRECT_BUFFER, this->command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, this->capacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, count * sizeof(DrawElementsIndirectCommand), this->sorted_commands.data());
+
+	StateCache::get().bindBuffer(GL_SHADER_STORAGE_BUFFER, this->data_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, this->capacity * sizeof(IndirectDrawData), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(IndirectDrawData), this->sorted_data.data());
+	StateCache::get().bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Issue all queued draws and clear the batch
+// draw_base_location = location of the indirect_draw_base uniform (first draw data entry of each multi-draw)
+// bind_material = called with the material index before each multi-draw of a new material
+// Return: number of multi-draw calls issued
+template <typename BindMaterial>
+size_t IndirectBatch::submit(GLint draw_base_location, BindMaterial bind_material)
+{
+	if (this->items.empty())
+		return 0;
+	this->upload();
+
+	StateCache::get().bindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_DRAW_BINDING, this->data_buffer);
+
+	size_t num_calls = 0;
+	size_t first = 0;
+	uint32_t bound_material = 0xFFFFFFFFu;
+	while (first < this->items.size())
+	{
+		// Run of draws sharing geometry buffer and material
+		GeometryBuffer* buffer = this->items[first].buffer;
+		uint32_t material = this->items[first].material;
+		size_t end = first + 1;
+		while (end < this->items.size() && this->items[end].buffer == buffer && this->items[end].material == material)
+			end++;
+
+		if (material != bound_material)
+		{
+			bind_material(material);
+			bound_material = material;
+		}
+		glUniform1ui(draw_base_location, GLuint(first));
+		StateCache::get().bindVertexArray(buffer->getVAO());
+		glMultiDrawElementsIndirect(GL_TRIANGLES, buffer->getIndexType(),
+			(const GLvoid*)(first * sizeof(DrawElementsIndirectCommand)), GLsizei(end - first), 0);
+
+		num_calls++;
+		first = end;
+	}
+
+	StateCache::get().bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	this->clear();
+
+	return num_calls;
+}
+
+#endif
@@ -0,0 +1,409 @@
+// *****************************************************************************************************************************
+// gl_ktx.hpp
+// OpenGL Rendering
+// KTX (v1) texture container and BC1/BC3 block compression (no OpenGL calls, usable by offline tools)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_KTX_HPP
+#define GL_KTX_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+// OpenGL enum values written to / read from KTX headers
+#define KTX_GL_RGBA 0x1908
+#define KTX_GL_UNSIGNED_BYTE 0x1401
+#define KTX_GL_RGBA8 0x8058
+#define KTX_GL_COMPRESSED_RGB_S3TC_DXT1 0x83F0
+#define KTX_GL_COMPRESSED_RGBA_S3TC_DXT5 0x83F3
+#define KTX_GL_RGB 0x1907
+
+#define KTX_ENDIANNESS 0x04030201
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct KTXHeader
+{
+	unsigned char identifier[12];
+	uint32_t endianness;
+	uint32_t gl_type;					// 0 for compressed formats
+	uint32_t gl_type_size;
+	uint32_t gl_format;					// 0 for compressed formats
+	uint32_t gl_internal_format;
+	uint32_t gl_base_internal_format;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t num_array_elements;
+	uint32_t num_faces;
+	uint32_t num_mip_levels;			// 0: loader should generate mipmaps
+	uint32_t bytes_key_value_data;
+};
+
+// KTX MIP LEVEL
+// View into a parsed KTX file
+struct KTXLevel
+{
+	const unsigned char* data;
+	uint32_t size;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Parse KTX (v1) file contents (2D textures only, native endianness)
+// Return: true if valid; header and levels point into data
+bool KTXParse(const unsigned char* data, size_t size, KTXHeader& header, std::vector<KTXLevel>& levels)
+{
+	levels.clear();
+
+	if (size < sizeof(KTXHeader))
+		return false;
+	std::memcpy(&header, data, sizeof(KTXHeader));
+
+	if (std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+		header.endianness != KTX_ENDIANNESS)
+		return false;
+	if (header.pixel_width == 0 || header.pixel_height == 0 || header.pixel_depth > 1 ||
+		header.num_array_elements > 0 || header.num_faces != 1)
+		return false;
+
+	size_t pos = sizeof(KTXHeader) + size_t(header.bytes_key_value_data);
+	uint32_t num_levels = std::max(1u, header.num_mip_levels);
+
+	for (uint32_t i = 0; i < num_levels; i++)
+	{
+		uint32_t image_size;
+		if (pos + sizeof(uint32_t) > size)
+			return false;
+		std::memcpy(&image_size, data + pos, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		if (pos + image_size > size)
+			return false;
+
+		KTXLevel level;
+		level.data = data + pos;
+		level.size = image_size;
+		level.width = std::max(1u, header.pixel_width >> i);
+		level.height = std::max(1u, header.pixel_height >> i);
+		levels.push_back(level);
+
+		pos += (size_t(image_size) + 3) & ~size_t(3);	// mipPadding
+	}
+
+	return true;
+}
+
+// Write KTX (v1) file contents
+// levels = mip chain data, largest first
+// Return: file contents
+std::vector<unsigned char> KTXWrite(uint32_t gl_internal_format, uint32_t gl_base_internal_format,
+	uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char>>& levels)
+{
+	KTXHeader header = {};
+	std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.endianness = KTX_ENDIANNESS;
+	header.gl_type_size = 1;
+	header.gl_internal_format = gl_internal_format;
+	header.gl_base_internal_format = gl_base_internal_format;
+	header.pixel_width = width;
+	header.pixel_height = height;
+	header.num_faces = 1;
+	header.num_mip_levels = static_cast<uint32_t>(levels.size());
+	if (gl_internal_format == KTX_GL_RGBA8)
+	{
+		header.gl_type = KTX_GL_UNSIGNED_BYTE;
+		header.gl_format = KTX_GL_RGBA;
+	}
+
+	std::vector<unsigned char> out(sizeof(KTXHeader));
+	std::memcpy(out.data(), &header, sizeof(KTXHeader));
+
+	for (const std::vector<unsigned char>& level : levels)
+	{
+		uint32_t image_size = static_cast<uint32_t>(level.size());
+		const unsigned char* size_bytes = reinterpret_cast<const unsigned char*>(&image_size);
+		out.insert(out.end(), size_bytes, size_bytes + sizeof(uint32_t));
+		out.insert(out.end(), level.begin(), level.end());
+		out.resize((out.size() + 3) & ~size_t(3), 0);
+	}
+
+	return out;
+}
+
+// Generate next mip level of an RGBA8 image (2x2 box filter)
+// Return: downsampled image of max(1, w/2) x max(1, h/2)
+std::vector<unsigned char> KTXDownsampleRGBA(const std::vector<unsigned char>& src, unsigned int width, unsigned int height)
+{
+	unsigned int dst_w = std::max(1u, width / 2);
+	unsigned int dst_h = std::max(1u, height / 2);
+	std::vector<unsigned char> dst(size_t(dst_w) * dst_h * 4);
+
+	for (unsigned int y = 0; y < dst_h; y++)
+	{
+		unsigned int y0 = std::min(y * 2, height - 1);
+		unsigned int y1 = std::min(y * 2 + 1, height - 1);
+		for (unsigned int x = 0; x < dst_w; x++)
+		{
+			unsigned int x0 = std::min(x * 2, width - 1);
+			unsigned int x1 = std::min(x * 2 + 1, width - 1);
+			for (unsigned int c = 0; c < 4; c++)
+			{
+				unsigned int sum = src[(size_t(y0) * width + x0) * 4 + c] + src[(size_t(y0) * width + x1) * 4 + c] +
+					src[(size_t(y1) * width + x0) * 4 + c] + src[(size_t(y1) * width + x1) * 4 + c];
+				dst[(size_t(y) * dst_w + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+
+	return dst;
+}
+
+// Pack 8-bit color to RGB565
+uint16_t KTXPack565(int r, int g, int b)
+{
+	return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+// Unpack RGB565 to 8-bit color
+void KTXUnpack565(uint16_t c, int rgb[3])
+{
+	rgb[0] = ((c >> 11) & 31) * 255 / 31;
+	rgb[1] = ((c >> 5) & 63) * 255 / 63;
+	rgb[2] = (c & 31) * 255 / 31;
+}
+
+// Encode one 4x4 RGBA block to BC1 (4-color mode) color data
+// block = 16 RGBA8 pixels, row-major
+// out = 8 bytes
+void KTXEncodeBC1Color(const unsigned char* block, unsigned char* out)
+{
+	int min_c[3] = { 255, 255, 255 };
+	int max_c[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			min_c[c] = std::min(min_c[c], int(block[i * 4 + c]));
+			max_c[c] = std::max(max_c[c], int(block[i * 4 + c]));
+			mean[c] += block[i * 4 + c];
+		}
+	}
+	for (int c = 0; c < 3; c++)
+		mean[c] = (mean[c] + 8) / 16;
+
+	// Pick bounding box diagonal from sign of red/blue covariance against green
+	int cov_rg = 0, cov_bg = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int g = block[i * 4 + 1] - mean[1];
+		cov_rg += (block[i * 4 + 0] - mean[0]) * g;
+		cov_bg += (block[i * 4 + 2] - mean[2]) * g;
+	}
+	if (cov_rg < 0)
+		std::swap(min_c[0], max_c[0]);
+	if (cov_bg < 0)
+		std::swap(min_c[2], max_c[2]);
+
+	// Inset endpoints by 1/16 of the range to reduce error from quantization
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (max_c[c] - min_c[c]) / 16;
+		max_c[c] -= inset;
+		min_c[c] += inset;
+	}
+
+	uint16_t c0 = KTXPack565(max_c[0], max_c[1], max_c[2]);
+	uint16_t c1 = KTXPack565(min_c[0], min_c[1], min_c[2]);
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	uint32_t indices = 0;
+	if (c0 != c1)
+	{
+		int palette[4][3];
+		KTXUnpack565(c0, palette[0]);
+		KTXUnpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, best_dist = 1 << 30;
+			for (int p = 0; p < 4; p++)
+			{
+				int dist = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = block[i * 4 + c] - palette[p][c];
+					dist += d * d;
+				}
+				if (dist < best_dist)
+				{
+					best_dist = dist;
+					best = p;
+				}
+			}
+			indices |= uint32_t(best) << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 0xFF;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF;
+	out[3] = c1 >> 8;
+	std::memcpy(out + 4, &indices, 4);
+}
+
+// Encode one 4x4 block alpha channel to BC3 alpha data (8-value mode)
+// out = 8 bytes
+void KTXEncodeBC3Alpha(const unsigned char* block, unsigned char* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		a0 = std::max(a0, int(block[i * 4 + 3]));
+		a1 = std::min(a1, int(block[i * 4 + 3]));
+	}
+
+	out[0] = static_cast<unsigned char>(a0);
+	out[1] = static_cast<unsigned char>(a1);
+
+	uint64_t indices = 0;
+	if (a0 != a1)
+	{
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int a = block[i * 4 + 3];
+			int best = 0, best_dist = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int dist = std::abs(a - palette[p]);
+				if (dist < best_dist)
+				{
+					best_dist = dist;
+					best = p;
+				}
+			}
+			indices |= uint64_t(best) << (i * 3);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xFF);
+}
+
+// Compress RGBA8 image to BC1 (alpha ignored) or BC3
+// Return: compressed blocks, ceil(w/4) * ceil(h/4) * (8 or 16) bytes
+std::vector<unsigned char> KTXCompressBC(const std::vector<unsigned char>& image, unsigned int width, unsigned int height,
+	bool alpha)
+{
+	unsigned int blocks_x = (width + 3) / 4;
+	unsigned int blocks_y = (height + 3) / 4;
+	size_t block_bytes = alpha ? 16 : 8;
+	std::vector<unsigned char> out(size_t(blocks_x) * blocks_y * block_bytes);
+	unsigned char block[64];
+
+	for (unsigned int by = 0; by < blocks_y; by++)
+	{
+		for (unsigned int bx = 0; bx < blocks_x; bx++)
+		{
+			// Gather block (edge pixels repeated past the image border)
+			for (unsigned int y = 0; y < 4; y++)
+			{
+				unsigned int sy = std::min(by * 4 + y, height - 1);
+				for (unsigned int x = 0; x < 4; x++)
+				{
+					unsigned int sx = std::min(bx * 4 + x, width - 1);
+					std::memcpy(block + (y * 4 + x) * 4, &image[(size_t(sy) * width + sx) * 4], 4);
+				}
+			}
+
+			unsigned char* dst = &out[(size_t(by) * blocks_x + bx) * block_bytes];
+			if (alpha)
+			{
+				KTXEncodeBC3Alpha(block, dst);
+				KTXEncodeBC1Color(block, dst + 8);
+			}
+			else
+				KTXEncodeBC1Color(block, dst);
+		}
+	}
+
+	return out;
+}
+
+// Compress RGBA8 image with full mip chain to KTX
+// Return: file contents (BC1 if fully opaque, otherwise BC3)
+std::vector<unsigned char> KTXCompressImage(const std::vector<unsigned char>& image, unsigned int width, unsigned int height)
+{
+	bool alpha = false;
+	for (size_t i = 3; i < image.size(); i += 4)
+	{
+		if (image[i] != 255)
+		{
+			alpha = true;
+			break;
+		}
+	}
+
+	std::vector<std::vector<unsigned char>> levels;
+	std::vector<unsigned char> level = image;
+	unsigned int w = width, h = height;
+	while (true)
+	{
+		levels.push_back(KTXCompressBC(level, w, h, alpha));
+		if (w == 1 && h == 1)
+			break;
+		level = KTXDownsampleRGBA(level, w, h);
+		w = std::max(1u, w / 2);
+		h = std::max(1u, h / 2);
+	}
+
+	return KTXWrite(alpha ? KTX_GL_COMPRESSED_RGBA_S3TC_DXT5 : KTX_GL_COMPRESSED_RGB_S3TC_DXT1,
+		alpha ? KTX_GL_RGBA : KTX_GL_RGB, width, height, levels);
+}
+
+// Get path of the compressed version of a texture (same name, .ktx extension)
+std::string KTXGetPath(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + ".ktx";
+
+	return path.substr(0, dot) + ".ktx";
+}
+
+// Check whether the compressed version of a texture can be used in place of the image
+// Return: true if <name>.ktx exists and is not older than the image (or the image is not shipped)
+bool KTXIsCurrent(const std::string& path)
+{
+	std::error_code ec;
+	std::filesystem::file_time_type ktx_time = std::filesystem::last_write_time(KTXGetPath(path), ec);
+	if (ec)
+		return false;
+
+	std::filesystem::file_time_type image_time = std::filesystem::last_write_time(path, ec);
+	return ec || ktx_time >= image_time;
+}
+
+#endif
@@ -13,7 +13,13 @@
 #include <cstdio>
 #include <vector>
 #include <cstring>
-#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
 
 #define GLEW_STATIC
 #include <GL\glew.h>
@@ -29,6 +35,13 @@
 #include "vec.hpp"
 #include "mat.hpp"
 
+#include "gl_geometry.hpp"
+#include "gl_indirect.hpp"
+#include "gl_raycast.hpp"
+#include "gl_shader.hpp"
+#include "gl_state.hpp"
+#include "gl_stats.hpp"
+
 // VERTEX
 template <typename T = float>
 struct Vertex
@@ -46,96 +59,698 @@ struct Texture
 	aiString path;	// Store the path of the texture for later comparison
 };
 
+// TEXTURE REFERENCE
+// Material texture as named in the source file (resolved to a Texture on the GL thread)
+struct TextureRef
+{
+	std::string type;	// Sampler type name (e.g. "texture_diffuse")
+	std::string path;	// Path relative to the model directory
+};
+
+// MESH LOD
+// Index range of one level of detail within the mesh index buffer
+struct MeshLOD
+{
+	GLuint first_index;		// Offset into the index buffer
+	GLuint num_indices;
+	float error;			// Simplification error, relative to the mesh extent
+};
+
+// MESH BOUNDS
+// Object-space bounding box and sphere
+template <typename T = float>
+struct MeshBounds
+{
+	Vec3<T> min;
+	Vec3<T> max;
+	Vec3<T> center;			// Sphere center (box center)
+	T radius = 0;
+	T extent() const { return std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z)); }
+};
+
+// Compute bounds of a vertex array
+// Return: bounds (all zero for an empty array)
+template <typename T>
+MeshBounds<T> MeshComputeBounds(const Vertex<T>* vertices, size_t num_vertices)
+{
+	MeshBounds<T> bounds;
+	if (num_vertices == 0)
+		return bounds;
+
+	bounds.min = bounds.max = vertices[0].pos;
+	for (size_t i = 1; i < num_vertices; i++)
+	{
+		const Vec3<T>& p = vertices[i].pos;
+		bounds.min.x = std::min(bounds.min.x, p.x); bounds.max.x = std::max(bounds.max.x, p.x);
+		bounds.min.y = std::min(bounds.min.y, p.y); bounds.max.y = std::max(bounds.max.y, p.y);
+		bounds.min.z = std::min(bounds.min.z, p.z); bounds.max.z = std::max(bounds.max.z, p.z);
+	}
+
+	bounds.center = Vec3<T>((bounds.min.x + bounds.max.x) / 2, (bounds.min.y + bounds.max.y) / 2,
+		(bounds.min.z + bounds.max.z) / 2);
+	T radius2 = 0;
+	for (size_t i = 0; i < num_vertices; i++)
+	{
+		Vec3<T> d = vertices[i].pos - bounds.center;
+		radius2 = std::max(radius2, d.x * d.x + d.y * d.y + d.z * d.z);
+	}
+	bounds.radius = std::sqrt(radius2);
+
+	return bounds;
+}
+
+// VERTEX FORMAT
+// GPU-side vertex layout (CPU-side vertices are always Vertex<T>)
+enum MeshVertexFormat
+{
+	MESH_VERTEX_FLOAT,		// Vertex<T> as is (32 bytes with float)
+	MESH_VERTEX_COMPACT		// VertexCompact (16 bytes), decode in shader with MESH_COMPACT_GLSL
+};
+
+// COMPACT VERTEX
+// Position: unorm16 within mesh bounds (dequantize with mesh_dequant)
+// Normal: octahedral snorm16
+// UV: half float
+struct VertexCompact
+{
+	uint16_t pos[4];		// xyz, w unused (padding)
+	int16_t norm[2];
+	uint16_t uv[2];
+};
+
+// Vertex shader helpers for MESH_VERTEX_COMPACT
+// Attribute locations are unchanged: 0 = vec3 position (normalized), 1 = vec2 normal (normalized), 2 = vec2 uv
+const char MESH_COMPACT_GLSL[] =
+	"uniform mat4 mesh_dequant;\n"
+	"vec3 meshDecodePosition(vec3 q)\n"
+	"{\n"
+	"	return (mesh_dequant * vec4(q, 1.0)).xyz;\n"
+	"}\n"
+	"vec3 meshDecodeNormal(vec2 e)\n"
+	"{\n"
+	"	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));\n"
+	"	float t = max(-n.z, 0.0);\n"
+	"	n.x += n.x >= 0.0 ? -t : t;\n"
+	"	n.y += n.y >= 0.0 ? -t : t;\n"
+	"	return normalize(n);\n"
+	"}\n";
+
+// Convert float to IEEE half (round to nearest even)
+uint16_t MeshFloatToHalf(float f)
+{
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t abs = x & 0x7FFFFFFF;
+
+	if (abs >= 0x7F800000)	// Inf / NaN
+		return uint16_t(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0));
+	if (abs >= 0x477FF000)	// Overflow
+		return uint16_t(sign | 0x7C00);
+	if (abs < 0x38800000)	// Denormal / zero
+	{
+		if (abs < 0x33000000)
+			return uint16_t(sign);
+		uint32_t mant = (abs & 0x007FFFFF) | 0x00800000;
+		uint32_t shift = 113 - (abs >> 23) + 13;
+		uint32_t half = mant >> shift;
+		uint32_t rem = mant & ((1u << shift) - 1);
+		uint32_t mid = 1u << (shift - 1);
+		if (rem > mid || (rem == mid && (half & 1)))
+			half++;
+		return uint16_t(sign | half);
+	}
+
+	uint32_t half = ((abs - 0x38000000) >> 13);
+	uint32_t rem = abs & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+		half++;
+	return uint16_t(sign | half);
+}
+
+// Encode unit vector to octahedral snorm16
+void MeshEncodeOctahedral(float x, float y, float z, int16_t out[2])
+{
+	float l1 = std::fabs(x) + std::fabs(y) + std::fabs(z);
+	if (l1 == 0)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	x /= l1;
+	y /= l1;
+	if (z < 0)
+	{
+		float ox = (1 - std::fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float oy = (1 - std::fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = ox;
+		y = oy;
+	}
+	out[0] = int16_t(std::lround(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f));
+	out[1] = int16_t(std::lround(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f));
+}
+
+// Encode vertices to compact format
+// dequant = output column-major matrix mapping normalized positions back to object space
+template <typename T>
+void MeshEncodeCompact(const Vertex<T>* vertices, size_t num_vertices, const MeshBounds<T>& bounds,
+	VertexCompact* out, GLfloat dequant[16])
+{
+	double lo[3] = { double(bounds.min.x), double(bounds.min.y), double(bounds.min.z) };
+	double ext[3] = { double(bounds.max.x) - lo[0], double(bounds.max.y) - lo[1], double(bounds.max.z) - lo[2] };
+	double scale[3];
+	for (int c = 0; c < 3; c++)
+		scale[c] = ext[c] > 0 ? 65535.0 / ext[c] : 0.0;
+
+	for (size_t i = 0; i < num_vertices; i++)
+	{
+		const Vertex<T>& v = vertices[i];
+		double p[3] = { double(v.pos.x), double(v.pos.y), double(v.pos.z) };
+		for (int c = 0; c < 3; c++)
+			out[i].pos[c] = uint16_t(std::lround(std::max(0.0, std::min(65535.0, (p[c] - lo[c]) * scale[c]))));
+		out[i].pos[3] = 0;
+		MeshEncodeOctahedral(float(v.norm.x), float(v.norm.y), float(v.norm.z), out[i].norm);
+		out[i].uv[0] = MeshFloatToHalf(float(v.uv.x));
+		out[i].uv[1] = MeshFloatToHalf(float(v.uv.y));
+	}
+
+	std::memset(dequant, 0, 16 * sizeof(GLfloat));
+	dequant[0] = GLfloat(ext[0]);
+	dequant[5] = GLfloat(ext[1]);
+	dequant[10] = GLfloat(ext[2]);
+	dequant[12] = GLfloat(lo[0]);
+	dequant[13] = GLfloat(lo[1]);
+	dequant[14] = GLfloat(lo[2]);
+	dequant[15] = 1;
+}
+
+// Per-instance vertex attribute locations (see InstanceBuffer)
+#define MESH_ATTRIB_INSTANCE_TRANSFORM 3	// mat4, occupies locations 3-6
+#define MESH_ATTRIB_INSTANCE_DATA 7			// vec4
+
+// INSTANCE ATTRIBUTES
+// Layout of one instance in the instance buffer
+struct InstanceAttribs
+{
+	GLfloat transform[16];	// Column-major model matrix
+	GLfloat data[4];		// User data (zero when not supplied)
+};
+
+// INSTANCE BUFFER
+// Streamed per-instance attributes for instanced draws (orphaned and refilled every upload)
+class InstanceBuffer
+{
+private:
+	GLuint vbo = 0;
+	uint64_t serial = 0;	// Unique per GL buffer created (names are reused after deletion, serials are not)
+	size_t capacity = 0;	// Instances
+public:
+	InstanceBuffer() {}
+	InstanceBuffer(const InstanceBuffer&) = delete;
+	InstanceBuffer(InstanceBuffer&& other) : vbo(other.vbo), serial(other.serial), capacity(other.capacity)
+	{
+		other.vbo = 0;
+		other.serial = 0;
+		other.capacity = 0;
+	}
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+	InstanceBuffer& operator=(InstanceBuffer&&) = delete;
+	~InstanceBuffer() { if (vbo) StateCache::get().deleteBuffer(vbo); }
+
+	GLuint getID() const { return vbo; }
+	uint64_t getSerial() const { return serial; }
+	bool upload(const GLfloat* transforms, const GLfloat* data, size_t count);
+};
+
+// Upload instance attributes
+// transforms = count column-major 4x4 matrices
+// data = optional count vec4s (nullptr: zero)
+// Return: true on success
+bool InstanceBuffer::upload(const GLfloat* transforms, const GLfloat* data, size_t count)
+{
+	static uint64_t next_serial = 0;
+	if (!this->vbo)
+	{
+		glGenBuffers(1, &this->vbo);
+		this->serial = ++next_serial;
+	}
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, this->vbo);
+
+	// Grow geometrically; re-specifying the store orphans data still in use by earlier draws
+	if (count > this->capacity)
+		this->capacity = std::max(count, this->capacity * 2);
+	glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(InstanceAttribs), nullptr, GL_STREAM_DRAW);
+
+	InstanceAttribs* dst = static_cast<InstanceAttribs*>(glMapBufferRange(GL_ARRAY_BUFFER, 0,
+		count * sizeof(InstanceAttribs), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	if (!dst)
+	{
+		fprintf(stderr, "Could not map instance buffer\n");
+		StateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		std::memcpy(dst[i].transform, transforms + i * 16, sizeof(dst[i].transform));
+		if (data)
+			std::memcpy(dst[i].data, data + i * 4, sizeof(dst[i].data));
+		else
+			std::memset(dst[i].data, 0, sizeof(dst[i].data));
+	}
+
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+// Set vertex attribute pointers for the bound VAO / VBO
+template <typename T>
+void MeshSetupVertexAttribs(MeshVertexFormat format)
+{
+	if (format == MESH_VERTEX_COMPACT)
+	{
+		// Vertex Positions (unorm16)
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(VertexCompact), (GLvoid*)offsetof(VertexCompact, pos));
+		// Vertex Normals (octahedral snorm16)
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(VertexCompact), (GLvoid*)offsetof(VertexCompact, norm));
+		// Vertex Texture Coords (half float)
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(VertexCompact), (GLvoid*)offsetof(VertexCompact, uv));
+	}
+	else
+	{
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)0);
+		// Vertex Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)offsetof(Vertex<T>, norm));
+		// Vertex Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)offsetof(Vertex<T>, uv));
+	}
+}
+
+// Attribute setup callbacks for the geometry pool
+template <typename T>
+void MeshSetupFloatAttribs() { MeshSetupVertexAttribs<T>(MESH_VERTEX_FLOAT); }
+template <typename T>
+void MeshSetupCompactAttribs() { MeshSetupVertexAttribs<T>(MESH_VERTEX_COMPACT); }
+
+// MESH DATA
+// CPU-side converted mesh, before any OpenGL objects are created
+template <typename T = float>
+struct MeshData
+{
+	std::vector<Vertex<T>> vertices;
+	std::vector<GLuint> indices;			// All LODs, LOD 0 first
+	std::vector<TextureRef> texture_refs;
+	std::vector<MeshLOD> lods;				// Index ranges (empty: indices are a single LOD)
+};
+
 
 // MESH CLASS
 template <typename T = float>
 class Mesh
 {
 private:
-	GLuint VAO, VBO, EBO;	// OpenGL render buffer IDs
+	GLuint VAO = 0, VBO = 0, EBO = 0;	// OpenGL render buffer IDs (unused when pooled)
+	GeometryRange geometry;	// Range in the shared geometry pool (pooled meshes)
+	MeshVertexFormat format;
+	GLenum index_type;		// GL_UNSIGNED_SHORT below 65536 vertices, else GL_UNSIGNED_INT
+	size_t gpu_bytes = 0;	// Vertex + index buffer size
+	GLfloat dequant[16];	// Compact position dequantization (column-major)
 
-	void setupMesh();
+	uint64_t instance_serial = 0;	// InstanceBuffer::getSerial() of the buffer bound to the per-instance attributes
+	std::unique_ptr<TriangleBVH> bvh;	// Ray casting acceleration (built on first raycast)
+
+	void setupMesh(const Vertex<T>* vertex_data, const GLuint* index_data, bool use_pool);
+	void setupLODs();
+	void setupInstancing(const InstanceBuffer& instances);
+	void drawElements(size_t lod, GLsizei instances);
 public:
 	std::vector<Vertex<T>> vertices;
-	std::vector<GLuint> indices;
+	std::vector<GLuint> indices;	// All LODs, LOD 0 first
 	std::vector<Texture> textures;
+	std::vector<MeshLOD> lods;		// At least one entry (LOD 0 = full detail)
+	MeshBounds<T> bounds;
 
-	Mesh(std::vector <Vertex<T>> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
-	void draw(GLuint shader_id);
+	Mesh(std::vector <Vertex<T>> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+		std::vector<MeshLOD> lods = std::vector<MeshLOD>(), MeshVertexFormat format = MESH_VERTEX_FLOAT,
+		bool use_pool = false);
+	Mesh(const Vertex<T>* vertex_data, size_t num_vertices, const GLuint* index_data, size_t num_indices,
+		std::vector<Texture> textures, std::vector<MeshLOD> lods = std::vector<MeshLOD>(),
+		MeshVertexFormat format = MESH_VERTEX_FLOAT, bool use_pool = false);
+	bool isPooled() const { return bool(geometry); }
+	MeshVertexFormat getVertexFormat() const { return format; }
+	GLenum getIndexType() const { return index_type; }
+	size_t getGPUBytes() const { return gpu_bytes; }
+	const GLfloat* getDequant() const { return dequant; }
+	GLuint getVAO() const { return geometry ? geometry.getBuffer()->getVAO() : VAO; }
+	uint32_t getMaterialKey() const;
+	bool hasSameTextures(const Mesh& other) const;
+	size_t selectLOD(T pixels_per_unit, T max_pixel_error, T hysteresis = 0, size_t previous = 0) const;
+	void draw(GLuint shader_id, size_t lod = 0);
+	void drawGeometry(size_t lod = 0) { drawElements(lod, 0); }	// Without binding the material
+	void drawInstanced(GLuint shader_id, const InstanceBuffer& instances, GLsizei count, size_t lod = 0);
+	bool addIndirect(IndirectBatch& batch, size_t lod, uint32_t material, IndirectDrawData& data) const;
+	void bindMaterial(GLuint shader_id);
+	void buildRaycast();
+	bool raycast(const Vec3<T>& origin, const Vec3<T>& dir, T t_max, RayHit& hit);
 };
 
+// Constructor (buffers are moved in; pass rvalues to avoid copies)
+template <typename T>
+Mesh<T>::Mesh(std::vector<Vertex<T>> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+	std::vector<MeshLOD> lods, MeshVertexFormat format, bool use_pool)
+	: format(format), vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)),
+	lods(std::move(lods))
+{
+	this->setupMesh(this->vertices.data(), this->indices.data(), use_pool);
+	this->setupLODs();
+}
+
+// Constructor from raw buffers (e.g. a memory-mapped mesh cache)
+// Buffers are uploaded directly, then copied to the CPU-side vectors
 template <typename T>
-Mesh<T>::Mesh(std::vector<Vertex<T>> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+Mesh<T>::Mesh(const Vertex<T>* vertex_data, size_t num_vertices, const GLuint* index_data, size_t num_indices,
+	std::vector<Texture> textures, std::vector<MeshLOD> lods, MeshVertexFormat format, bool use_pool)
+	: format(format), textures(std::move(textures)), lods(std::move(lods))
 {
-	this->vertices = vertices;
-	this->indices = indices;
-	this->textures = textures;
-	
-	this->setupMesh();
+	this->vertices.resize(num_vertices);
+	this->indices.resize(num_indices);
+
+	this->setupMesh(vertex_data, index_data, use_pool);
+
+	std::memcpy(this->vertices.data(), vertex_data, num_vertices * sizeof(Vertex<T>));
+	std::memcpy(this->indices.data(), index_data, num_indices * sizeof(GLuint));
+	this->setupLODs();
 }
 
+// Default to a single LOD
 template <typename T>
-void Mesh<T>::setupMesh()
+void Mesh<T>::setupLODs()
 {
+	if (this->lods.empty())
+		this->lods.push_back({ 0, GLuint(this->indices.size()), 0.0f });
+}
+
+// Select the coarsest LOD whose projected error is within max_pixel_error
+// pixels_per_unit = screen pixels covered by one object-space unit at the mesh's distance
+// hysteresis = fraction by which a coarser LOD must beat the threshold before switching (avoids popping)
+// previous = LOD selected last time at the same draw site (hysteresis state is kept by the caller)
+// Return: selected LOD index
+template <typename T>
+size_t Mesh<T>::selectLOD(T pixels_per_unit, T max_pixel_error, T hysteresis, size_t previous) const
+{
+	T extent = this->bounds.extent();
+	size_t lod = 0;
+
+	// LOD errors increase monotonically
+	for (size_t i = 1; i < this->lods.size(); i++)
+	{
+		T error_px = T(this->lods[i].error) * extent * pixels_per_unit;
+		T limit = i > previous ? max_pixel_error * (1 - hysteresis) : max_pixel_error;
+		if (error_px > limit)
+			break;
+		lod = i;
+	}
+
+	return lod;
+}
+
+// use_pool = sub-allocate from the shared geometry pool instead of creating buffers (falls back on failure)
+template <typename T>
+void Mesh<T>::setupMesh(const Vertex<T>* vertex_data, const GLuint* index_data, bool use_pool)
+{
+	size_t num_vertices = this->vertices.size();
+	size_t num_indices = this->indices.size();
+	this->bounds = MeshComputeBounds(vertex_data, num_vertices);
+
+	// Vertex data in GPU layout
+	const void* gpu_vertices = vertex_data;
+	GLsizei vertex_size = sizeof(Vertex<T>);
+	std::vector<VertexCompact> compact;
+	if (this->format == MESH_VERTEX_COMPACT)
+	{
+		compact.resize(num_vertices);
+		MeshEncodeCompact(vertex_data, num_vertices, this->bounds, compact.data(), this->dequant);
+		gpu_vertices = compact.data();
+		vertex_size = sizeof(VertexCompact);
+	}
+
+	// 16-bit indices when every vertex is addressable
+	const void* gpu_indices = index_data;
+	GLsizei index_size = sizeof(GLuint);
+	std::vector<uint16_t> short_indices;
+	this->index_type = GL_UNSIGNED_INT;
+	if (num_vertices <= 0x10000)
+	{
+		short_indices.assign(index_data, index_data + num_indices);
+		gpu_indices = short_indices.data();
+		index_size = sizeof(uint16_t);
+		this->index_type = GL_UNSIGNED_SHORT;
+	}
+	this->gpu_bytes = num_vertices * vertex_size + num_indices * index_size;
+
+	if (use_pool && num_vertices > 0 && num_indices > 0)
+	{
+		GeometryBuffer& buffer = GeometryPool::get().getBuffer(this->format, vertex_size, this->index_type,
+			this->format == MESH_VERTEX_COMPACT ? &MeshSetupCompactAttribs<T> : &MeshSetupFloatAttribs<T>);
+		uint32_t slot = buffer.allocate(gpu_vertices, num_vertices, gpu_indices, num_indices);
+		if (slot != GEOMETRY_NO_SLOT)
+		{
+			this->geometry = GeometryRange(&buffer, slot);
+			return;
+		}
+	}
+
 	glGenVertexArrays(1, &this->VAO);
 	glGenBuffers(1, &this->VBO);
 	glGenBuffers(1, &this->EBO);
 
-	glBindVertexArray(this->VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+	StateCache::get().bindVertexArray(this->VAO);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, this->VBO);
+	glBufferData(GL_ARRAY_BUFFER, num_vertices * vertex_size, gpu_vertices, GL_STATIC_DRAW);
+
+	StateCache::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * index_size, gpu_indices, GL_STATIC_DRAW);
+
+	MeshSetupVertexAttribs<T>(this->format);
 
-	glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex<T>), &this->vertices[0], GL_STATIC_DRAW);
+	StateCache::get().bindVertexArray(0);
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+// Point the VAO's per-instance attributes at an instance buffer (divisor 1)
+// Pooled meshes share the VAO, so the binding is tracked per geometry buffer. Bindings are tracked by buffer serial,
+// not GL name: a deleted instance buffer's name can come back for a new buffer while the VAO still holds the old one.
+template <typename T>
+void Mesh<T>::setupInstancing(const InstanceBuffer& instances)
+{
+	StateCache::get().bindVertexArray(this->geometry ? this->geometry.getBuffer()->getVAO() : this->VAO);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, instances.getID());
 
-	// Vertex Positions
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)0);
-	// Vertex Normals
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)offsetof(Vertex<T>, norm));
-	// Vertex Texture Coords
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex<T>), (GLvoid*)offsetof(Vertex<T>, uv));
+	for (GLuint col = 0; col < 4; col++)
+	{
+		glEnableVertexAttribArray(MESH_ATTRIB_INSTANCE_TRANSFORM + col);
+		glVertexAttribPointer(MESH_ATTRIB_INSTANCE_TRANSFORM + col, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAttribs),
+			(GLvoid*)(offsetof(InstanceAttribs, transform) + col * 4 * sizeof(GLfloat)));
+		glVertexAttribDivisor(MESH_ATTRIB_INSTANCE_TRANSFORM + col, 1);
+	}
+	glEnableVertexAttribArray(MESH_ATTRIB_INSTANCE_DATA);
+	glVertexAttribPointer(MESH_ATTRIB_INSTANCE_DATA, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAttribs),
+		(GLvoid*)offsetof(InstanceAttribs, data));
+	glVertexAttribDivisor(MESH_ATTRIB_INSTANCE_DATA, 1);
 
-	glBindVertexArray(0);
+	StateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+	if (this->geometry)
+		this->geometry.getBuffer()->instance_serial = instances.getSerial();
+	else
+		this->instance_serial = instances.getSerial();
 }
 
+// Issue the draw call for one LOD (instances = 0: non-instanced)
+// The VAO is left bound; the state cache skips the rebind when the next draw uses the same one
+template <typename T>
+void Mesh<T>::drawElements(size_t lod, GLsizei instances)
+{
+	const MeshLOD& range = this->lods[std::min(lod, this->lods.size() - 1)];
+	size_t index_size = this->index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(GLuint);
+	size_t first_index = range.first_index;
+	GLint base_vertex = 0;
+
+	if (this->geometry)
+	{
+		const GeometrySlot& slot = this->geometry.getSlot();
+		StateCache::get().bindVertexArray(this->geometry.getBuffer()->getVAO());
+		first_index += slot.index_offset;
+		base_vertex = GLint(slot.vertex_offset);
+	}
+	else
+		StateCache::get().bindVertexArray(this->VAO);
+
+	if (instances > 0)
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.num_indices, this->index_type,
+			(GLvoid*)(first_index * index_size), instances, base_vertex);
+	else if (base_vertex != 0)
+		glDrawElementsBaseVertex(GL_TRIANGLES, range.num_indices, this->index_type, (GLvoid*)(first_index * index_size),
+			base_vertex);
+	else
+		glDrawElements(GL_TRIANGLES, range.num_indices, this->index_type, (GLvoid*)(first_index * index_size));
+
+	RendFrameStats& stats = FrameStats::get().counters();
+	stats.draw_calls++;
+	stats.instances += instances;
+}
+
+// lod = level of detail to draw (clamped to the coarsest available)
+template <typename T>
+void Mesh<T>::draw(GLuint shader_id, size_t lod)
+{
+	this->bindMaterial(shader_id);
+	this->drawElements(lod, 0);
+}
+
+// Draw count instances with per-instance attributes from an instance buffer (one draw call)
+// Shader reads the instance transform at MESH_ATTRIB_INSTANCE_TRANSFORM and data at MESH_ATTRIB_INSTANCE_DATA
+template <typename T>
+void Mesh<T>::drawInstanced(GLuint shader_id, const InstanceBuffer& instances, GLsizei count, size_t lod)
+{
+	if (count <= 0 || !instances.getID())
+		return;
+	uint64_t bound = this->geometry ? this->geometry.getBuffer()->instance_serial : this->instance_serial;
+	if (bound != instances.getSerial())
+		this->setupInstancing(instances);
+
+	this->bindMaterial(shader_id);
+	this->drawElements(lod, count);
+}
+
+// Return: hash of the texture set (equal for meshes with the same textures)
+template <typename T>
+uint32_t Mesh<T>::getMaterialKey() const
+{
+	uint32_t hash = 2166136261u;
+	for (const Texture& texture : this->textures)
+		hash = (hash ^ texture.id) * 16777619u;
+	return hash;
+}
+
+// Return: true if both meshes bind the same textures to the same units
+template <typename T>
+bool Mesh<T>::hasSameTextures(const Mesh& other) const
+{
+	if (this->textures.size() != other.textures.size())
+		return false;
+	for (size_t i = 0; i < this->textures.size(); i++)
+	{
+		if (this->textures[i].id != other.textures[i].id || this->textures[i].type != other.textures[i].type)
+			return false;
+	}
+	return true;
+}
+
+// Queue a draw of one LOD in an indirect batch (pooled meshes only)
+// data = per-draw shader data with the model matrix set (dequantization is filled in)
+// Return: false if the mesh is not pooled
+template <typename T>
+bool Mesh<T>::addIndirect(IndirectBatch& batch, size_t lod, uint32_t material, IndirectDrawData& data) const
+{
+	if (!this->geometry)
+		return false;
+
+	const MeshLOD& range = this->lods[std::min(lod, this->lods.size() - 1)];
+	for (int c = 0; c < 3; c++)
+	{
+		data.dequant_scale[c] = this->format == MESH_VERTEX_COMPACT ? this->dequant[c * 5] : 1.0f;
+		data.dequant_offset[c] = this->format == MESH_VERTEX_COMPACT ? this->dequant[12 + c] : 0.0f;
+	}
+	data.dequant_scale[3] = 1.0f;
+	data.dequant_offset[3] = 0.0f;
+	data.material[0] = material;
+	data.material[1] = data.material[2] = data.material[3] = 0;
+
+	batch.add(this->geometry.getBuffer(), this->geometry.getSlot(), range.first_index, range.num_indices, material, data);
+	return true;
+}
+
+// Bind textures and set material / vertex format uniforms
 // TODO: use array im shader for texture uniforms instead of named?
 template <typename T>
-void Mesh<T>::draw(GLuint shader_id)
+void Mesh<T>::bindMaterial(GLuint shader_id)
 {
+	const ShaderLocations& loc = ShaderLocationCache::get().getLocations(shader_id);
+
 	GLuint diffuse_num = 0;
 	GLuint specular_num = 0;
 	for (GLuint i = 0; i < this->textures.size(); i++)
 	{
-		glActiveTexture(GL_TEXTURE0 + i); // Activate proper texture unit before binding
-										  // Retrieve texture number (the N in diffuse_textureN)
-		std::stringstream ss;
-		std::string number;
-		std::string name = this->textures[i].type;
-		if (name == "texture_diffuse")
-			ss << "[" << ++diffuse_num << "]"; // Transfer GLuint to stream
-		else if (name == "texture_specular")
-			ss << "[" << ++specular_num << "]"; // Transfer GLuint to stream
-		number = ss.str();
+		// Sampler location from texture number (the N in texture_diffuseN); other types have no sampler
+		GLint location = -1;
+		const std::string& name = this->textures[i].type;
+		if (name == "texture_diffuse" && ++diffuse_num <= SHADER_MAX_MATERIAL_TEXTURES)
+			location = loc.tex_diffuse[diffuse_num - 1];
+		else if (name == "texture_specular" && ++specular_num <= SHADER_MAX_MATERIAL_TEXTURES)
+			location = loc.tex_specular[specular_num - 1];
 
-		glUniform1f(glGetUniformLocation(shader_id, ("material." + name + number).c_str()), float(i));
+		glUniform1i(location, GLint(i));
 
-		glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		// Unit is only activated if its binding changes
+		StateCache::get().bindTextureUnit(i, GL_TEXTURE_2D, this->textures[i].id);
 	}
 
 	// Set number of diffuse and specular textures
-	glUniform1ui(glGetUniformLocation(shader_id, "material.num_tex_diffuse"), diffuse_num);
-	glUniform1ui(glGetUniformLocation(shader_id, "material.num_tex_specular"), specular_num);
+	glUniform1ui(loc.num_tex_diffuse, diffuse_num);
+	glUniform1ui(loc.num_tex_specular, specular_num);
+
+	if (this->format == MESH_VERTEX_COMPACT)
+		glUniformMatrix4fv(loc.mesh_dequant, 1, GL_FALSE, this->dequant);
+}
 
-	glActiveTexture(GL_TEXTURE0);
+// Build the triangle BVH of LOD 0 if it does not exist yet (raycast builds it on first use otherwise)
+template <typename T>
+void Mesh<T>::buildRaycast()
+{
+	if (this->bvh || this->vertices.empty())
+		return;
+
+	this->bvh.reset(new TriangleBVH());
+	const MeshLOD& lod = this->lods[0];
+	if (std::is_same<T, float>::value)
+	{
+		this->bvh->build(reinterpret_cast<const float*>(&this->vertices[0].pos), sizeof(Vertex<T>),
+			this->indices.data() + lod.first_index, lod.num_indices);
+	}
+	else
+	{
+		std::vector<float> positions(this->vertices.size() * 3);
+		for (size_t i = 0; i < this->vertices.size(); i++)
+		{
+			positions[i * 3] = float(this->vertices[i].pos.x);
+			positions[i * 3 + 1] = float(this->vertices[i].pos.y);
+			positions[i * 3 + 2] = float(this->vertices[i].pos.z);
+		}
+		this->bvh->build(positions.data(), sizeof(float) * 3, this->indices.data() + lod.first_index, lod.num_indices);
+	}
+}
+
+// Cast a ray against LOD 0 (the triangle BVH is built on the first call)
+// origin, dir = ray in mesh space, t_max = far limit along dir
+// hit = triangle, barycentrics and ray parameter of the closest hit
+// Return: true on a hit closer than t_max
+template <typename T>
+bool Mesh<T>::raycast(const Vec3<T>& origin, const Vec3<T>& dir, T t_max, RayHit& hit)
+{
+	if (this->vertices.empty())
+		return false;
+	this->buildRaycast();
 
-	// Draw mesh
-	glBindVertexArray(this->VAO);
-	glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	const float o[3] = { float(origin.x), float(origin.y), float(origin.z) };
+	const float d[3] = { float(dir.x), float(dir.y), float(dir.z) };
+	return this->bvh->intersect(o, d, float(t_max), hit);
 }
 
 #endif
@@ -0,0 +1,418 @@
+// *****************************************************************************************************************************
+// gl_mesh_cache.hpp
+// OpenGL Rendering
+// Binary mesh cache (converted vertex/index buffers, skips Assimp on warm starts)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_MESH_CACHE_HPP
+#define GL_MESH_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include "gl_cache.hpp"
+#include "gl_mesh.hpp"
+#include "gl_hierarchy.hpp"
+
+// File layout (native endianness, all offsets in bytes from start of file):
+//   MeshCacheHeader
+//   MeshCacheEntry[num_meshes]
+//   MeshCacheTexRef[num_tex_refs]
+//   MeshLOD[num_lods]
+//   MeshCacheNode[num_nodes] (depth-first order)
+//   uint32_t mesh_refs[num_mesh_refs] (mesh indices drawn per node)
+//   string data (texture types and paths, not null-terminated)
+//   vertex and index arrays (16-byte aligned, directly uploadable)
+
+#define MESH_CACHE_MAGIC 0x434D4C47		// "GLMC"
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_ALIGN 16
+
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t import_flags;		// Assimp post-processing flags used for the import
+	uint32_t real_size;			// sizeof(T)
+	uint32_t vertex_size;		// sizeof(Vertex<T>)
+	uint32_t num_meshes;
+	uint32_t num_tex_refs;
+	uint32_t options;			// Model processing options that change the converted data
+	uint32_t num_lods;
+	uint32_t num_nodes;
+	uint32_t num_mesh_refs;
+	uint32_t reserved;
+	int64_t source_mtime;		// Source file stamp
+	uint64_t source_size;
+	uint64_t source_path_hash;	// Hash of canonical source path
+	uint64_t string_offset;
+	uint64_t string_size;
+};
+
+struct MeshCacheEntry
+{
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t first_tex_ref;
+	uint32_t num_tex_refs;
+	uint32_t first_lod;
+	uint32_t num_lods;			// 0: indices are a single LOD
+};
+
+struct MeshCacheNode
+{
+	int32_t parent;
+	uint32_t first_mesh_ref;
+	uint32_t num_mesh_refs;
+	uint32_t name_offset;		// Relative to header string_offset
+	uint32_t name_len;
+	float local[16];			// Column-major
+};
+
+struct MeshCacheTexRef
+{
+	uint32_t type_offset;		// Relative to header string_offset
+	uint32_t type_len;
+	uint32_t path_offset;
+	uint32_t path_len;
+};
+
+// Hash of canonical source path (cache key component)
+uint64_t MeshCachePathHash(const std::string& source_path)
+{
+	std::error_code ec;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(source_path, ec);
+
+	return CacheHash(ec ? source_path : canonical.generic_string());
+}
+
+// Get default cache file path for a source model
+// cache_dir = directory for cache files (empty: next to source)
+std::string MeshCacheGetPath(const std::string& source_path, const std::string& cache_dir)
+{
+	if (cache_dir.empty())
+		return source_path + ".mcache";
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.mcache", (unsigned long long)MeshCachePathHash(source_path));
+
+	return cache_dir + '/' + name;
+}
+
+// Write converted meshes to cache file
+// Return: true on success
+template <typename T>
+bool MeshCacheWrite(const std::string& cache_path, const std::string& source_path, uint32_t import_flags,
+	uint32_t options, const std::vector<MeshData<T>>& meshes, const std::vector<NodeData<T>>& nodes)
+{
+	static_assert(std::is_trivially_copyable<Vertex<T>>::value, "Vertex type must be trivially copyable");
+
+	CacheFileStamp stamp;
+	if (!CacheGetFileStamp(source_path, stamp))
+		return false;
+
+	MeshCacheHeader header = {};
+	std::vector<MeshCacheEntry> entries(meshes.size());
+	std::vector<MeshCacheTexRef> tex_refs;
+	std::vector<MeshLOD> lods;
+	std::vector<MeshCacheNode> cache_nodes(nodes.size());
+	std::vector<uint32_t> mesh_refs;
+	std::string strings;
+
+	// Texture references and string table
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		entries[i].first_tex_ref = static_cast<uint32_t>(tex_refs.size());
+		entries[i].num_tex_refs = static_cast<uint32_t>(meshes[i].texture_refs.size());
+
+		for (const TextureRef& ref : meshes[i].texture_refs)
+		{
+			MeshCacheTexRef cref;
+			cref.type_offset = static_cast<uint32_t>(strings.size());
+			cref.type_len = static_cast<uint32_t>(ref.type.size());
+			strings += ref.type;
+			cref.path_offset = static_cast<uint32_t>(strings.size());
+			cref.path_len = static_cast<uint32_t>(ref.path.size());
+			strings += ref.path;
+			tex_refs.push_back(cref);
+		}
+
+		entries[i].first_lod = static_cast<uint32_t>(lods.size());
+		entries[i].num_lods = static_cast<uint32_t>(meshes[i].lods.size());
+		lods.insert(lods.end(), meshes[i].lods.begin(), meshes[i].lods.end());
+	}
+
+	// Node hierarchy
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		MeshCacheNode& cnode = cache_nodes[i];
+		cnode.parent = nodes[i].parent;
+		cnode.first_mesh_ref = static_cast<uint32_t>(mesh_refs.size());
+		cnode.num_mesh_refs = static_cast<uint32_t>(nodes[i].meshes.size());
+		cnode.name_offset = static_cast<uint32_t>(strings.size());
+		cnode.name_len = static_cast<uint32_t>(nodes[i].name.size());
+		for (int j = 0; j < 16; j++)
+			cnode.local[j] = float(nodes[i].local.m[j]);
+		strings += nodes[i].name;
+		mesh_refs.insert(mesh_refs.end(), nodes[i].meshes.begin(), nodes[i].meshes.end());
+	}
+
+	// Data offsets
+	uint64_t offset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) +
+		tex_refs.size() * sizeof(MeshCacheTexRef) + lods.size() * sizeof(MeshLOD) +
+		cache_nodes.size() * sizeof(MeshCacheNode) + mesh_refs.size() * sizeof(uint32_t);
+	header.string_offset = offset;
+	header.string_size = strings.size();
+	offset += strings.size();
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		offset = (offset + MESH_CACHE_ALIGN - 1) & ~uint64_t(MESH_CACHE_ALIGN - 1);
+		entries[i].vertex_offset = offset;
+		entries[i].num_vertices = static_cast<uint32_t>(meshes[i].vertices.size());
+		offset += meshes[i].vertices.size() * sizeof(Vertex<T>);
+
+		offset = (offset + MESH_CACHE_ALIGN - 1) & ~uint64_t(MESH_CACHE_ALIGN - 1);
+		entries[i].index_offset = offset;
+		entries[i].num_indices = static_cast<uint32_t>(meshes[i].indices.size());
+		offset += meshes[i].indices.size() * sizeof(GLuint);
+	}
+
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.import_flags = import_flags;
+	header.options = options;
+	header.real_size = sizeof(T);
+	header.vertex_size = sizeof(Vertex<T>);
+	header.num_meshes = static_cast<uint32_t>(meshes.size());
+	header.num_tex_refs = static_cast<uint32_t>(tex_refs.size());
+	header.num_lods = static_cast<uint32_t>(lods.size());
+	header.num_nodes = static_cast<uint32_t>(cache_nodes.size());
+	header.num_mesh_refs = static_cast<uint32_t>(mesh_refs.size());
+	header.source_mtime = stamp.mtime;
+	header.source_size = stamp.size;
+	header.source_path_hash = MeshCachePathHash(source_path);
+
+	// Assemble file
+	std::vector<unsigned char> buffer(static_cast<size_t>(offset), 0);
+	unsigned char* dst = buffer.data();
+	size_t pos = 0;
+
+	std::memcpy(dst + pos, &header, sizeof(header));
+	pos += sizeof(header);
+	if (!entries.empty())
+		std::memcpy(dst + pos, entries.data(), entries.size() * sizeof(MeshCacheEntry));
+	pos += entries.size() * sizeof(MeshCacheEntry);
+	if (!tex_refs.empty())
+		std::memcpy(dst + pos, tex_refs.data(), tex_refs.size() * sizeof(MeshCacheTexRef));
+	pos += tex_refs.size() * sizeof(MeshCacheTexRef);
+	if (!lods.empty())
+		std::memcpy(dst + pos, lods.data(), lods.size() * sizeof(MeshLOD));
+	pos += lods.size() * sizeof(MeshLOD);
+	if (!cache_nodes.empty())
+		std::memcpy(dst + pos, cache_nodes.data(), cache_nodes.size() * sizeof(MeshCacheNode));
+	pos += cache_nodes.size() * sizeof(MeshCacheNode);
+	if (!mesh_refs.empty())
+		std::memcpy(dst + pos, mesh_refs.data(), mesh_refs.size() * sizeof(uint32_t));
+	pos += mesh_refs.size() * sizeof(uint32_t);
+	if (!strings.empty())
+		std::memcpy(dst + pos, strings.data(), strings.size());
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (!meshes[i].vertices.empty())
+			std::memcpy(dst + entries[i].vertex_offset, meshes[i].vertices.data(),
+				meshes[i].vertices.size() * sizeof(Vertex<T>));
+		if (!meshes[i].indices.empty())
+			std::memcpy(dst + entries[i].index_offset, meshes[i].indices.data(),
+				meshes[i].indices.size() * sizeof(GLuint));
+	}
+
+	return CacheWriteFile(cache_path, buffer.data(), buffer.size());
+}
+
+// MESH CACHE READER
+// Validates and exposes a memory-mapped cache file
+template <typename T = float>
+class MeshCacheReader
+{
+private:
+	MappedFile file;
+	const MeshCacheHeader* header = nullptr;
+	const MeshCacheEntry* entries = nullptr;
+	const MeshCacheTexRef* tex_refs = nullptr;
+	const MeshLOD* lods = nullptr;
+	const MeshCacheNode* nodes = nullptr;
+	const uint32_t* mesh_refs = nullptr;
+	const char* strings = nullptr;
+
+	bool validate(const std::string& source_path, uint32_t import_flags, uint32_t options);
+public:
+	bool open(const std::string& cache_path, const std::string& source_path, uint32_t import_flags, uint32_t options);
+	void close() { file.close(); header = nullptr; }
+
+	size_t numMeshes() const { return header ? header->num_meshes : 0; }
+	size_t numVertices(size_t i) const { return entries[i].num_vertices; }
+	size_t numIndices(size_t i) const { return entries[i].num_indices; }
+	const Vertex<T>* vertices(size_t i) const
+		{ return reinterpret_cast<const Vertex<T>*>(file.data() + entries[i].vertex_offset); }
+	const GLuint* indices(size_t i) const
+		{ return reinterpret_cast<const GLuint*>(file.data() + entries[i].index_offset); }
+	std::vector<TextureRef> textureRefs(size_t i) const;
+	std::vector<MeshLOD> meshLODs(size_t i) const
+		{ return std::vector<MeshLOD>(lods + entries[i].first_lod, lods + entries[i].first_lod + entries[i].num_lods); }
+	std::vector<NodeData<T>> nodeData() const;
+};
+
+// Open and validate cache file against source file and import settings
+// Return: true if cache is present and current
+template <typename T>
+bool MeshCacheReader<T>::open(const std::string& cache_path, const std::string& source_path, uint32_t import_flags,
+	uint32_t options)
+{
+	close();
+
+	if (!file.open(cache_path))
+		return false;
+
+	if (!validate(source_path, import_flags, options))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+bool MeshCacheReader<T>::validate(const std::string& source_path, uint32_t import_flags, uint32_t options)
+{
+	const unsigned char* base = file.data();
+	size_t size = file.size();
+
+	if (size < sizeof(MeshCacheHeader))
+		return false;
+
+	header = reinterpret_cast<const MeshCacheHeader*>(base);
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+		header->import_flags != import_flags || header->options != options || header->real_size != sizeof(T) ||
+		header->vertex_size != sizeof(Vertex<T>))
+		return false;
+
+	// Stale check
+	CacheFileStamp stamp;
+	if (!CacheGetFileStamp(source_path, stamp))
+		return false;
+	if (header->source_mtime != stamp.mtime || header->source_size != stamp.size ||
+		header->source_path_hash != MeshCachePathHash(source_path))
+		return false;
+
+	// Bounds checks (offsets come from the file, so compare against the remaining size instead of adding to them)
+	uint64_t tables_end = sizeof(MeshCacheHeader) + uint64_t(header->num_meshes) * sizeof(MeshCacheEntry) +
+		uint64_t(header->num_tex_refs) * sizeof(MeshCacheTexRef) + uint64_t(header->num_lods) * sizeof(MeshLOD) +
+		uint64_t(header->num_nodes) * sizeof(MeshCacheNode) + uint64_t(header->num_mesh_refs) * sizeof(uint32_t);
+	if (tables_end > size || header->string_offset < tables_end || header->string_offset > size ||
+		header->string_size > size - header->string_offset)
+		return false;
+
+	entries = reinterpret_cast<const MeshCacheEntry*>(base + sizeof(MeshCacheHeader));
+	tex_refs = reinterpret_cast<const MeshCacheTexRef*>(entries + header->num_meshes);
+	lods = reinterpret_cast<const MeshLOD*>(tex_refs + header->num_tex_refs);
+	nodes = reinterpret_cast<const MeshCacheNode*>(lods + header->num_lods);
+	mesh_refs = reinterpret_cast<const uint32_t*>(nodes + header->num_nodes);
+	strings = reinterpret_cast<const char*>(base + header->string_offset);
+
+	for (uint32_t i = 0; i < header->num_meshes; i++)
+	{
+		const MeshCacheEntry& e = entries[i];
+		if (e.vertex_offset % MESH_CACHE_ALIGN != 0 || e.index_offset % MESH_CACHE_ALIGN != 0)
+			return false;
+		if (e.vertex_offset > size || uint64_t(e.num_vertices) * sizeof(Vertex<T>) > size - e.vertex_offset ||
+			e.index_offset > size || uint64_t(e.num_indices) * sizeof(GLuint) > size - e.index_offset)
+			return false;
+		if (uint64_t(e.first_tex_ref) + e.num_tex_refs > header->num_tex_refs ||
+			uint64_t(e.first_lod) + e.num_lods > header->num_lods)
+			return false;
+		for (uint32_t j = 0; j < e.num_lods; j++)
+		{
+			if (uint64_t(lods[e.first_lod + j].first_index) + lods[e.first_lod + j].num_indices > e.num_indices)
+				return false;
+		}
+
+		// Indices are used on the CPU (bounds, raycast BVH, compaction) and by the GPU without further checks
+		const GLuint* indices = reinterpret_cast<const GLuint*>(base + e.index_offset);
+		for (uint32_t j = 0; j < e.num_indices; j++)
+		{
+			if (indices[j] >= e.num_vertices)
+				return false;
+		}
+	}
+
+	// Nodes must be in depth-first order (parent before child) and reference existing meshes
+	for (uint32_t i = 0; i < header->num_nodes; i++)
+	{
+		const MeshCacheNode& n = nodes[i];
+		if (n.parent >= int32_t(i) || n.parent < -1 ||
+			uint64_t(n.first_mesh_ref) + n.num_mesh_refs > header->num_mesh_refs ||
+			uint64_t(n.name_offset) + n.name_len > header->string_size)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_mesh_refs; i++)
+	{
+		if (mesh_refs[i] >= header->num_meshes)
+			return false;
+	}
+
+	for (uint32_t i = 0; i < header->num_tex_refs; i++)
+	{
+		if (uint64_t(tex_refs[i].type_offset) + tex_refs[i].type_len > header->string_size ||
+			uint64_t(tex_refs[i].path_offset) + tex_refs[i].path_len > header->string_size)
+			return false;
+	}
+
+	return true;
+}
+
+// Get texture references of a cached mesh
+template <typename T>
+std::vector<TextureRef> MeshCacheReader<T>::textureRefs(size_t i) const
+{
+	std::vector<TextureRef> refs(entries[i].num_tex_refs);
+
+	for (uint32_t j = 0; j < entries[i].num_tex_refs; j++)
+	{
+		const MeshCacheTexRef& cref = tex_refs[entries[i].first_tex_ref + j];
+		refs[j].type.assign(strings + cref.type_offset, cref.type_len);
+		refs[j].path.assign(strings + cref.path_offset, cref.path_len);
+	}
+
+	return refs;
+}
+
+// Get node hierarchy of the cached model
+template <typename T>
+std::vector<NodeData<T>> MeshCacheReader<T>::nodeData() const
+{
+	std::vector<NodeData<T>> out(header ? header->num_nodes : 0);
+
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		const MeshCacheNode& cnode = nodes[i];
+		out[i].parent = cnode.parent;
+		out[i].name.assign(strings + cnode.name_offset, cnode.name_len);
+		for (int j = 0; j < 16; j++)
+			out[i].local.m[j] = T(cnode.local[j]);
+		out[i].meshes.assign(mesh_refs + cnode.first_mesh_ref, mesh_refs + cnode.first_mesh_ref + cnode.num_mesh_refs);
+	}
+
+	return out;
+}
+
+#endif
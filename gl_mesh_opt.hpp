@@ -0,0 +1,340 @@
+// *****************************************************************************************************************************
+// gl_mesh_opt.hpp
+// OpenGL Rendering
+// Mesh optimization (vertex cache, overdraw and vertex fetch ordering)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_MESH_OPT_HPP
+#define GL_MESH_OPT_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "gl_mesh.hpp"
+
+#define MESH_OPT_CACHE_SIZE 32			// Modeled cache size for triangle ordering
+#define MESH_OPT_ANALYZE_CACHE_SIZE 16	// FIFO cache size for ACMR/ATVR reporting
+
+// MESH CACHE STATS
+struct MeshCacheStats
+{
+	float acmr = 0;		// Average cache miss ratio (transformed vertices per triangle, 0.5 - 3)
+	float atvr = 0;		// Average transformed vertex ratio (transformed / unique vertices, 1 is optimal)
+};
+
+// MESH OPT STATS
+// Vertex cache efficiency before and after optimization
+struct MeshOptStats
+{
+	MeshCacheStats before;
+	MeshCacheStats after;
+};
+
+// Simulate a FIFO post-transform vertex cache over an index buffer
+// Return: ACMR and ATVR
+MeshCacheStats MeshAnalyzeVertexCache(const GLuint* indices, size_t num_indices, size_t num_vertices,
+	unsigned int cache_size = MESH_OPT_ANALYZE_CACHE_SIZE)
+{
+	MeshCacheStats stats;
+	std::vector<uint32_t> stamps(num_vertices, 0);	// Insertion time of each vertex
+	uint32_t time = cache_size + 1;
+	size_t misses = 0;
+	size_t unique = 0;
+
+	for (size_t i = 0; i < num_indices; i++)
+	{
+		GLuint v = indices[i];
+		if (stamps[v] == 0)
+			unique++;
+		if (time - stamps[v] > cache_size)
+		{
+			stamps[v] = time++;
+			misses++;
+		}
+	}
+
+	if (num_indices >= 3)
+		stats.acmr = float(misses) / float(num_indices / 3);
+	if (unique > 0)
+		stats.atvr = float(misses) / float(unique);
+
+	return stats;
+}
+
+// Forsyth vertex score
+// cache_pos = position in modeled LRU cache (-1: not cached)
+// live_tris = remaining triangles using the vertex
+float MeshOptVertexScore(int cache_pos, uint32_t live_tris)
+{
+	if (live_tris == 0)
+		return -1.0f;
+
+	float score = 0;
+	if (cache_pos >= 0)
+	{
+		if (cache_pos < 3)
+			score = 0.75f;	// Vertices of the last triangle: fixed score to avoid favoring strips too much
+		else
+			score = std::pow(1.0f - float(cache_pos - 3) / float(MESH_OPT_CACHE_SIZE - 3), 1.5f);
+	}
+
+	return score + 2.0f / std::sqrt(float(live_tris));	// Boost vertices with few remaining triangles
+}
+
+// Reorder triangles for post-transform vertex cache efficiency (Forsyth, linear-speed)
+void MeshOptimizeVertexCache(GLuint* indices, size_t num_indices, size_t num_vertices)
+{
+	const size_t num_tris = num_indices / 3;
+	const size_t none = size_t(-1);
+	if (num_tris == 0)
+		return;
+
+	// Vertex -> triangle adjacency
+	std::vector<uint32_t> live(num_vertices, 0);
+	std::vector<uint32_t> offsets(num_vertices + 1, 0);
+	std::vector<uint32_t> adjacency(num_tris * 3);
+	for (size_t i = 0; i < num_tris * 3; i++)
+		live[indices[i]]++;
+	for (size_t v = 0; v < num_vertices; v++)
+		offsets[v + 1] = offsets[v] + live[v];
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < num_tris * 3; i++)
+			adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+	}
+
+	std::vector<int> cache_pos(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	std::vector<float> tri_score(num_tris);
+	std::vector<char> emitted(num_tris, 0);
+	for (size_t v = 0; v < num_vertices; v++)
+		vertex_score[v] = MeshOptVertexScore(-1, live[v]);
+
+	size_t best = 0;
+	for (size_t t = 0; t < num_tris; t++)
+	{
+		tri_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		if (tri_score[t] > tri_score[best])
+			best = t;
+	}
+
+	std::vector<GLuint> out;
+	out.reserve(num_tris * 3);
+	GLuint cache[MESH_OPT_CACHE_SIZE + 3];
+	GLuint new_cache[MESH_OPT_CACHE_SIZE + 3];
+	size_t cache_count = 0;
+	size_t cursor = 0;
+
+	while (best != none)
+	{
+		emitted[best] = 1;
+		size_t new_count = 0;
+
+		// Emit triangle, move its vertices to the front of the cache
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint v = indices[best * 3 + k];
+			out.push_back(v);
+
+			// Remove triangle from the vertex's live list
+			uint32_t* list = &adjacency[offsets[v]];
+			for (uint32_t j = 0; j < live[v]; j++)
+			{
+				if (list[j] == best)
+				{
+					list[j] = list[live[v] - 1];
+					break;
+				}
+			}
+			live[v]--;
+
+			if (std::find(new_cache, new_cache + new_count, v) == new_cache + new_count)
+				new_cache[new_count++] = v;
+		}
+		for (size_t i = 0; i < cache_count; i++)
+		{
+			if (std::find(new_cache, new_cache + new_count, cache[i]) == new_cache + new_count)
+				new_cache[new_count++] = cache[i];
+		}
+
+		// Update vertex scores (vertices pushed past the cache end drop out)
+		for (size_t i = 0; i < new_count; i++)
+		{
+			GLuint v = new_cache[i];
+			cache_pos[v] = i < MESH_OPT_CACHE_SIZE ? int(i) : -1;
+			vertex_score[v] = MeshOptVertexScore(cache_pos[v], live[v]);
+		}
+		cache_count = std::min(new_count, size_t(MESH_OPT_CACHE_SIZE));
+		std::copy(new_cache, new_cache + cache_count, cache);
+
+		// Rescore triangles touching affected vertices and pick the best
+		best = none;
+		float best_score = -1.0f;
+		for (size_t i = 0; i < new_count; i++)
+		{
+			GLuint v = new_cache[i];
+			for (uint32_t j = 0; j < live[v]; j++)
+			{
+				uint32_t t = adjacency[offsets[v] + j];
+				tri_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] +
+					vertex_score[indices[t * 3 + 2]];
+				if (tri_score[t] > best_score)
+				{
+					best_score = tri_score[t];
+					best = t;
+				}
+			}
+		}
+
+		// Cache exhausted: continue with the next unemitted triangle
+		if (best == none)
+		{
+			while (cursor < num_tris && emitted[cursor])
+				cursor++;
+			if (cursor < num_tris)
+				best = cursor;
+		}
+	}
+
+	std::copy(out.begin(), out.end(), indices);
+}
+
+// Reorder triangle clusters to reduce overdraw (Sander et al., "Fast Triangle Reordering")
+// Clusters are split where the cache order restarts (a triangle with three cache misses),
+// so vertex cache efficiency is mostly preserved. Outward-facing clusters far from the
+// mesh center are drawn first, since they tend to occlude the rest.
+// Call after MeshOptimizeVertexCache
+template <typename T>
+void MeshOptimizeOverdraw(GLuint* indices, size_t num_indices, const Vertex<T>* vertices, size_t num_vertices)
+{
+	const size_t num_tris = num_indices / 3;
+	if (num_tris < 2)
+		return;
+
+	// Cluster boundaries
+	std::vector<size_t> clusters;	// First triangle of each cluster
+	std::vector<uint32_t> stamps(num_vertices, 0);
+	uint32_t time = MESH_OPT_ANALYZE_CACHE_SIZE + 1;
+	for (size_t t = 0; t < num_tris; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint v = indices[t * 3 + k];
+			if (time - stamps[v] > MESH_OPT_ANALYZE_CACHE_SIZE)
+			{
+				stamps[v] = time++;
+				misses++;
+			}
+		}
+		if (misses == 3 || t == 0)
+			clusters.push_back(t);
+	}
+	if (clusters.size() < 2)
+		return;
+	clusters.push_back(num_tris);
+
+	// Mesh centroid
+	double center[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < num_indices; i++)
+	{
+		center[0] += vertices[indices[i]].pos.x;
+		center[1] += vertices[indices[i]].pos.y;
+		center[2] += vertices[indices[i]].pos.z;
+	}
+	for (int c = 0; c < 3; c++)
+		center[c] /= double(num_tris * 3);
+
+	// Cluster sort keys: dot(cluster centroid - mesh centroid, cluster normal)
+	std::vector<std::pair<double, size_t>> keys(clusters.size() - 1);
+	for (size_t c = 0; c + 1 < clusters.size(); c++)
+	{
+		double centroid[3] = { 0, 0, 0 };
+		double normal[3] = { 0, 0, 0 };
+		double area = 0;
+
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			const Vec3<T>& p0 = vertices[indices[t * 3]].pos;
+			const Vec3<T>& p1 = vertices[indices[t * 3 + 1]].pos;
+			const Vec3<T>& p2 = vertices[indices[t * 3 + 2]].pos;
+			double e1[3] = { double(p1.x - p0.x), double(p1.y - p0.y), double(p1.z - p0.z) };
+			double e2[3] = { double(p2.x - p0.x), double(p2.y - p0.y), double(p2.z - p0.z) };
+			double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			double a = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			centroid[0] += (double(p0.x) + p1.x + p2.x) / 3 * a;
+			centroid[1] += (double(p0.y) + p1.y + p2.y) / 3 * a;
+			centroid[2] += (double(p0.z) + p1.z + p2.z) / 3 * a;
+			normal[0] += n[0];
+			normal[1] += n[1];
+			normal[2] += n[2];
+			area += a;
+		}
+
+		double key = 0;
+		double normal_len = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (area > 0 && normal_len > 0)
+		{
+			for (int i = 0; i < 3; i++)
+				key += (centroid[i] / area - center[i]) * normal[i] / normal_len;
+		}
+		keys[c] = std::make_pair(key, c);
+	}
+
+	std::stable_sort(keys.begin(), keys.end(),
+		[](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) { return a.first > b.first; });
+
+	std::vector<GLuint> out;
+	out.reserve(num_tris * 3);
+	for (const std::pair<double, size_t>& key : keys)
+		out.insert(out.end(), indices + clusters[key.second] * 3, indices + clusters[key.second + 1] * 3);
+
+	std::copy(out.begin(), out.end(), indices);
+}
+
+// Reorder vertices into first-use order for vertex fetch locality (unreferenced vertices are dropped)
+template <typename T>
+void MeshOptimizeVertexFetch(std::vector<Vertex<T>>& vertices, std::vector<GLuint>& indices)
+{
+	const GLuint unused = GLuint(-1);
+	std::vector<GLuint> remap(vertices.size(), unused);
+	GLuint next = 0;
+
+	for (GLuint& index : indices)
+	{
+		if (remap[index] == unused)
+			remap[index] = next++;
+		index = remap[index];
+	}
+
+	std::vector<Vertex<T>> fetch_order(next);
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		if (remap[v] != unused)
+			fetch_order[remap[v]] = vertices[v];
+	}
+	vertices.swap(fetch_order);
+}
+
+// Run all optimization passes on a triangle mesh
+// Return: vertex cache stats before and after
+template <typename T>
+MeshOptStats MeshOptimize(std::vector<Vertex<T>>& vertices, std::vector<GLuint>& indices)
+{
+	MeshOptStats stats;
+
+	stats.before = MeshAnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+	MeshOptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+	MeshOptimizeOverdraw(indices.data(), indices.size(), vertices.data(), vertices.size());
+	MeshOptimizeVertexFetch(vertices, indices);
+	stats.after = MeshAnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	return stats;
+}
+
+#endif
@@ -0,0 +1,298 @@
+// *****************************************************************************************************************************
+// gl_mesh_simplify.hpp
+// OpenGL Rendering
+// Quadric error mesh simplification (LOD generation)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_MESH_SIMPLIFY_HPP
+#define GL_MESH_SIMPLIFY_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "gl_mesh.hpp"
+
+// QUADRIC
+// Symmetric 4x4 error quadric (Garland & Heckbert)
+struct SimplifyQuadric
+{
+	double a2 = 0, b2 = 0, c2 = 0, d2 = 0, ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+
+	// Add plane ax + by + cz + d = 0 with weight w
+	void addPlane(double a, double b, double c, double d, double w)
+	{
+		a2 += a * a * w; b2 += b * b * w; c2 += c * c * w; d2 += d * d * w;
+		ab += a * b * w; ac += a * c * w; ad += a * d * w;
+		bc += b * c * w; bd += b * d * w; cd += c * d * w;
+	}
+
+	void add(const SimplifyQuadric& q)
+	{
+		a2 += q.a2; b2 += q.b2; c2 += q.c2; d2 += q.d2;
+		ab += q.ab; ac += q.ac; ad += q.ad;
+		bc += q.bc; bd += q.bd; cd += q.cd;
+	}
+
+	// Squared distance sum at point
+	double eval(double x, double y, double z) const
+	{
+		double e = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+			2 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y + cd * z);
+		return e > 0 ? e : 0;
+	}
+};
+
+// Simplify a triangle mesh by edge collapse to existing vertices (vertex attributes are kept as-is)
+// Vertices on open borders or attribute seams (same position, different vertex) are locked,
+// so the silhouette and texture mapping stay intact.
+// target_index_count = desired number of indices (stops early if max_error is reached)
+// max_error = maximum error, relative to the mesh extent
+// result_error = optional output of the achieved error, relative to the mesh extent
+// Return: simplified index buffer (references the original vertex array)
+template <typename T>
+std::vector<GLuint> MeshSimplify(const Vertex<T>* vertices, size_t num_vertices, const GLuint* indices, size_t num_indices,
+	size_t target_index_count, float max_error, float* result_error = nullptr)
+{
+	std::vector<GLuint> result(indices, indices + num_indices);
+	if (result_error)
+		*result_error = 0;
+	if (num_indices < 6 || target_index_count >= num_indices)
+		return result;
+
+	// Mesh extent (errors are relative to it)
+	double lo[3] = { 1e300, 1e300, 1e300 };
+	double hi[3] = { -1e300, -1e300, -1e300 };
+	std::vector<double> pos(num_vertices * 3);
+	for (size_t v = 0; v < num_vertices; v++)
+	{
+		pos[v * 3] = vertices[v].pos.x;
+		pos[v * 3 + 1] = vertices[v].pos.y;
+		pos[v * 3 + 2] = vertices[v].pos.z;
+		for (int c = 0; c < 3; c++)
+		{
+			lo[c] = std::min(lo[c], pos[v * 3 + c]);
+			hi[c] = std::max(hi[c], pos[v * 3 + c]);
+		}
+	}
+	double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+	if (extent <= 0)
+		return result;
+	double max_cost = double(max_error) * extent * double(max_error) * extent;
+
+	// Position representatives (vertices sharing a position)
+	std::vector<GLuint> rep(num_vertices);
+	std::vector<char> locked(num_vertices, 0);
+	{
+		std::unordered_map<std::string, GLuint> by_pos;
+		std::vector<uint32_t> copies(num_vertices, 0);
+		by_pos.reserve(num_vertices);
+		for (size_t v = 0; v < num_vertices; v++)
+		{
+			std::string key(reinterpret_cast<const char*>(&pos[v * 3]), sizeof(double) * 3);
+			auto it = by_pos.emplace(key, GLuint(v)).first;
+			rep[v] = it->second;
+			copies[it->second]++;
+		}
+		for (size_t v = 0; v < num_vertices; v++)
+		{
+			if (copies[rep[v]] > 1)
+				locked[v] = 1;	// Attribute seam
+		}
+	}
+
+	// Border edges (used by a single triangle, compared by position)
+	{
+		std::unordered_map<uint64_t, uint32_t> edge_count;
+		edge_count.reserve(num_indices);
+		for (size_t i = 0; i < num_indices; i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t a = rep[indices[i + k]], b = rep[indices[i + (k + 1) % 3]];
+				edge_count[std::min(a, b) << 32 | std::max(a, b)]++;
+			}
+		}
+		for (size_t i = 0; i < num_indices; i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint a = indices[i + k], b = indices[i + (k + 1) % 3];
+				uint64_t ra = rep[a], rb = rep[b];
+				if (edge_count[std::min(ra, rb) << 32 | std::max(ra, rb)] == 1)
+					locked[a] = locked[b] = 1;
+			}
+		}
+	}
+
+	// Vertex quadrics from area-weighted triangle planes
+	std::vector<SimplifyQuadric> quadrics(num_vertices);
+	for (size_t i = 0; i < num_indices; i += 3)
+	{
+		const double* p0 = &pos[indices[i] * 3];
+		const double* p1 = &pos[indices[i + 1] * 3];
+		const double* p2 = &pos[indices[i + 2] * 3];
+		double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len == 0)
+			continue;
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		for (int k = 0; k < 3; k++)
+			quadrics[indices[i + k]].addPlane(n[0], n[1], n[2], d, len * 0.5);
+	}
+
+	struct Collapse
+	{
+		GLuint from, to;
+		double cost;
+	};
+
+	std::vector<GLuint> remap(num_vertices);
+	std::vector<char> touched(num_vertices);
+	std::vector<uint32_t> tri_offsets(num_vertices + 1);
+	std::vector<uint32_t> tri_list;
+	std::vector<Collapse> collapses;
+	double achieved = 0;
+
+	// Passes: collapse the cheapest independent edges, compact, repeat
+	while (result.size() > target_index_count)
+	{
+		// Vertex -> triangle adjacency for flip checks
+		std::fill(tri_offsets.begin(), tri_offsets.end(), 0);
+		for (GLuint v : result)
+			tri_offsets[v + 1]++;
+		for (size_t v = 0; v < num_vertices; v++)
+			tri_offsets[v + 1] += tri_offsets[v];
+		tri_list.resize(result.size());
+		{
+			std::vector<uint32_t> fill(tri_offsets.begin(), tri_offsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+				tri_list[fill[result[i]]++] = uint32_t(i / 3);
+		}
+
+		// Candidate collapses (both directions of every edge)
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint a = result[i + k], b = result[i + (k + 1) % 3];
+				for (int dir = 0; dir < 2; dir++)
+				{
+					GLuint from = dir ? b : a, to = dir ? a : b;
+					if (locked[from] || rep[from] == rep[to])
+						continue;
+					SimplifyQuadric q = quadrics[from];
+					q.add(quadrics[to]);
+					double cost = q.eval(pos[to * 3], pos[to * 3 + 1], pos[to * 3 + 2]);
+					if (cost <= max_cost)
+						collapses.push_back({ from, to, cost });
+				}
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+		// Each collapse removes about two triangles
+		size_t max_collapses = (result.size() - target_index_count) / 6 + 1;
+		size_t num_collapsed = 0;
+		for (size_t v = 0; v < num_vertices; v++)
+			remap[v] = GLuint(v);
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (const Collapse& c : collapses)
+		{
+			if (num_collapsed >= max_collapses)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+
+			// Reject collapses that flip a remaining triangle
+			bool flips = false;
+			for (uint32_t j = tri_offsets[c.from]; j < tri_offsets[c.from + 1] && !flips; j++)
+			{
+				const GLuint* tri = &result[tri_list[j] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					continue;	// Removed by the collapse
+
+				double p[3][3];
+				for (int k = 0; k < 3; k++)
+					std::memcpy(p[k], &pos[tri[k] * 3], sizeof(p[k]));
+				double n0[3], n1[3];
+				for (int pass = 0; pass < 2; pass++)
+				{
+					if (pass == 1)
+					{
+						for (int k = 0; k < 3; k++)
+						{
+							if (tri[k] == c.from)
+								std::memcpy(p[k], &pos[c.to * 3], sizeof(p[k]));
+						}
+					}
+					double e1[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+					double e2[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+					double* n = pass ? n1 : n0;
+					n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+					n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+					n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+				}
+				double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+				double len0 = std::sqrt(n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]);
+				double len1 = std::sqrt(n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]);
+				if (dot <= 0.25 * len0 * len1)
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			// Lock the whole neighborhood for this pass so adjacency stays valid
+			for (uint32_t j = tri_offsets[c.from]; j < tri_offsets[c.from + 1]; j++)
+			{
+				const GLuint* tri = &result[tri_list[j] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+			for (uint32_t j = tri_offsets[c.to]; j < tri_offsets[c.to + 1]; j++)
+			{
+				const GLuint* tri = &result[tri_list[j] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+
+			remap[c.from] = c.to;
+			quadrics[c.to].add(quadrics[c.from]);
+			achieved = std::max(achieved, c.cost);
+			num_collapsed++;
+		}
+		if (num_collapsed == 0)
+			break;
+
+		// Apply remap and drop degenerate triangles
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			GLuint a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	if (result_error)
+		*result_error = float(std::sqrt(achieved) / extent);
+
+	return result;
+}
+
+#endif
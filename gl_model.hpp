@@ -13,6 +13,17 @@
 #include <cstdio>
 #include <vector>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MODEL_USE_SSE
+#include <emmintrin.h>
+#endif
 
 #define GLEW_STATIC
 #include <GL\glew.h>
@@ -33,114 +44,1023 @@
 #include "mat.hpp"
 
 #include "gl_mesh.hpp"
+#include "gl_mesh_cache.hpp"
+#include "gl_mesh_opt.hpp"
+#include "gl_mesh_simplify.hpp"
+#include "gl_texture.hpp"
+#include "gl_threads.hpp"
+#include "gl_camera.hpp"
+#include "gl_cull.hpp"
+#include "gl_hierarchy.hpp"
+#include "gl_queue.hpp"
+
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals /*| aiProcess_FixInfacingNormals*/)
+
+// Added to MODEL_IMPORT_FLAGS when meshes are optimized or simplified: both need an indexed mesh, since on unwelded
+// output every vertex is unique (no cache reuse) and every shared position counts as a locked seam (no collapses)
+#define MODEL_IMPORT_WELD_FLAGS aiProcess_JoinIdenticalVertices
+
+// Mesh cache option bits (settings that change converted mesh data)
+#define MODEL_CACHE_OPT_OPTIMIZED 0x1
+#define MODEL_CACHE_OPT_LOD 0x2			// Upper bits: hash of LOD settings
+
+// MODEL SETTINGS
+// Import options for Model construction
+struct ModelSettings
+{
+	bool use_cache = true;		// Load from / write to binary mesh cache (skips Assimp when current)
+	std::string cache_dir;		// Directory for cache files (empty: next to source file)
+	bool parallel_import = true;	// Convert meshes on the shared worker pool
+	bool report_load_time = false;	// Print load time breakdown after loading
+	TextureOptions texture_options;	// Sampler settings for material textures
+	bool async_textures = false;	// Stream textures (placeholder until resident; requires TextureStreamer::update() per frame)
+	bool optimize_meshes = false;	// Reorder for vertex cache, overdraw and vertex fetch (see gl_mesh_opt.hpp)
+	MeshVertexFormat vertex_format = MESH_VERTEX_FLOAT;	// GPU vertex layout (MESH_VERTEX_COMPACT: see MESH_COMPACT_GLSL)
+	bool use_geometry_pool = false;	// Sub-allocate meshes from the shared GeometryPool (one VAO per vertex layout)
+	unsigned int lod_levels = 0;	// Simplified LODs generated per mesh in addition to full detail (0: none)
+	float lod_ratio = 0.5f;			// Triangle count of each LOD relative to the previous one
+	float lod_max_error = 0.05f;	// Maximum simplification error per LOD step, relative to the mesh extent
+	float lod_pixel_error = 1.0f;	// Draw the coarsest LOD whose error projects to at most this many pixels
+	float lod_hysteresis = 0.25f;	// Margin a coarser LOD must beat lod_pixel_error by before switching
+									// (kept per mesh reference; see Model::beginFrame)
+	bool frustum_culling = true;	// Skip meshes outside the view frustum when drawing with a camera
+};
+
+// MODEL LOAD STATS
+// Load time breakdown (milliseconds)
+struct ModelLoadStats
+{
+	double parse_ms = 0;		// Assimp import (or cache map/validate)
+	double convert_ms = 0;		// CPU mesh conversion
+	double upload_ms = 0;		// GL object creation and texture loading
+	size_t num_meshes = 0;
+	size_t geometry_bytes = 0;	// GPU vertex + index buffer memory
+	unsigned int num_threads = 1;
+	bool from_cache = false;
+};
+
+// MODEL TEXTURE STATS
+// Texture memory used by a model (shared textures counted once per model)
+struct ModelTextureStats
+{
+	size_t num_textures = 0;
+	size_t bytes = 0;			// Resident GPU memory
+	size_t bytes_rgba8 = 0;		// Same textures stored as uncompressed GL_RGBA8
+	size_t bytesSaved() const { return bytes_rgba8 > bytes ? bytes_rgba8 - bytes : 0; }
+};
 
 template <typename T = float>
 class Model
 {
 private:
 	std::vector<Mesh<T>> meshes;
-	std::vector<Texture> textures_loaded;
+	std::vector<Texture> textures_loaded;	// Texture cache references held by this model
 	std::string directory;
+	ModelSettings settings;
+	ModelLoadStats load_stats;
+	std::vector<MeshOptStats> opt_stats;	// Per mesh, filled when meshes are optimized on import
+	InstanceBuffer instances;				// Streamed by drawInstanced, shared by all meshes
+	IndirectBatch indirect;					// Draw commands collected by drawIndirect
+	std::vector<uint32_t> mesh_material;	// Material index per mesh (meshes with identical textures share one)
+	std::vector<uint32_t> material_mesh;	// First mesh using each material (binds its textures)
+
+	// Node hierarchy (depth-first order); meshes are shared by every node that references them
+	TransformHierarchy<T> hierarchy;
+	std::vector<std::string> node_names;
+	std::vector<uint32_t> node_mesh_first;	// Range into mesh_refs per node
+	std::vector<uint32_t> node_mesh_count;
+	std::vector<uint32_t> mesh_refs;		// Mesh indices
+	NodeTransform<T> root_transform = NodeTransformIdentity<T>();
+
+	// Frustum culling scratch, per mesh reference (reused between frames)
+	CullSpheres cull_spheres;
+	std::vector<uint8_t> cull_visible;
+
+	// LOD hysteresis state per mesh reference: last selected LOD and the frame it was selected in
+	std::vector<uint32_t> ref_lod;
+	std::vector<uint64_t> ref_lod_frame;
+	uint64_t lod_frame = 0;			// Advanced by every LOD draw, or only by beginFrame() once it has been called
+	bool lod_frame_manual = false;
+
+	void advanceLODFrame() { if (!lod_frame_manual) lod_frame++; }
+
+	uint32_t getCacheOptions() const;
+	unsigned int getImportFlags() const;
 
 	void loadModel(std::string path);
-	void processNode(aiNode* node, const aiScene* scene);
-	Mesh<T> processMesh(aiMesh* mesh, const aiScene* scene);
-	std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName);
+	bool loadCache(const std::string& path);
+	void buildHierarchy(const std::vector<NodeData<T>>& nodes);
+	void buildMaterials();
+	void cullMeshRefs(Camera<T>& camera, Mat4<T> projection, const NodeTransform<T>& base);
+	size_t selectMeshLOD(uint32_t ref, const NodeTransform<T>& world, T scale, T pixel_scale, const Vec3<T>& cam_pos);
+	void drawNodes(GLuint shader_id, const NodeTransform<T>& base, const Vec3<T>* cam_pos, T pixel_scale);
+	bool submitIndirect(GLuint shader_id, const Vec3<T>* cam_pos, T pixel_scale);
+	void enqueueNodes(RenderQueue<T>& queue, GLuint shader_id, bool translucent, const Vec3<T>* cam_pos, T pixel_scale);
+	void processNode(aiNode* node, int32_t parent, std::vector<NodeData<T>>& nodes);
+	MeshData<T> processMesh(aiMesh* mesh, const aiScene* scene, MeshOptStats* stats);
+	std::vector<TextureRef> getMaterialTextureRefs(aiMaterial* mat, aiTextureType type, std::string typeName);
+	std::vector<Texture> loadMaterialTextures(const std::vector<TextureRef>& refs);
 public:
-	Model(const GLchar* path) { this->loadModel(path); };
+	Model(const GLchar* path, ModelSettings settings = ModelSettings()) : settings(settings) { this->loadModel(path); };
+	Model(const Model&) = delete;
+	Model(Model&&) = default;
+	Model& operator=(const Model&) = delete;
+	Model& operator=(Model&&) = delete;
+	~Model();
 	void draw(GLuint shader_id);
+	void draw(GLuint shader_id, Camera<T>& camera, Mat4<T> projection);
+	void draw(GLuint shader_id, Camera<T>& camera, Mat4<T> projection, Mat4<T> model_mat);
+	void drawInstanced(GLuint shader_id, const GLfloat* transforms, size_t count, const GLfloat* instance_data = nullptr,
+		size_t lod = 0);
+	bool drawIndirect(GLuint shader_id);
+	bool drawIndirect(GLuint shader_id, Camera<T>& camera, Mat4<T> projection);
+	void enqueue(RenderQueue<T>& queue, GLuint shader_id, bool translucent = false);
+	void enqueue(RenderQueue<T>& queue, GLuint shader_id, Camera<T>& camera, Mat4<T> projection, bool translucent = false);
+
+	void beginFrame() { lod_frame_manual = true; lod_frame++; }	// Once per frame if drawn more than once per frame
+	void setTransform(Mat4<T> model_mat) { root_transform = NodeTransformFromMat4(model_mat); }
+	size_t numNodes() const { return hierarchy.size(); }
+	int32_t findNode(const std::string& name) const;
+	void setNodeTransform(uint32_t node, Mat4<T> local) { hierarchy.setLocal(node, NodeTransformFromMat4(local)); }
+	TransformHierarchy<T>& getHierarchy() { return hierarchy; }
+	MeshBounds<T> getBounds();
+	void buildRaycast();
+	bool raycast(const Vec3<T>& origin, const Vec3<T>& dir, RayHit& hit);
+
+	const ModelLoadStats& getLoadStats() const { return load_stats; }
+	ModelTextureStats getTextureStats() const;
+	const std::vector<MeshOptStats>& getOptStats() const { return opt_stats; }
 };
 
+// Gather Assimp attribute streams into interleaved vertices
+// dst = output array of count vertices
+// norm, uv = optional streams (nullptr: zero-filled)
+template <typename T>
+void ModelGatherVertices(Vertex<T>* dst, const aiVector3D* pos, const aiVector3D* norm, const aiVector3D* uv, size_t count)
+{
+	size_t i = 0;
+
+#ifdef MODEL_USE_SSE
+	// Packed float layout: [px py pz nx] [ny nz u v], two 16-byte stores per vertex
+	constexpr bool packed = std::is_same<T, float>::value && sizeof(aiVector3D) == 3 * sizeof(float) &&
+		sizeof(Vertex<T>) == 8 * sizeof(float) && offsetof(Vertex<T>, norm) == 3 * sizeof(float) &&
+		offsetof(Vertex<T>, uv) == 6 * sizeof(float);
+
+	if constexpr (packed)
+	{
+		if (norm)
+		{
+			float* out = reinterpret_cast<float*>(dst);
+			const __m128 zero = _mm_setzero_ps();
+
+			// Last vertex is done in the scalar loop, since 16-byte loads read one float past each element
+			for (; i + 1 < count; i++)
+			{
+				__m128 p = _mm_loadu_ps(&pos[i].x);
+				__m128 n = _mm_loadu_ps(&norm[i].x);
+				__m128 t = uv ? _mm_loadu_ps(&uv[i].x) : zero;
+
+				__m128 pz_nx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));			// [pz pz nx nx]
+				__m128 lo = _mm_shuffle_ps(p, pz_nx, _MM_SHUFFLE(2, 0, 1, 0));			// [px py pz nx]
+				__m128 hi = _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1));				// [ny nz u v]
+
+				_mm_storeu_ps(out + i * 8, lo);
+				_mm_storeu_ps(out + i * 8 + 4, hi);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		Vertex<T>& v = dst[i];
+		v.pos.x = pos[i].x;
+		v.pos.y = pos[i].y;
+		v.pos.z = pos[i].z;
+		if (norm)
+		{
+			v.norm.x = norm[i].x;
+			v.norm.y = norm[i].y;
+			v.norm.z = norm[i].z;
+		}
+		else
+			v.norm = Vec3<T>();
+		if (uv)
+		{
+			v.uv.x = uv[i].x;
+			v.uv.y = uv[i].y;
+		}
+		else
+			v.uv = Vec2<T>();
+	}
+}
+
+// Convert an Assimp mesh's vertex and index streams (buffers are sized once and filled in place)
+template <typename T>
+void ModelConvertGeometry(const aiMesh* mesh, std::vector<Vertex<T>>& vertices, std::vector<GLuint>& indices)
+{
+	vertices.resize(mesh->mNumVertices);
+	ModelGatherVertices(vertices.data(), mesh->mVertices, mesh->mNormals, mesh->mTextureCoords[0], mesh->mNumVertices);
+
+	size_t num_indices = 0;
+	for (GLuint i = 0; i < mesh->mNumFaces; i++)
+		num_indices += mesh->mFaces[i].mNumIndices;
+
+	// Faces are read by reference: copying an aiFace allocates its index array
+	indices.resize(num_indices);
+	GLuint* dst = indices.data();
+	for (GLuint i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace& face = mesh->mFaces[i];
+		for (GLuint j = 0; j < face.mNumIndices; j++)
+			*dst++ = face.mIndices[j];
+	}
+}
+
+// Set a mat4 uniform from a node transform (location -1 is ignored, as by GL)
+template <typename T>
+void ModelSetTransformUniform(GLint location, const NodeTransform<T>& transform)
+{
+	GLfloat m[16];
+	for (int i = 0; i < 16; i++)
+		m[i] = GLfloat(transform.m[i]);
+	glUniformMatrix4fv(location, 1, GL_FALSE, m);
+}
+
+// Convert Assimp (row-major) matrix
+template <typename T>
+NodeTransform<T> ModelConvertTransform(const aiMatrix4x4& mat)
+{
+	const ai_real rows[4][4] = {
+		{ mat.a1, mat.a2, mat.a3, mat.a4 },
+		{ mat.b1, mat.b2, mat.b3, mat.b4 },
+		{ mat.c1, mat.c2, mat.c3, mat.c4 },
+		{ mat.d1, mat.d2, mat.d3, mat.d4 } };
+	NodeTransform<T> out;
+	for (int row = 0; row < 4; row++)
+	{
+		for (int col = 0; col < 4; col++)
+			out.m[col * 4 + row] = T(rows[row][col]);
+	}
+	return out;
+}
+
+// Milliseconds elapsed since start
+double ModelElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Destructor (releases shared textures)
+template <typename T>
+Model<T>::~Model()
+{
+	for (const Texture& texture : this->textures_loaded)
+		TextureCache::get().release(texture.id);
+}
+
+// Get option bits stored in / checked against the mesh cache
+template <typename T>
+uint32_t Model<T>::getCacheOptions() const
+{
+	uint32_t options = 0;
+	if (this->settings.optimize_meshes)
+		options |= MODEL_CACHE_OPT_OPTIMIZED;
+	if (this->settings.lod_levels > 0)
+	{
+		float lod_params[3] = { float(this->settings.lod_levels), this->settings.lod_ratio, this->settings.lod_max_error };
+		options |= MODEL_CACHE_OPT_LOD | (uint32_t(CacheHash(lod_params, sizeof(lod_params))) & ~0xFFu);
+	}
+
+	return options;
+}
+
+// Return: Assimp post-processing flags for this model's settings
+template <typename T>
+unsigned int Model<T>::getImportFlags() const
+{
+	unsigned int flags = MODEL_IMPORT_FLAGS;
+	if (this->settings.optimize_meshes || this->settings.lod_levels > 0)
+		flags |= MODEL_IMPORT_WELD_FLAGS;
+	return flags;
+}
+
+// Get texture memory used by this model (async textures count once resident)
+template <typename T>
+ModelTextureStats Model<T>::getTextureStats() const
+{
+	ModelTextureStats stats;
+	std::vector<GLuint> ids;
+
+	for (const Texture& texture : this->textures_loaded)
+		ids.push_back(texture.id);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	for (GLuint id : ids)
+	{
+		const TextureInfo* info = TextureCache::get().getInfo(id);
+		if (info)
+		{
+			stats.num_textures++;
+			stats.bytes += info->bytes;
+			stats.bytes_rgba8 += info->bytes_rgba8;
+		}
+	}
+
+	return stats;
+}
+
+// Get bounds of all node meshes in model space (node transforms applied, setTransform not applied)
+// Instance boxes for InstanceBVH: transform min / max with BVHTransformBox
+template <typename T>
+MeshBounds<T> Model<T>::getBounds()
+{
+	this->hierarchy.update();
+
+	MeshBounds<T> result;
+	bool empty = true;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		const NodeTransform<T>& world = this->hierarchy.getWorld(node);
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			const MeshBounds<T>& b = this->meshes[this->mesh_refs[this->node_mesh_first[node] + j]].bounds;
+			for (int corner = 0; corner < 8; corner++)
+			{
+				Vec3<T> p = NodeTransformPoint(world, Vec3<T>(corner & 1 ? b.max.x : b.min.x,
+					corner & 2 ? b.max.y : b.min.y, corner & 4 ? b.max.z : b.min.z));
+				if (empty)
+				{
+					result.min = result.max = p;
+					empty = false;
+				}
+				result.min.x = std::min(result.min.x, p.x); result.max.x = std::max(result.max.x, p.x);
+				result.min.y = std::min(result.min.y, p.y); result.max.y = std::max(result.max.y, p.y);
+				result.min.z = std::min(result.min.z, p.z); result.max.z = std::max(result.max.z, p.z);
+			}
+		}
+	}
+	if (empty)
+		return result;
+
+	result.center = Vec3<T>((result.min.x + result.max.x) / 2, (result.min.y + result.max.y) / 2,
+		(result.min.z + result.max.z) / 2);
+	Vec3<T> half = result.max - result.center;
+	result.radius = T(std::sqrt(half.x * half.x + half.y * half.y + half.z * half.z));
+	return result;
+}
+
+// Build the triangle BVHs of every mesh now (e.g. after loading), so the first raycast does not pay for them
+template <typename T>
+void Model<T>::buildRaycast()
+{
+	for (Mesh<T>& mesh : this->meshes)
+		mesh.buildRaycast();
+}
+
+// Find the closest mesh triangle along a world-space ray (setTransform and node transforms applied)
+// Each mesh builds its triangle BVH on the first ray that reaches it unless buildRaycast was called (LOD 0 is tested)
+// hit = mesh index, node, triangle, barycentrics and distance of the closest hit (in units of |dir|)
+// Return: true on a hit
+template <typename T>
+bool Model<T>::raycast(const Vec3<T>& origin, const Vec3<T>& dir, RayHit& hit)
+{
+	this->hierarchy.update();
+
+	// Rays are transformed into mesh space without renormalizing, so the ray parameter is shared by all meshes
+	T best = std::numeric_limits<T>::max();
+	bool found = false;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
+
+		NodeTransform<T> world, inverse;
+		NodeTransformMul(this->root_transform, this->hierarchy.getWorld(node), world);
+		if (!NodeTransformInverse(world, inverse))
+			continue;
+		Vec3<T> local_origin = NodeTransformPoint(inverse, origin);
+		Vec3<T> local_dir = NodeTransformVector(inverse, dir);
+
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			uint32_t mesh_index = this->mesh_refs[this->node_mesh_first[node] + j];
+			RayHit mesh_hit;
+			if (this->meshes[mesh_index].raycast(local_origin, local_dir, best, mesh_hit))
+			{
+				best = T(mesh_hit.distance);
+				hit = mesh_hit;
+				hit.mesh = int32_t(mesh_index);
+				hit.node = int32_t(node);
+				found = true;
+			}
+		}
+	}
+
+	if (found)
+		hit.distance = float(best * std::sqrt(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z));
+	return found;
+}
+
+// Find node by name
+// Return: node index, -1 if not found
+template <typename T>
+int32_t Model<T>::findNode(const std::string& name) const
+{
+	for (size_t i = 0; i < this->node_names.size(); i++)
+	{
+		if (this->node_names[i] == name)
+			return int32_t(i);
+	}
+	return -1;
+}
+
+// Draw at full detail
+// The "model" uniform is set to the setTransform transform (identity by default) times each node's world transform
 template <typename T>
 void Model<T>::draw(GLuint shader_id)
 {
-	for (GLuint i = 0; i < this->meshes.size(); i++)
-		this->meshes[i].draw(shader_id);
+	RendSubmitTimer timer;
+	this->hierarchy.update();
+	this->drawNodes(shader_id, this->root_transform, nullptr, 0);
+}
+
+// Draw with per-mesh LOD selected from projected screen size
+// projection = perspective projection matrix (current viewport height is read from GL)
+// The "model" uniform is set as by draw(shader_id); culling and LOD use the same transforms.
+template <typename T>
+void Model<T>::draw(GLuint shader_id, Camera<T>& camera, Mat4<T> projection)
+{
+	RendSubmitTimer timer;
+	this->advanceLODFrame();
+	this->cullMeshRefs(camera, projection, this->root_transform);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	// Pixels per world unit at distance 1
+	T pixel_scale = projection[1].y * T(viewport[3]) / 2;
+	Vec3<T> cam_pos = camera.getPos();
+	this->drawNodes(shader_id, this->root_transform, &cam_pos, pixel_scale);
+}
+
+// Draw with per-mesh LOD selection at a model-to-world transform
+// model_mat = model-to-world transform, applied on top of setTransform; the "model" uniform is set to
+// model_mat * setTransform * node world transform
+template <typename T>
+void Model<T>::draw(GLuint shader_id, Camera<T>& camera, Mat4<T> projection, Mat4<T> model_mat)
+{
+	RendSubmitTimer timer;
+	this->advanceLODFrame();
+	NodeTransform<T> base;
+	NodeTransformMul(NodeTransformFromMat4(model_mat), this->root_transform, base);
+	this->cullMeshRefs(camera, projection, base);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	T pixel_scale = projection[1].y * T(viewport[3]) / 2;
+	Vec3<T> cam_pos = camera.getPos();
+	this->drawNodes(shader_id, base, &cam_pos, pixel_scale);
+}
+
+// Draw node meshes (hierarchy must be up to date)
+// base = transform applied on top of node world transforms
+// The "model" uniform is set to base * node world transform per node
+// cam_pos = camera position for LOD selection and culling by cullMeshRefs() (nullptr: full detail, no culling)
+template <typename T>
+void Model<T>::drawNodes(GLuint shader_id, const NodeTransform<T>& base, const Vec3<T>* cam_pos, T pixel_scale)
+{
+	GLint model_loc = ShaderLocationCache::get().getLocations(shader_id).model;
+	NodeTransform<T> world;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
+
+		NodeTransformMul(base, this->hierarchy.getWorld(node), world);
+		ModelSetTransformUniform(model_loc, world);
+		T scale = cam_pos ? NodeTransformMaxScale(world) : T(1);
+
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			uint32_t ref = this->node_mesh_first[node] + j;
+			if (cam_pos && !this->cull_visible[ref])
+				continue;
+			Mesh<T>& mesh = this->meshes[this->mesh_refs[ref]];
+			mesh.draw(shader_id, cam_pos ? this->selectMeshLOD(ref, world, scale, pixel_scale, *cam_pos) : 0);
+		}
+	}
+}
+
+// Select LOD of a mesh reference drawn with a world transform
+// Hysteresis state is kept per reference, so meshes shared by several nodes do not share it. A reference selected
+// again in the same LOD frame selects without hysteresis and keeps the first draw's state. Each LOD draw starts a new
+// LOD frame until beginFrame() is called; models drawn more than once per frame (several placements, shadow passes)
+// should call beginFrame() once per frame instead.
+// scale = largest axis scale of world
+// pixel_scale = pixels per world unit at distance 1
+template <typename T>
+size_t Model<T>::selectMeshLOD(uint32_t ref, const NodeTransform<T>& world, T scale, T pixel_scale,
+	const Vec3<T>& cam_pos)
+{
+	const Mesh<T>& mesh = this->meshes[this->mesh_refs[ref]];
+	Vec3<T> d = NodeTransformPoint(world, mesh.bounds.center) - cam_pos;
+
+	// Distance to the nearest point of the bounding sphere (inside: full detail)
+	T dist = T(std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z)) - mesh.bounds.radius * scale;
+	T pixels_per_unit = dist > 0 ? pixel_scale * scale / dist : std::numeric_limits<T>::max();
+
+	if (this->ref_lod.size() != this->mesh_refs.size())
+	{
+		this->ref_lod.assign(this->mesh_refs.size(), 0);
+		this->ref_lod_frame.assign(this->mesh_refs.size(), ~uint64_t(0));
+	}
+
+	if (this->ref_lod_frame[ref] == this->lod_frame)
+		return mesh.selectLOD(pixels_per_unit, T(this->settings.lod_pixel_error));
+
+	size_t lod = mesh.selectLOD(pixels_per_unit, T(this->settings.lod_pixel_error), T(this->settings.lod_hysteresis),
+		this->ref_lod[ref]);
+	this->ref_lod[ref] = uint32_t(lod);
+	this->ref_lod_frame[ref] = this->lod_frame;
+	return lod;
+}
+
+// Draw count instances, one instanced draw call per mesh
+// transforms = count column-major 4x4 model matrices (vertex attribute MESH_ATTRIB_INSTANCE_TRANSFORM)
+// instance_data = optional count vec4s (vertex attribute MESH_ATTRIB_INSTANCE_DATA)
+// lod = level of detail for all instances
+// The "model" uniform is set to each node's world transform (instance transforms replace setTransform)
+template <typename T>
+void Model<T>::drawInstanced(GLuint shader_id, const GLfloat* transforms, size_t count, const GLfloat* instance_data,
+	size_t lod)
+{
+	RendSubmitTimer timer;
+	if (count == 0 || !this->instances.upload(transforms, instance_data, count))
+		return;
+
+	this->hierarchy.update();
+
+	GLint model_loc = ShaderLocationCache::get().getLocations(shader_id).model;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
+
+		ModelSetTransformUniform(model_loc, this->hierarchy.getWorld(node));
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			this->meshes[this->mesh_refs[this->node_mesh_first[node] + j]].drawInstanced(shader_id, this->instances,
+				GLsizei(count), lod);
+		}
+	}
+}
+
+// Draw at full detail with one multi-draw indirect call per geometry buffer and material
+// The shader reads per-draw transforms and material indices through INDIRECT_GLSL (indirect_draw_base + gl_DrawIDARB).
+// Falls back to draw() (the "model" uniform path) when the context lacks GL 4.3 / ARB_shader_draw_parameters
+// or the meshes are not in the geometry pool (ModelSettings::use_geometry_pool).
+// Return: true if the indirect path was used
+template <typename T>
+bool Model<T>::drawIndirect(GLuint shader_id)
+{
+	if (!this->submitIndirect(shader_id, nullptr, 0))
+	{
+		this->draw(shader_id);
+		return false;
+	}
+	return true;
+}
+
+// Draw with per-mesh LOD selection with multi-draw indirect (see above)
+// Meshes are culled once; the fallback draws from the same visibility (frame stats count each mesh once)
+// Return: true if the indirect path was used
+template <typename T>
+bool Model<T>::drawIndirect(GLuint shader_id, Camera<T>& camera, Mat4<T> projection)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	T pixel_scale = projection[1].y * T(viewport[3]) / 2;
+	Vec3<T> cam_pos = camera.getPos();
+
+	this->advanceLODFrame();
+	this->cullMeshRefs(camera, projection, this->root_transform);
+	if (!this->submitIndirect(shader_id, &cam_pos, pixel_scale))
+	{
+		RendSubmitTimer timer;
+		this->drawNodes(shader_id, this->root_transform, &cam_pos, pixel_scale);
+		return false;
+	}
+	return true;
+}
+
+// Collect and issue indirect draws
+// cam_pos = camera position for LOD selection and culling by cullMeshRefs() (nullptr: full detail, no culling)
+// Return: false if the indirect path is not available (nothing drawn)
+template <typename T>
+bool Model<T>::submitIndirect(GLuint shader_id, const Vec3<T>* cam_pos, T pixel_scale)
+{
+	if (!RendIsIndirectSupported())
+		return false;
+	for (const Mesh<T>& mesh : this->meshes)
+	{
+		if (!mesh.isPooled())
+			return false;
+	}
+
+	RendSubmitTimer timer;
+	this->hierarchy.update();
+
+	IndirectDrawData data;
+	NodeTransform<T> world;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
+
+		NodeTransformMul(this->root_transform, this->hierarchy.getWorld(node), world);
+		for (int i = 0; i < 16; i++)
+			data.model[i] = GLfloat(world.m[i]);
+		T scale = cam_pos ? NodeTransformMaxScale(world) : T(1);
+
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			uint32_t ref = this->node_mesh_first[node] + j;
+			if (cam_pos && !this->cull_visible[ref])
+				continue;
+			uint32_t mesh_index = this->mesh_refs[ref];
+			Mesh<T>& mesh = this->meshes[mesh_index];
+			size_t lod = cam_pos ? this->selectMeshLOD(ref, world, scale, pixel_scale, *cam_pos) : 0;
+			mesh.addIndirect(this->indirect, lod, this->mesh_material[mesh_index], data);
+		}
+	}
+
+	size_t num_draws = this->indirect.size();
+	size_t num_calls = this->indirect.submit(ShaderLocationCache::get().getLocations(shader_id).indirect_draw_base,
+		[&](uint32_t material) { this->meshes[this->material_mesh[material]].bindMaterial(shader_id); });
+
+	RendFrameStats& stats = FrameStats::get().counters();
+	stats.draw_calls += num_calls;
+	stats.indirect_draws += num_draws;
+	return true;
+}
+
+// Record full detail draws in a render queue (drawn by RenderQueue::submit)
+template <typename T>
+void Model<T>::enqueue(RenderQueue<T>& queue, GLuint shader_id, bool translucent)
+{
+	this->enqueueNodes(queue, shader_id, translucent, nullptr, 0);
+}
+
+// Record draws with per-mesh LOD selection in a render queue
+template <typename T>
+void Model<T>::enqueue(RenderQueue<T>& queue, GLuint shader_id, Camera<T>& camera, Mat4<T> projection, bool translucent)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	T pixel_scale = projection[1].y * T(viewport[3]) / 2;
+	Vec3<T> cam_pos = camera.getPos();
+
+	this->advanceLODFrame();
+	this->cullMeshRefs(camera, projection, this->root_transform);
+	this->enqueueNodes(queue, shader_id, translucent, &cam_pos, pixel_scale);
+}
+
+// Record one packet per node mesh
+// cam_pos = camera position for LOD selection and culling by cullMeshRefs() (nullptr: full detail, no culling)
+template <typename T>
+void Model<T>::enqueueNodes(RenderQueue<T>& queue, GLuint shader_id, bool translucent, const Vec3<T>* cam_pos,
+	T pixel_scale)
+{
+	this->hierarchy.update();
+
+	NodeTransform<T> world;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
+
+		NodeTransformMul(this->root_transform, this->hierarchy.getWorld(node), world);
+		T scale = cam_pos ? NodeTransformMaxScale(world) : T(1);
+
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
+		{
+			uint32_t ref = this->node_mesh_first[node] + j;
+			if (cam_pos && !this->cull_visible[ref])
+				continue;
+			Mesh<T>& mesh = this->meshes[this->mesh_refs[ref]];
+			size_t lod = cam_pos ? this->selectMeshLOD(ref, world, scale, pixel_scale, *cam_pos) : 0;
+			queue.add(shader_id, mesh, lod, world, translucent);
+		}
+	}
 }
 
 template <typename T>
 void Model<T>::loadModel(std::string path)
 {
+	this->directory = path.substr(0, path.find_last_of('/'));
+
+	// Warm start: mapped cache file, no Assimp
+	if (this->settings.use_cache && this->loadCache(path))
+	{
+		if (this->settings.report_load_time)
+		{
+			ModelTextureStats tex_stats = this->getTextureStats();
+			printf("Model %s (cache): map %.2f ms, upload %.2f ms, %zu meshes\n", path.c_str(),
+				this->load_stats.parse_ms, this->load_stats.upload_ms, this->load_stats.num_meshes);
+			printf("Model %s (cache): %zu textures, %zu KB (%zu KB saved vs RGBA8), geometry %zu KB\n", path.c_str(),
+				tex_stats.num_textures, tex_stats.bytes / 1024, tex_stats.bytesSaved() / 1024,
+				this->load_stats.geometry_bytes / 1024);
+		}
+		return;
+	}
+
+	// Parse
+	auto start = std::chrono::steady_clock::now();
 	Assimp::Importer import;
-	const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals /*| aiProcess_FixInfacingNormals*/);
+	const aiScene* scene = import.ReadFile(path, this->getImportFlags());
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
 		std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
 		return;
 	}
-	this->directory = path.substr(0, path.find_last_of('/'));
+	this->load_stats.parse_ms = ModelElapsedMs(start);
+
+	// Convert (CPU only, parallel; each scene mesh once, in scene order, referenced by nodes)
+	start = std::chrono::steady_clock::now();
+	std::vector<NodeData<T>> nodes;
+	this->processNode(scene->mRootNode, -1, nodes);
+
+	size_t num_meshes = scene->mNumMeshes;
+	std::vector<MeshData<T>> mesh_data(num_meshes);
+	if (this->settings.optimize_meshes)
+		this->opt_stats.resize(num_meshes);
+	auto convert = [&](size_t i)
+	{
+		mesh_data[i] = this->processMesh(scene->mMeshes[i], scene,
+			this->settings.optimize_meshes ? &this->opt_stats[i] : nullptr);
+	};
+	if (this->settings.parallel_import)
+	{
+		ThreadPool& pool = RendGetThreadPool();
+		pool.parallelFor(num_meshes, convert);
+		this->load_stats.num_threads = pool.numThreads() + 1;
+	}
+	else
+	{
+		for (size_t i = 0; i < num_meshes; i++)
+			convert(i);
+	}
+	this->load_stats.convert_ms = ModelElapsedMs(start);
 
-	this->processNode(scene->mRootNode, scene);
+	// Cold start: write cache for next time (before buffers are moved into meshes)
+	if (this->settings.use_cache)
+	{
+		std::string cache_path = MeshCacheGetPath(path, this->settings.cache_dir);
+		if (!MeshCacheWrite(cache_path, path, this->getImportFlags(), this->getCacheOptions(), mesh_data, nodes))
+			fprintf(stderr, "Could not write mesh cache %s\n", cache_path.c_str());
+	}
+
+	// Upload (GL thread)
+	start = std::chrono::steady_clock::now();
+	this->buildHierarchy(nodes);
+	this->meshes.reserve(mesh_data.size());
+	for (MeshData<T>& data : mesh_data)
+	{
+		this->meshes.emplace_back(std::move(data.vertices), std::move(data.indices),
+			this->loadMaterialTextures(data.texture_refs), std::move(data.lods), this->settings.vertex_format,
+			this->settings.use_geometry_pool);
+	}
+	this->buildMaterials();
+	this->load_stats.upload_ms = ModelElapsedMs(start);
+	this->load_stats.num_meshes = this->meshes.size();
+	for (const Mesh<T>& mesh : this->meshes)
+		this->load_stats.geometry_bytes += mesh.getGPUBytes();
+
+	if (this->settings.report_load_time)
+	{
+		ModelTextureStats tex_stats = this->getTextureStats();
+		printf("Model %s: parse %.2f ms, convert %.2f ms (%u threads), upload %.2f ms, %zu meshes\n", path.c_str(),
+			this->load_stats.parse_ms, this->load_stats.convert_ms, this->load_stats.num_threads,
+			this->load_stats.upload_ms, this->load_stats.num_meshes);
+		printf("Model %s: %zu textures, %zu KB (%zu KB saved vs RGBA8), geometry %zu KB\n", path.c_str(),
+			tex_stats.num_textures, tex_stats.bytes / 1024, tex_stats.bytesSaved() / 1024,
+			this->load_stats.geometry_bytes / 1024);
+
+		// Triangle-weighted vertex cache stats over all meshes
+		if (!this->opt_stats.empty())
+		{
+			MeshOptStats total;
+			double num_tris = 0;
+			for (size_t i = 0; i < this->opt_stats.size(); i++)
+			{
+				double n = double(this->meshes[i].lods[0].num_indices / 3);
+				total.before.acmr += float(this->opt_stats[i].before.acmr * n);
+				total.after.acmr += float(this->opt_stats[i].after.acmr * n);
+				total.before.atvr += float(this->opt_stats[i].before.atvr * n);
+				total.after.atvr += float(this->opt_stats[i].after.atvr * n);
+				num_tris += n;
+			}
+			if (num_tris > 0)
+				printf("Model %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", path.c_str(),
+					total.before.acmr / num_tris, total.after.acmr / num_tris,
+					total.before.atvr / num_tris, total.after.atvr / num_tris);
+		}
+	}
 }
 
+// Load meshes from binary cache file
+// Return: true if cache was current and loaded
 template <typename T>
-void Model<T>::processNode(aiNode* node, const aiScene* scene)
+bool Model<T>::loadCache(const std::string& path)
 {
-	// Process all the node's meshes (if any)
-	for (GLuint i = 0; i < node->mNumMeshes; i++)
-	{
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		this->meshes.push_back(this->processMesh(mesh, scene));
-	}
-	// Then do the same for each of its children
-	for (GLuint i = 0; i < node->mNumChildren; i++)
+	auto start = std::chrono::steady_clock::now();
+	MeshCacheReader<T> cache;
+	if (!cache.open(MeshCacheGetPath(path, this->settings.cache_dir), path, this->getImportFlags(), this->getCacheOptions()))
+		return false;
+	this->load_stats.parse_ms = ModelElapsedMs(start);
+	this->load_stats.from_cache = true;
+
+	start = std::chrono::steady_clock::now();
+	this->buildHierarchy(cache.nodeData());
+	this->meshes.reserve(cache.numMeshes());
+	for (size_t i = 0; i < cache.numMeshes(); i++)
 	{
-		this->processNode(node->mChildren[i], scene);
+		this->meshes.emplace_back(cache.vertices(i), cache.numVertices(i), cache.indices(i), cache.numIndices(i),
+			this->loadMaterialTextures(cache.textureRefs(i)), cache.meshLODs(i), this->settings.vertex_format,
+			this->settings.use_geometry_pool);
 	}
+	this->buildMaterials();
+	this->load_stats.upload_ms = ModelElapsedMs(start);
+	this->load_stats.num_meshes = this->meshes.size();
+	for (const Mesh<T>& mesh : this->meshes)
+		this->load_stats.geometry_bytes += mesh.getGPUBytes();
+
+	return true;
 }
 
+// Update world transforms and test the world bounding sphere of every node mesh against the view frustum
+// Fills cull_visible (indexed like mesh_refs) and adds to the frame's visible / culled counts
+// base = transform applied on top of node world transforms
 template <typename T>
-Mesh<T> Model<T>::processMesh(aiMesh* mesh, const aiScene* scene)
+void Model<T>::cullMeshRefs(Camera<T>& camera, Mat4<T> projection, const NodeTransform<T>& base)
 {
-	std::vector<Vertex<T>> vertices;
-	std::vector<GLuint> indices;
-	std::vector<Texture> textures;
+	this->hierarchy.update();
+	this->cull_visible.resize(this->mesh_refs.size());
 
-	for (GLuint i = 0; i < mesh->mNumVertices; i++)
+	if (!this->settings.frustum_culling)
 	{
-		Vertex<T> vertex;
-		// Process vertex positions, normals and texture coordinates
-		// TODO: Set up fromData() function, = operator, or constructor for Vec3 here
-		Vec3<T> vector;
-		vector.x = mesh->mVertices[i].x;
-		vector.y = mesh->mVertices[i].y;
-		vector.z = mesh->mVertices[i].z;
-		vertex.pos = vector;
+		std::fill(this->cull_visible.begin(), this->cull_visible.end(), uint8_t(1));
+		FrameStats::get().counters().visible += this->mesh_refs.size();
+		return;
+	}
 
-		vector.x = mesh->mNormals[i].x;
-		vector.y = mesh->mNormals[i].y;
-		vector.z = mesh->mNormals[i].z;
-		vertex.norm = vector;
+	this->cull_spheres.clear();
+	NodeTransform<T> world;
+	for (uint32_t node = 0; node < this->hierarchy.size(); node++)
+	{
+		if (this->node_mesh_count[node] == 0)
+			continue;
 
-		if (mesh->mTextureCoords[0]) // Check for texture coordinates
+		NodeTransformMul(base, this->hierarchy.getWorld(node), world);
+		T scale = NodeTransformMaxScale(world);
+		for (uint32_t j = 0; j < this->node_mesh_count[node]; j++)
 		{
-			Vec2<T> vec;
-			vec.x = mesh->mTextureCoords[0][i].x;
-			vec.y = mesh->mTextureCoords[0][i].y;
-			vertex.uv = vec;
+			const MeshBounds<T>& bounds = this->meshes[this->mesh_refs[this->node_mesh_first[node] + j]].bounds;
+			Vec3<T> c = NodeTransformPoint(world, bounds.center);
+			this->cull_spheres.push(float(c.x), float(c.y), float(c.z), float(bounds.radius * scale));
 		}
-		else
-			vertex.uv = Vec2<T>();
+	}
+
+	// Node mesh ranges are consecutive in node order, so spheres line up with mesh_refs
+	size_t num_visible = RendCullSpheres(camera.getFrustum(projection), this->cull_spheres, this->cull_visible.data());
+
+	RendFrameStats& stats = FrameStats::get().counters();
+	stats.visible += num_visible;
+	stats.culled += this->mesh_refs.size() - num_visible;
+}
 
-		vertices.push_back(vertex);
+// Assign material indices (meshes with the same textures in the same order share a material)
+template <typename T>
+void Model<T>::buildMaterials()
+{
+	this->mesh_material.resize(this->meshes.size());
+	this->material_mesh.clear();
+
+	for (size_t i = 0; i < this->meshes.size(); i++)
+	{
+		const std::vector<Texture>& textures = this->meshes[i].textures;
+		uint32_t material = uint32_t(this->material_mesh.size());
+		for (uint32_t m = 0; m < this->material_mesh.size(); m++)
+		{
+			const std::vector<Texture>& other = this->meshes[this->material_mesh[m]].textures;
+			if (other.size() == textures.size() && std::equal(textures.begin(), textures.end(), other.begin(),
+				[](const Texture& a, const Texture& b) { return a.id == b.id && a.type == b.type; }))
+			{
+				material = m;
+				break;
+			}
+		}
+		if (material == this->material_mesh.size())
+			this->material_mesh.push_back(uint32_t(i));
+		this->mesh_material[i] = material;
 	}
-	// Process indices
-	for (GLuint i = 0; i < mesh->mNumFaces; i++)
+}
+
+// Build transform hierarchy and mesh references from node data (depth-first order)
+template <typename T>
+void Model<T>::buildHierarchy(const std::vector<NodeData<T>>& nodes)
+{
+	this->hierarchy.clear();
+	this->hierarchy.reserve(nodes.size());
+	this->node_names.clear();
+	this->node_mesh_first.clear();
+	this->node_mesh_count.clear();
+	this->mesh_refs.clear();
+
+	for (const NodeData<T>& node : nodes)
 	{
-		aiFace face = mesh->mFaces[i];
-		for (GLuint j = 0; j < face.mNumIndices; j++)
-			indices.push_back(face.mIndices[j]);
+		if (this->hierarchy.addNode(node.parent, node.local) < 0)
+			break;
+		this->node_names.push_back(node.name);
+		this->node_mesh_first.push_back(static_cast<uint32_t>(this->mesh_refs.size()));
+		this->node_mesh_count.push_back(static_cast<uint32_t>(node.meshes.size()));
+		this->mesh_refs.insert(this->mesh_refs.end(), node.meshes.begin(), node.meshes.end());
+	}
+}
+
+// Flatten node tree in depth-first order, keeping local transforms and mesh references
+template <typename T>
+void Model<T>::processNode(aiNode* node, int32_t parent, std::vector<NodeData<T>>& nodes)
+{
+	int32_t index = static_cast<int32_t>(nodes.size());
+	nodes.emplace_back();
+	NodeData<T>& data = nodes.back();
+	data.parent = parent;
+	data.name = node->mName.C_Str();
+	data.local = ModelConvertTransform<T>(node->mTransformation);
+	data.meshes.assign(node->mMeshes, node->mMeshes + node->mNumMeshes);
+
+	// Then do the same for each of its children
+	for (GLuint i = 0; i < node->mNumChildren; i++)
+	{
+		this->processNode(node->mChildren[i], index, nodes);
+	}
+}
+
+// Convert mesh to CPU-side data (no GL calls, safe on worker threads)
+// stats = optimization stats output (nullptr: no optimization)
+template <typename T>
+MeshData<T> Model<T>::processMesh(aiMesh* mesh, const aiScene* scene, MeshOptStats* stats)
+{
+	MeshData<T> data;
+	std::vector<Vertex<T>>& vertices = data.vertices;
+	std::vector<GLuint>& indices = data.indices;
+	std::vector<TextureRef>& textures = data.texture_refs;
+
+	// Process vertex positions, normals, texture coordinates and indices
+	ModelConvertGeometry(mesh, vertices, indices);
+	size_t num_indices = indices.size();
+
+	// Optimize (triangle-only meshes; points and lines are left as imported)
+	bool triangles = num_indices == size_t(mesh->mNumFaces) * 3;
+	if (stats && triangles)
+		*stats = MeshOptimize(vertices, indices);
+
+	// LOD chain, each level simplified from the previous one and appended to the index buffer
+	if (this->settings.lod_levels > 0 && triangles)
+	{
+		data.lods.push_back({ 0, GLuint(num_indices), 0.0f });
+		for (unsigned int level = 1; level <= this->settings.lod_levels; level++)
+		{
+			MeshLOD prev = data.lods.back();
+			size_t target = size_t(prev.num_indices * this->settings.lod_ratio) / 3 * 3;
+			float error = 0;
+			std::vector<GLuint> lod = MeshSimplify(vertices.data(), vertices.size(), indices.data() + prev.first_index,
+				prev.num_indices, target, this->settings.lod_max_error, &error);
+
+			// Stop when simplification stalls (locked borders/seams or error limit)
+			if (lod.empty() || lod.size() > prev.num_indices * 9 / 10)
+				break;
+			if (stats)
+				MeshOptimizeVertexCache(lod.data(), lod.size(), vertices.size());
+
+			// Errors accumulate across steps
+			data.lods.push_back({ GLuint(indices.size()), GLuint(lod.size()), prev.error + error });
+			indices.insert(indices.end(), lod.begin(), lod.end());
+		}
 	}
 
 	// Process material
 	if (mesh->mMaterialIndex >= 0)
 	{
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-		std::vector<Texture> diffuseMaps = this->loadMaterialTextures(material,
+		std::vector<TextureRef> diffuseMaps = this->getMaterialTextureRefs(material,
 			aiTextureType_DIFFUSE, "texture_diffuse");
 		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-		std::vector<Texture> specularMaps = this->loadMaterialTextures(material,
+		std::vector<TextureRef> specularMaps = this->getMaterialTextureRefs(material,
 			aiTextureType_SPECULAR, "texture_specular");
 		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 
@@ -151,36 +1071,40 @@ Mesh<T> Model<T>::processMesh(aiMesh* mesh, const aiScene* scene)
 			fprintf(stderr, "Multiple specular maps loaded for this mesh, but may not be fully supported");
 	}
 
-	return Mesh<T>(vertices, indices, textures);
+	return data;
 }
 
+// Get material texture references (no loading, safe off the GL thread)
 template <typename T>
-std::vector<Texture> Model<T>::loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+std::vector<TextureRef> Model<T>::getMaterialTextureRefs(aiMaterial* mat, aiTextureType type, std::string typeName)
 {
-	std::vector<Texture> textures;
+	std::vector<TextureRef> refs;
 	for (GLuint i = 0; i < mat->GetTextureCount(type); i++)
 	{
 		aiString str;
 		mat->GetTexture(type, i, &str);
-		GLboolean skip = false;
-		for (GLuint j = 0; j < textures_loaded.size(); j++)
-		{
-			if (std::strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
-			{
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break;
-			}
-		}
-		if (!skip)
-		{   // If texture hasn't been loaded already, load it
-			Texture texture;
-			texture.id = RendLoadTexture((this->directory + '/' + str.C_Str()).c_str());
-			texture.type = typeName;
-			texture.path = str;
-			textures.push_back(texture);
-			this->textures_loaded.push_back(texture);  // Add to loaded textures
-		}
+		refs.push_back({ typeName, str.C_Str() });
+	}
+	return refs;
+}
+
+// Load textures from references through the shared texture cache (GL thread)
+template <typename T>
+std::vector<Texture> Model<T>::loadMaterialTextures(const std::vector<TextureRef>& refs)
+{
+	std::vector<Texture> textures;
+	textures.reserve(refs.size());
+	for (const TextureRef& ref : refs)
+	{
+		Texture texture;
+		texture.id = TextureCache::get().acquire(this->directory + '/' + ref.path, this->settings.texture_options,
+			this->settings.async_textures);
+		texture.type = ref.type;
+		texture.path = aiString(ref.path);
+		textures.push_back(texture);
+
+		if (texture.id != 0)
+			this->textures_loaded.push_back(texture);	// Released on destruction
 	}
 	return textures;
 }
@@ -0,0 +1,214 @@
+// *****************************************************************************************************************************
+// gl_queue.hpp
+// OpenGL Rendering
+// Render queue: draw packets sorted by 64-bit state / depth keys
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_QUEUE_HPP
+#define GL_QUEUE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "vec.hpp"
+#include "mat.hpp"
+
+#include "gl_mesh.hpp"
+#include "gl_hierarchy.hpp"
+#include "gl_shader.hpp"
+#include "gl_state.hpp"
+#include "gl_stats.hpp"
+
+// Sort key layout (ascending order = submission order)
+// Opaque:      [63] 0 | [62..53] program | [52..45] VAO | [44..29] material | [28..5] depth (near first) | [4..0] 0
+// Translucent: [63] 1 | [62..39] depth (far first) | [38..29] program | [28..21] VAO | [20..5] material | [4..0] 0
+// Fields are the low bits of the GL names / material hash: collisions only cost state changes, never correctness.
+#define QUEUE_KEY_TRANSLUCENT (1ull << 63)
+
+// Sort 64-bit keys with a payload, least significant byte first (passes where all keys share the byte are skipped)
+// tmp_keys / tmp_values = scratch storage (resized as needed, reuse between calls to avoid allocations)
+void RendRadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& tmp_keys,
+	std::vector<uint32_t>& tmp_values)
+{
+	size_t count = keys.size();
+	if (count < 2)
+		return;
+	tmp_keys.resize(count);
+	tmp_values.resize(count);
+
+	// All eight histograms in one pass over the keys
+	uint32_t histograms[8][256];
+	std::memset(histograms, 0, sizeof(histograms));
+	for (uint64_t key : keys)
+	{
+		for (int pass = 0; pass < 8; pass++)
+			histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+	}
+
+	for (int pass = 0; pass < 8; pass++)
+	{
+		uint32_t* histogram = histograms[pass];
+		if (histogram[(keys[0] >> (pass * 8)) & 0xFF] == count)
+			continue;
+
+		// Exclusive prefix sum -> output offsets
+		uint32_t sum = 0;
+		for (int b = 0; b < 256; b++)
+		{
+			uint32_t n = histogram[b];
+			histogram[b] = sum;
+			sum += n;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t dst = histogram[(keys[i] >> (pass * 8)) & 0xFF]++;
+			tmp_keys[dst] = keys[i];
+			tmp_values[dst] = values[i];
+		}
+		keys.swap(tmp_keys);
+		values.swap(tmp_values);
+	}
+}
+
+// Return: 24-bit depth for sort keys (bit pattern of a non-negative float increases with its value)
+uint32_t QueueDepthBits(float depth)
+{
+	if (!(depth > 0))
+		return 0;
+	uint32_t bits;
+	std::memcpy(&bits, &depth, sizeof(bits));
+	return bits >> 7;	// Sign bit is 0: drop it and the low mantissa bits
+}
+
+// Return: opaque or translucent sort key
+uint64_t QueueMakeKey(GLuint program, GLuint vao, uint32_t material, float depth, bool translucent)
+{
+	uint64_t p = program & 0x3FF;
+	uint64_t v = vao & 0xFF;
+	uint64_t m = material & 0xFFFF;
+	uint64_t d = QueueDepthBits(depth) & 0xFFFFFF;
+
+	if (translucent)
+		return QUEUE_KEY_TRANSLUCENT | ((0xFFFFFF - d) << 39) | (p << 29) | (v << 21) | (m << 5);
+	return (p << 53) | (v << 45) | (m << 29) | (d << 5);
+}
+
+// RENDER QUEUE
+// Records draw packets for one frame, then sorts and submits them: opaque draws grouped by program, geometry and
+// material (front to back within a group, for early-Z), then translucent draws back to front with alpha blending.
+// Packet storage is kept between frames (no allocations once capacities settle).
+template <typename T = float>
+class RenderQueue
+{
+private:
+	struct Packet
+	{
+		Mesh<T>* mesh;
+		size_t lod;
+		GLuint program;
+		GLfloat model[16];
+	};
+	std::vector<Packet> packets;
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> order;
+	std::vector<uint64_t> tmp_keys;
+	std::vector<uint32_t> tmp_order;
+	Vec3<T> view_pos;
+public:
+	void begin(const Vec3<T>& view_position);
+	void add(GLuint program, Mesh<T>& mesh, size_t lod, const NodeTransform<T>& world, bool translucent = false);
+	void submit();
+	void clear() { packets.clear(); keys.clear(); order.clear(); }
+	size_t size() const { return packets.size(); }
+};
+
+// Start a frame (clears the queue)
+// view_position = camera position in world space (depth = distance to each mesh's bounding sphere center)
+template <typename T>
+void RenderQueue<T>::begin(const Vec3<T>& view_position)
+{
+	this->clear();
+	this->view_pos = view_position;
+}
+
+// Record a draw
+// world = model matrix of the mesh
+// translucent = drawn after all opaque draws, back to front with alpha blending and no depth writes
+template <typename T>
+void RenderQueue<T>::add(GLuint program, Mesh<T>& mesh, size_t lod, const NodeTransform<T>& world, bool translucent)
+{
+	Vec3<T> d = NodeTransformPoint(world, mesh.bounds.center) - this->view_pos;
+	float depth = float(std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+
+	this->keys.push_back(QueueMakeKey(program, mesh.getVAO(), mesh.getMaterialKey(), depth, translucent));
+	this->order.push_back(uint32_t(this->packets.size()));
+
+	this->packets.emplace_back();
+	Packet& packet = this->packets.back();
+	packet.mesh = &mesh;
+	packet.lod = lod;
+	packet.program = program;
+	for (int i = 0; i < 16; i++)
+		packet.model[i] = GLfloat(world.m[i]);
+}
+
+// Sort and draw all packets, then clear the queue
+// Sets the "model" uniform per packet; material uniforms are only set when the material changes.
+template <typename T>
+void RenderQueue<T>::submit()
+{
+	RendSubmitTimer timer;
+	RendRadixSort(this->keys, this->order, this->tmp_keys, this->tmp_order);
+
+	StateCache& state = StateCache::get();
+	const Mesh<T>* prev_mesh = nullptr;
+	GLuint prev_program = 0;
+	bool blending = false;
+
+	for (size_t i = 0; i < this->order.size(); i++)
+	{
+		const Packet& packet = this->packets[this->order[i]];
+		Mesh<T>& mesh = *packet.mesh;
+
+		if (!blending && (this->keys[i] & QUEUE_KEY_TRANSLUCENT))
+		{
+			state.setEnabled(GL_BLEND, true);
+			state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			state.depthMask(false);
+			blending = true;
+		}
+
+		state.useProgram(packet.program);
+		const ShaderLocations& loc = ShaderLocationCache::get().getLocations(packet.program);
+		glUniformMatrix4fv(loc.model, 1, GL_FALSE, packet.model);
+
+		// Material uniforms persist in the program: skip when the previous draw used the same textures
+		// (compact meshes also need their own dequantization)
+		bool same_material = prev_mesh && packet.program == prev_program &&
+			(prev_mesh == &mesh || (mesh.getVertexFormat() == MESH_VERTEX_FLOAT && mesh.hasSameTextures(*prev_mesh)));
+		if (same_material)
+			mesh.drawGeometry(packet.lod);
+		else
+			mesh.draw(packet.program, packet.lod);
+
+		prev_mesh = &mesh;
+		prev_program = packet.program;
+	}
+
+	if (blending)
+	{
+		state.depthMask(true);
+		state.setEnabled(GL_BLEND, false);
+	}
+	this->clear();
+}
+
+#endif
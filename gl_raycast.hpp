@@ -0,0 +1,271 @@
+// *****************************************************************************************************************************
+// gl_raycast.hpp
+// OpenGL Rendering
+// CPU ray casting against triangle meshes (per-mesh triangle BVH, SSE ray / triangle kernel)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_RAYCAST_HPP
+#define GL_RAYCAST_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYCAST_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include "gl_bvh.hpp"
+
+#define RAYCAST_EPSILON 1e-12f		// Determinant below which a ray is treated as parallel to a triangle
+
+// RAY HIT
+// Closest hit of a ray cast (mesh / node = -1: no hit)
+struct RayHit
+{
+	int32_t mesh = -1;			// Index of mesh in the model
+	int32_t node = -1;			// Node the mesh was drawn at
+	uint32_t triangle = 0;		// Triangle in LOD 0 (indices[triangle * 3 .. + 2])
+	float u = 0, v = 0;			// Barycentrics: point = (1 - u - v) * p0 + u * p1 + v * p2
+	float distance = FLT_MAX;	// Ray parameter (distance for a normalized direction)
+};
+
+// TRIANGLE BVH
+// Binned SAH tree over the triangles of one mesh. Leaf triangles are stored as SoA (p0, edge1, edge2),
+// so the kernel tests four consecutive triangles with one set of SSE operations.
+class TriangleBVH
+{
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> triangles;	// Original triangle index per packed slot
+	std::vector<float> soa[9];			// p0.xyz, e1.xyz, e2.xyz per packed slot (3 zeroed slots after the last)
+	std::vector<uint32_t> stack;		// Traversal scratch
+
+	void intersectLeaf(const BVHNode& node, const float o[3], const float d[3], float& t_best, uint32_t& hit_slot,
+		float& hit_u, float& hit_v) const;
+public:
+	void build(const float* positions, size_t stride, const uint32_t* indices, size_t num_indices);
+	bool intersect(const float origin[3], const float dir[3], float t_max, RayHit& hit);
+
+	bool empty() const { return nodes.empty(); }
+	size_t numTriangles() const { return triangles.size(); }
+};
+
+// Build from an indexed triangle list
+// positions = first vertex position (3 floats), stride = bytes between vertices
+void TriangleBVH::build(const float* positions, size_t stride, const uint32_t* indices, size_t num_indices)
+{
+	size_t num_tris = num_indices / 3;
+	this->nodes.clear();
+	this->triangles.clear();
+	if (num_tris == 0)
+		return;
+
+	auto vertex = [&](uint32_t i) { return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + i * stride); };
+
+	// Triangle boxes -> shared SAH builder
+	std::vector<float> mins(num_tris * 3), maxs(num_tris * 3);
+	for (size_t t = 0; t < num_tris; t++)
+	{
+		const float* p0 = vertex(indices[t * 3]);
+		const float* p1 = vertex(indices[t * 3 + 1]);
+		const float* p2 = vertex(indices[t * 3 + 2]);
+		for (int k = 0; k < 3; k++)
+		{
+			mins[t * 3 + k] = std::min(p0[k], std::min(p1[k], p2[k]));
+			maxs[t * 3 + k] = std::max(p0[k], std::max(p1[k], p2[k]));
+		}
+	}
+	{
+		InstanceBVH builder;
+		builder.build(mins.data(), maxs.data(), num_tris);
+		this->nodes = builder.getNodes();
+		this->triangles = builder.getIndices();
+	}
+
+	// Pack in leaf order. Leaves start at any slot, so a leaf's last group of four may read up to 3 slots past its
+	// end: into the next leaf (harmless) or the zeroed tail (degenerate triangles never hit).
+	for (std::vector<float>& a : this->soa)
+		a.assign(num_tris + 3, 0.0f);
+	for (size_t s = 0; s < num_tris; s++)
+	{
+		size_t t = this->triangles[s];
+		const float* p0 = vertex(indices[t * 3]);
+		const float* p1 = vertex(indices[t * 3 + 1]);
+		const float* p2 = vertex(indices[t * 3 + 2]);
+		for (int k = 0; k < 3; k++)
+		{
+			this->soa[k][s] = p0[k];
+			this->soa[3 + k][s] = p1[k] - p0[k];
+			this->soa[6 + k][s] = p2[k] - p0[k];
+		}
+	}
+}
+
+// Test the triangles of a leaf (Moller-Trumbore, double-sided)
+// t_best = closest hit so far, updated with hit_slot / hit_u / hit_v when a closer hit is found
+void TriangleBVH::intersectLeaf(const BVHNode& node, const float o[3], const float d[3], float& t_best,
+	uint32_t& hit_slot, float& hit_u, float& hit_v) const
+{
+	uint32_t s = node.first;
+	uint32_t end = node.first + node.count;
+
+#ifdef RAYCAST_USE_SSE
+	const __m128 ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]);
+	const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(RAYCAST_EPSILON);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	for (; s < end; s += 4)
+	{
+		__m128 p0x = _mm_loadu_ps(&this->soa[0][s]), p0y = _mm_loadu_ps(&this->soa[1][s]), p0z = _mm_loadu_ps(&this->soa[2][s]);
+		__m128 e1x = _mm_loadu_ps(&this->soa[3][s]), e1y = _mm_loadu_ps(&this->soa[4][s]), e1z = _mm_loadu_ps(&this->soa[5][s]);
+		__m128 e2x = _mm_loadu_ps(&this->soa[6][s]), e2y = _mm_loadu_ps(&this->soa[7][s]), e2z = _mm_loadu_ps(&this->soa[8][s]);
+
+		// pvec = d x e2, det = e1 . pvec
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 valid = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), eps);
+		__m128 inv_det = _mm_div_ps(one, det);
+
+		// u = (o - p0) . pvec / det
+		__m128 tx = _mm_sub_ps(ox, p0x), ty = _mm_sub_ps(oy, p0y), tz = _mm_sub_ps(oz, p0z);
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+		// qvec = tvec x e1, v = d . qvec / det, t = e2 . qvec / det
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(t_best)));
+
+		int mask = _mm_movemask_ps(valid);
+		if (!mask)
+			continue;
+
+		float ts[4], us[4], vs[4];
+		_mm_storeu_ps(ts, t);
+		_mm_storeu_ps(us, u);
+		_mm_storeu_ps(vs, v);
+		for (int k = 0; k < 4; k++)
+		{
+			if ((mask >> k) & 1 && ts[k] < t_best && s + k < this->triangles.size())
+			{
+				t_best = ts[k];
+				hit_slot = s + k;
+				hit_u = us[k];
+				hit_v = vs[k];
+			}
+		}
+	}
+#else
+	for (; s < end; s++)
+	{
+		const float e1[3] = { this->soa[3][s], this->soa[4][s], this->soa[5][s] };
+		const float e2[3] = { this->soa[6][s], this->soa[7][s], this->soa[8][s] };
+		float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (std::fabs(det) <= RAYCAST_EPSILON)
+			continue;
+		float inv_det = 1.0f / det;
+
+		float tv[3] = { o[0] - this->soa[0][s], o[1] - this->soa[1][s], o[2] - this->soa[2][s] };
+		float u = (tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2]) * inv_det;
+		if (u < 0 || u > 1)
+			continue;
+		float q[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0] };
+		float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+		if (v < 0 || u + v > 1)
+			continue;
+		float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+		if (t > 0 && t < t_best)
+		{
+			t_best = t;
+			hit_slot = s;
+			hit_u = u;
+			hit_v = v;
+		}
+	}
+#endif
+}
+
+// Find the closest hit along origin + t * dir with 0 < t < t_max
+// hit = triangle, barycentrics and distance are set on a hit (mesh / node are left to the caller)
+// Return: true on a hit closer than t_max
+bool TriangleBVH::intersect(const float origin[3], const float dir[3], float t_max, RayHit& hit)
+{
+	if (this->nodes.empty())
+		return false;
+
+	float inv_dir[3];
+	for (int k = 0; k < 3; k++)
+		inv_dir[k] = dir[k] != 0 ? 1.0f / dir[k] : (std::signbit(dir[k]) ? -FLT_MAX : FLT_MAX);
+
+	// Return: entry distance of the ray into a node box, FLT_MAX if missed or beyond t_best
+	auto enter = [&](const BVHNode& node, float t_best)
+	{
+		float t0 = 0, t1 = t_best;
+		for (int k = 0; k < 3; k++)
+		{
+			float a = (node.min[k] - origin[k]) * inv_dir[k];
+			float b = (node.max[k] - origin[k]) * inv_dir[k];
+			t0 = std::max(t0, std::min(a, b));
+			t1 = std::min(t1, std::max(a, b));
+		}
+		return t0 <= t1 ? t0 : FLT_MAX;
+	};
+
+	float t_best = t_max;
+	uint32_t hit_slot = 0xFFFFFFFFu;
+	float hit_u = 0, hit_v = 0;
+
+	this->stack.clear();
+	if (enter(this->nodes[0], t_best) != FLT_MAX)
+		this->stack.push_back(0);
+	while (!this->stack.empty())
+	{
+		const BVHNode& node = this->nodes[this->stack.back()];
+		this->stack.pop_back();
+
+		if (!node.left)
+		{
+			this->intersectLeaf(node, origin, dir, t_best, hit_slot, hit_u, hit_v);
+			continue;
+		}
+
+		// Visit the nearer child first (pushed last); skip children beyond the closest hit
+		float ta = enter(this->nodes[node.left], t_best);
+		float tb = enter(this->nodes[node.left + 1], t_best);
+		uint32_t near_child = ta <= tb ? node.left : node.left + 1;
+		uint32_t far_child = ta <= tb ? node.left + 1 : node.left;
+		if (std::max(ta, tb) != FLT_MAX)
+			this->stack.push_back(far_child);
+		if (std::min(ta, tb) != FLT_MAX)
+			this->stack.push_back(near_child);
+	}
+
+	if (hit_slot == 0xFFFFFFFFu)
+		return false;
+
+	hit.triangle = this->triangles[hit_slot];
+	hit.u = hit_u;
+	hit.v = hit_v;
+	hit.distance = t_best;
+	return true;
+}
+
+#endif
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <cstdio>
 #include <vector>
+#include <algorithm>
 
 #define GLEW_STATIC
 #include <GL\glew.h>
@@ -20,6 +21,12 @@
 #define GLFW_INCLUDE_GLU
 #include "GLFW\glfw3.h"
 
+// Headless contexts without a display server (define before including and link libEGL; CMake: OPENGL_HEADLESS_EGL)
+#ifdef RENDER_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "file_help.hpp"
 
 #include "linked_list.hpp"
@@ -31,9 +38,80 @@
 #include "lodepng.h"
 #include "lodepng.cpp"
 
+#include "gl_ktx.hpp"
+#include "gl_geometry.hpp"
+#include "gl_state.hpp"
+
 //#include "gl_shader.hpp"
 
 void RendSetViewport(GLFWwindow* window);
+struct RendTarget;
+struct RendHeadlessContext;
+void RendDeleteTarget(RendTarget& target);
+void RendTerminateHeadless(RendHeadlessContext& context, RendTarget& target);
+
+// RENDER TARGET
+// Offscreen framebuffer (color + depth renderbuffers); multisampled targets are resolved into a single-sample
+// framebuffer before reading
+struct RendTarget
+{
+	GLuint fbo = 0;
+	GLuint color_rb = 0;
+	GLuint depth_rb = 0;
+	GLuint resolve_fbo = 0;		// samples > 1
+	GLuint resolve_rb = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int samples = 0;	// 0: single-sample
+};
+
+// HEADLESS CONTEXT
+// Context without a visible window: a hidden GLFW window, or a surfaceless EGL context (RENDER_USE_EGL)
+struct RendHeadlessContext
+{
+	GLFWwindow* window = nullptr;
+#ifdef RENDER_USE_EGL
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// TEXTURE OPTIONS
+// Sampler and mipmap settings for loaded textures
+struct TextureOptions
+{
+	GLint wrap_s = GL_REPEAT;
+	GLint wrap_t = GL_REPEAT;
+	GLint min_filter = GL_LINEAR_MIPMAP_LINEAR;
+	GLint mag_filter = GL_LINEAR;
+	bool mipmap = true;
+	bool prefer_compressed = true;	// Load <name>.ktx instead of the image when present and up to date
+	bool compact_format = true;		// Store with the fewest channels that keep the image content
+};
+
+// TEXTURE INFO
+// Description of a loaded texture
+struct TextureInfo
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	GLenum internal_format = 0;
+	size_t bytes = 0;			// Estimated GPU memory including mip chain
+	size_t bytes_rgba8 = 0;		// Same texture stored as uncompressed GL_RGBA8 (for savings reports)
+};
+
+// TEXTURE IMAGE
+// Decoded pixels and the upload format chosen for them
+struct TextureImage
+{
+	std::vector<unsigned char> pixels;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int channels = 4;
+	GLenum internal_format = GL_RGBA8;
+	GLenum format = GL_RGBA;
+	GLint swizzle[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+};
 
 // Initialize OpenGL render context
 // Return: GLFW window id created
@@ -71,7 +149,7 @@ GLFWwindow* RendInit(const char *name, unsigned int width = 1024, unsigned int h
 	RendSetViewport(window);
 
 	// Configure OpenGL
-	glEnable(GL_DEPTH_TEST);
+	StateCache::get().setEnabled(GL_DEPTH_TEST, true);
 
 	return window;
 }
@@ -85,40 +163,503 @@ void RendSetViewport(GLFWwindow* window)
 	glViewport(0, 0, width, height);
 }
 
+// Create an offscreen render target
+// samples = MSAA sample count (0 or 1: single-sample, clamped to GL_MAX_SAMPLES)
+// Return: true on success (target is left bound for drawing; on failure its objects are deleted)
+bool RendCreateTarget(RendTarget& target, unsigned int width, unsigned int height, unsigned int samples = 0)
+{
+	GLint max_samples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+	samples = samples > 1 ? std::min(samples, (unsigned int)std::max(max_samples, 1)) : 0;
+	if (samples == 1)
+		samples = 0;
+
+	target.width = width;
+	target.height = height;
+	target.samples = samples;
+
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glGenRenderbuffers(1, &target.color_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.color_rb);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color_rb);
+	glGenRenderbuffers(1, &target.depth_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depth_rb);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depth_rb);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fprintf(stderr, "Offscreen framebuffer %ux%u (%u samples) is incomplete\n", width, height, samples);
+		RendDeleteTarget(target);
+		return false;
+	}
+
+	if (samples)
+	{
+		glGenFramebuffers(1, &target.resolve_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, target.resolve_fbo);
+		glGenRenderbuffers(1, &target.resolve_rb);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.resolve_rb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.resolve_rb);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fprintf(stderr, "Offscreen resolve framebuffer %ux%u is incomplete\n", width, height);
+			RendDeleteTarget(target);
+			return false;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+// Delete render target objects
+void RendDeleteTarget(RendTarget& target)
+{
+	GLuint fbos[2] = { target.fbo, target.resolve_fbo };
+	GLuint rbs[3] = { target.color_rb, target.depth_rb, target.resolve_rb };
+	glDeleteFramebuffers(2, fbos);
+	glDeleteRenderbuffers(3, rbs);
+	target = RendTarget();
+}
+
+// Bind a render target for drawing and set the viewport to its size
+void RendBindTarget(const RendTarget& target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glViewport(0, 0, target.width, target.height);
+}
+
+// Read the color buffer of a render target as RGBA8 (resolves multisampling first; waits for rendering to finish)
+// flip_y = first row is the top of the image (image file order) instead of the bottom (GL order)
+// Return: true on success
+bool RendReadPixels(const RendTarget& target, std::vector<unsigned char>& rgba, bool flip_y = true)
+{
+	if (!target.fbo)
+		return false;
+
+	GLuint read_fbo = target.fbo;
+	if (target.samples)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.resolve_fbo);
+		glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT,
+			GL_NEAREST);
+		read_fbo = target.resolve_fbo;
+	}
+
+	size_t row = size_t(target.width) * 4;
+	rgba.resize(row * target.height);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	StateCache::get().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, target.width, target.height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+
+	if (flip_y)
+	{
+		for (unsigned int y = 0; y < target.height / 2; y++)
+			std::swap_ranges(rgba.begin() + y * row, rgba.begin() + (y + 1) * row, rgba.begin() + (target.height - 1 - y) * row);
+	}
+
+	return true;
+}
+
+// Save the color buffer of a render target as a PNG file
+// Return: true on success
+bool RendSaveTargetPNG(const RendTarget& target, const char* path)
+{
+	std::vector<unsigned char> rgba;
+	if (!RendReadPixels(target, rgba))
+		return false;
+
+	unsigned int error = lodepng::encode(path, rgba, target.width, target.height);
+	if (error)
+	{
+		fprintf(stderr, "Could not write %s: %s\n", path, lodepng_error_text(error));
+		return false;
+	}
+	return true;
+}
+
+// Initialize an OpenGL context without a visible window and create an offscreen render target
+// The hidden GLFW window still needs a display server; define RENDER_USE_EGL for hosts without one (e.g. Mesa's
+// surfaceless platform). Either way works with software rasterizers (Mesa llvmpipe: LIBGL_ALWAYS_SOFTWARE=1).
+// Models, shaders and textures then work as with RendInit; draws go to the target.
+// samples = MSAA sample count of the target (0: single-sample)
+// Return: true on success
+bool RendInitHeadless(RendHeadlessContext& context, RendTarget& target, unsigned int width, unsigned int height,
+	unsigned int samples = 0)
+{
+#ifdef RENDER_USE_EGL
+	// Surfaceless display if available, else the default display
+	context.display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+		context.display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (context.display == EGL_NO_DISPLAY)
+		context.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (context.display == EGL_NO_DISPLAY || !eglInitialize(context.display, nullptr, nullptr))
+	{
+		fprintf(stderr, "Failed to initialize EGL display\n");
+		return false;
+	}
+
+	// Surface type defaults to windows, which surfaceless displays do not have
+	const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(context.display, config_attribs, &config, 1, &num_configs) || num_configs < 1 ||
+		!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "No EGL config for desktop OpenGL\n");
+		eglTerminate(context.display);
+		return false;
+	}
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context.context = eglCreateContext(context.display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context.context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(context.display, EGL_NO_SURFACE, EGL_NO_SURFACE, context.context))	// EGL_KHR_surfaceless_context
+	{
+		fprintf(stderr, "Failed to create surfaceless EGL context\n");
+		eglTerminate(context.display);
+		return false;
+	}
+
+	// glewInit would query the window system; only the context is needed here
+	glewExperimental = GL_TRUE;
+	if (glewContextInit() != GLEW_OK)
+	{
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		eglTerminate(context.display);
+		return false;
+	}
+#else
+	if (!glfwInit())
+	{
+		fprintf(stderr, "Failed to initialize GLFW\n");
+		return false;
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_SAMPLES, 0);	// Multisampling is done by the render target
+
+	// The default framebuffer is never drawn to
+	context.window = glfwCreateWindow(1, 1, "", nullptr, nullptr);
+	if (context.window == nullptr)
+	{
+		fprintf(stderr, "Failed to create hidden GLFW window\n");
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(context.window);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		glfwTerminate();
+		return false;
+	}
+#endif
+
+	// Configure OpenGL
+	StateCache::get().invalidate();
+	StateCache::get().setEnabled(GL_DEPTH_TEST, true);
+
+	if (!RendCreateTarget(target, width, height, samples))
+	{
+		RendTerminateHeadless(context, target);
+		return false;
+	}
+	return true;
+}
+
+// Delete the render target and shared geometry, then destroy the headless context
+void RendTerminateHeadless(RendHeadlessContext& context, RendTarget& target)
+{
+	GeometryPool::get().release();
+	RendDeleteTarget(target);
+
+#ifdef RENDER_USE_EGL
+	if (context.display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent(context.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context.context != EGL_NO_CONTEXT)
+			eglDestroyContext(context.display, context.context);
+		eglTerminate(context.display);
+	}
+	context.display = EGL_NO_DISPLAY;
+	context.context = EGL_NO_CONTEXT;
+#else
+	if (context.window)
+	{
+		glfwDestroyWindow(context.window);
+		glfwTerminate();
+	}
+	context.window = nullptr;
+#endif
+}
+
+// Set sampler parameters of the currently bound 2D texture
+void RendSetTextureParams(const TextureOptions& options)
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrap_s);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrap_t);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.min_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.mag_filter);
+}
+
+// Estimate GPU memory of a 2D texture
+// Return: bytes, including mip chain if enabled
+size_t RendTextureBytes(unsigned int width, unsigned int height, unsigned int bytes_per_texel, bool mipmap)
+{
+	size_t bytes = size_t(width) * height * bytes_per_texel;
+	if (mipmap)
+		bytes += bytes / 3;		// Full mip chain adds ~1/3
+
+	return bytes;
+}
+
+// Check if the context can sample a compressed internal format
+bool RendIsCompressedFormatSupported(GLenum format)
+{
+	static std::vector<GLint> formats;
+	static bool queried = false;
+
+	if (!queried)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+		formats.resize(count);
+		if (count > 0)
+			glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]);
+		queried = true;
+	}
+
+	for (GLint f : formats)
+	{
+		if (GLenum(f) == format)
+			return true;
+	}
+
+	// Some core profile drivers support S3TC without listing it
+	if (format >= GL_COMPRESSED_RGB_S3TC_DXT1_EXT && format <= GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		return GLEW_EXT_texture_compression_s3tc;
+
+	return false;
+}
+
+// Upload KTX file contents (full mip chain) to the currently bound 2D texture
+// Return: true on success, false if invalid or the format is not supported
+bool RendTexImageKTX(const unsigned char* data, size_t size, const TextureOptions& options, TextureInfo* info = nullptr)
+{
+	KTXHeader header;
+	std::vector<KTXLevel> levels;
+
+	if (!KTXParse(data, size, header, levels))
+		return false;
+
+	bool compressed = header.gl_type == 0;
+	if (compressed && !RendIsCompressedFormatSupported(header.gl_internal_format))
+		return false;
+
+	size_t bytes = 0;
+	for (GLint i = 0; i < GLint(levels.size()); i++)
+	{
+		const KTXLevel& level = levels[i];
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, header.gl_internal_format, level.width, level.height, 0,
+				level.size, level.data);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, header.gl_internal_format, level.width, level.height, 0,
+				header.gl_format, header.gl_type, level.data);
+		bytes += level.size;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	if (header.num_mip_levels == 0 && options.mipmap && !compressed)
+		glGenerateMipmap(GL_TEXTURE_2D);
+	else
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size()) - 1);
+	RendSetTextureParams(options);
+
+	if (info)
+	{
+		info->width = header.pixel_width;
+		info->height = header.pixel_height;
+		info->internal_format = header.gl_internal_format;
+		info->bytes = bytes;
+		info->bytes_rgba8 = RendTextureBytes(header.pixel_width, header.pixel_height, 4, levels.size() > 1 ||
+			(options.mipmap && !compressed));
+	}
+
+	return true;
+}
+
+// Load pre-compressed, pre-mipmapped KTX texture
+// Return: Texture ID created (0 if missing, invalid or unsupported)
+GLuint RendLoadTextureKTX(const char* path, const TextureOptions& options = TextureOptions(), TextureInfo* info = nullptr)
+{
+	std::vector<unsigned char> file;
+	GLuint tex_id;
+
+	if (lodepng::load_file(file, path) != 0 || file.empty())
+		return 0;
+
+	glGenTextures(1, &tex_id);
+	StateCache::get().bindTexture(GL_TEXTURE_2D, tex_id);
+	bool loaded = RendTexImageKTX(file.data(), file.size(), options, info);
+	StateCache::get().bindTexture(GL_TEXTURE_2D, 0);
+
+	if (!loaded)
+	{
+		StateCache::get().deleteTexture(tex_id);
+		return 0;
+	}
+
+	return tex_id;
+}
+
+// Repack decoded RGBA8 image into the smallest format that keeps its content
+// Grayscale -> GL_R8 / GL_RG8 (with alpha), opaque color -> GL_RGB8, otherwise GL_RGBA8.
+// Swizzles expand the stored channels back to RGBA so shader sampling is unchanged.
+// (sRGB formats are not chosen since they would change sampled values.)
+void RendPackTextureImage(TextureImage& image)
+{
+	std::vector<unsigned char>& px = image.pixels;
+	size_t num_texels = size_t(image.width) * image.height;
+	bool gray = true;
+	bool opaque = true;
+
+	for (size_t i = 0; i < num_texels && (gray || opaque); i++)
+	{
+		const unsigned char* p = &px[i * 4];
+		gray = gray && p[0] == p[1] && p[0] == p[2];
+		opaque = opaque && p[3] == 255;
+	}
+
+	if (gray && opaque)
+	{
+		for (size_t i = 0; i < num_texels; i++)
+			px[i] = px[i * 4];
+		image.channels = 1;
+		image.internal_format = GL_R8;
+		image.format = GL_RED;
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		std::copy(swizzle, swizzle + 4, image.swizzle);
+	}
+	else if (gray)
+	{
+		for (size_t i = 0; i < num_texels; i++)
+		{
+			px[i * 2] = px[i * 4];
+			px[i * 2 + 1] = px[i * 4 + 3];
+		}
+		image.channels = 2;
+		image.internal_format = GL_RG8;
+		image.format = GL_RG;
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+		std::copy(swizzle, swizzle + 4, image.swizzle);
+	}
+	else if (opaque)
+	{
+		for (size_t i = 0; i < num_texels; i++)
+		{
+			px[i * 3] = px[i * 4];
+			px[i * 3 + 1] = px[i * 4 + 1];
+			px[i * 3 + 2] = px[i * 4 + 2];
+		}
+		image.channels = 3;
+		image.internal_format = GL_RGB8;
+		image.format = GL_RGB;
+		GLint swizzle[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ONE };
+		std::copy(swizzle, swizzle + 4, image.swizzle);
+	}
+
+	px.resize(num_texels * image.channels);
+}
+
+// Decode image file to RGBA8 and optionally repack (safe off the GL thread)
+// Return: lodepng error code (0 on success)
+unsigned int RendDecodeTextureImage(const char* path, TextureImage& image, bool compact_format)
+{
+	unsigned int error = lodepng::decode(image.pixels, image.width, image.height, path);
+	if (error == 0 && compact_format)
+		RendPackTextureImage(image);
+
+	return error;
+}
+
+// Specify level 0 of the currently bound 2D texture from a decoded image
+// pixels = image.pixels data, or an offset into the bound pixel unpack buffer
+void RendTexImage(const TextureImage& image, const GLvoid* pixels, const TextureOptions& options, TextureInfo* info)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);	// Rows of 1-3 channel images are not 4-byte aligned
+	glTexImage2D(GL_TEXTURE_2D, 0, image.internal_format, image.width, image.height, 0, image.format,
+		GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, image.swizzle);
+	if (options.mipmap)
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+	if (info)
+	{
+		info->width = image.width;
+		info->height = image.height;
+		info->internal_format = image.internal_format;
+		info->bytes = RendTextureBytes(image.width, image.height, image.channels, options.mipmap);
+		info->bytes_rgba8 = RendTextureBytes(image.width, image.height, 4, options.mipmap);
+	}
+}
+
 // Load Texture
+// Uses the compressed <name>.ktx version when present, not older than the image and supported, otherwise decodes the image
+// options = sampler and mipmap settings
+// info = optional output description of the created texture
 // Return: Texture ID created
-GLuint RendLoadTexture(const char* path)
+GLuint RendLoadTexture(const char* path, const TextureOptions& options = TextureOptions(), TextureInfo* info = nullptr)
 {
 	GLuint tex_id;
-	unsigned int width, height;
-	std::vector<unsigned char> image;
+	TextureImage image;
 	unsigned int error;
 
+	if (options.prefer_compressed && KTXIsCurrent(path))
+	{
+		tex_id = RendLoadTextureKTX(KTXGetPath(path).c_str(), options, info);
+		if (tex_id != 0)
+			return tex_id;
+	}
+
 	// Load Image
-	error = lodepng::decode(image, width, height, path);
-	//if (image)
+	error = RendDecodeTextureImage(path, image, options.compact_format);
 	if (error == 0)
 	{
 		// Generate and Bind OpenGL Texture
 		glGenTextures(1, &tex_id);
-		glBindTexture(GL_TEXTURE_2D, tex_id);
+		StateCache::get().bindTexture(GL_TEXTURE_2D, tex_id);
 
-		// TODO: Add arguments to this function if needed to define below parameters
-		// lodepng appears to always produce a 4-byte RGBA output?
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image[0]);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		RendTexImage(image, image.pixels.data(), options, info);
 
 		// Parameters
-		// TODO: Are these always applicable?
 		// TODO: Check if texture is square and disable MIPMAP if not (also anything else to consider?)
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		RendSetTextureParams(options);
 
 		// Cleanup
 		//SOIL_free_image_data(image);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		StateCache::get().bindTexture(GL_TEXTURE_2D, 0);
 
 		return tex_id;
 	}
@@ -10,6 +10,14 @@
 #define GL_SHADER_HPP_
 
 #include <iostream>
+#include <cstdio>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 #include "GL\glew.h"
 
@@ -17,6 +25,445 @@
 #define GLFW_INCLUDE_GLU
 #include "GLFW\glfw3.h"
 
+#include "file_help.hpp"
+
+#include "gl_cache.hpp"
+#include "gl_state.hpp"
+
+#define SHADER_MAX_MATERIAL_TEXTURES 8	// Per type (material.texture_diffuse[1..N], material.texture_specular[1..N])
+
+// Uniform block bindings, assigned by name when a program is reflected (GLSL 3.30 has no layout(binding))
+#define SHADER_FRAME_BINDING 0			// "FrameData": camera and lights, updated once per frame
+#define SHADER_MATERIAL_BINDING 1		// "MaterialData": per-material constants
+#define SHADER_FRAME_BLOCK "FrameData"
+#define SHADER_MATERIAL_BLOCK "MaterialData"
+
+// SHADER LOCATIONS
+// Uniform locations used by the model / mesh draw path (-1: not used by the program)
+struct ShaderLocations
+{
+	GLint model;
+	GLint mesh_dequant;
+	GLint num_tex_diffuse;
+	GLint num_tex_specular;
+	GLint indirect_draw_base;
+	GLint tex_diffuse[SHADER_MAX_MATERIAL_TEXTURES];
+	GLint tex_specular[SHADER_MAX_MATERIAL_TEXTURES];
+};
+
+// Query draw path uniform locations of a linked program
+void ShaderResolveLocations(GLuint program, ShaderLocations& loc)
+{
+	char name[64];
+
+	loc.model = glGetUniformLocation(program, "model");
+	loc.mesh_dequant = glGetUniformLocation(program, "mesh_dequant");
+	loc.num_tex_diffuse = glGetUniformLocation(program, "material.num_tex_diffuse");
+	loc.num_tex_specular = glGetUniformLocation(program, "material.num_tex_specular");
+	loc.indirect_draw_base = glGetUniformLocation(program, "indirect_draw_base");
+
+	// Texture numbers start at 1 (the N in texture_diffuse[N])
+	for (int i = 0; i < SHADER_MAX_MATERIAL_TEXTURES; i++)
+	{
+		snprintf(name, sizeof(name), "material.texture_diffuse[%d]", i + 1);
+		loc.tex_diffuse[i] = glGetUniformLocation(program, name);
+		snprintf(name, sizeof(name), "material.texture_specular[%d]", i + 1);
+		loc.tex_specular[i] = glGetUniformLocation(program, name);
+	}
+}
+
+// SHADER UNIFORM INFO
+// Active uniform of a linked program (array uniforms are listed once, as name[0])
+struct ShaderUniformInfo
+{
+	std::string name;
+	GLenum type;
+	GLint size;				// Array length (1 for non-arrays)
+	GLint location;			// -1 for block members
+	GLint block;			// Uniform block index (-1: default block)
+	GLint offset;			// Byte offset within the block
+	GLint array_stride;
+	GLint matrix_stride;
+};
+
+// SHADER BLOCK INFO
+// Active uniform block of a linked program
+struct ShaderBlockInfo
+{
+	std::string name;
+	GLuint index;
+	GLint data_size;		// Bytes required by the block (std140 size for std140 blocks)
+	GLint binding;			// Binding point (-1: not one of the shared blocks)
+};
+
+// SHADER REFLECTION
+struct ShaderReflection
+{
+	std::vector<ShaderUniformInfo> uniforms;
+	std::vector<ShaderBlockInfo> blocks;
+
+	const ShaderUniformInfo* findUniform(const std::string& name) const;
+	const ShaderBlockInfo* findBlock(const std::string& name) const;
+};
+
+// Return: uniform with the given name (arrays also match without [0]), nullptr if not active
+const ShaderUniformInfo* ShaderReflection::findUniform(const std::string& name) const
+{
+	for (const ShaderUniformInfo& u : this->uniforms)
+	{
+		if (u.name == name || (u.size > 1 && u.name.size() == name.size() + 3 && u.name.compare(0, name.size(), name) == 0))
+			return &u;
+	}
+	return nullptr;
+}
+
+// Return: uniform block with the given name, nullptr if not active
+const ShaderBlockInfo* ShaderReflection::findBlock(const std::string& name) const
+{
+	for (const ShaderBlockInfo& b : this->blocks)
+	{
+		if (b.name == name)
+			return &b;
+	}
+	return nullptr;
+}
+
+// Query active uniforms and uniform blocks of a linked program
+// The shared blocks (SHADER_FRAME_BLOCK, SHADER_MATERIAL_BLOCK) are assigned their binding points
+void ShaderReflect(GLuint program, ShaderReflection& out)
+{
+	out.uniforms.clear();
+	out.blocks.clear();
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+	std::vector<GLchar> name(size_t(std::max(max_length, 1)));
+	for (GLint i = 0; i < count; i++)
+	{
+		ShaderBlockInfo block;
+		block.index = GLuint(i);
+		glGetActiveUniformBlockName(program, block.index, GLsizei(name.size()), nullptr, name.data());
+		block.name = name.data();
+		glGetActiveUniformBlockiv(program, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.data_size);
+
+		block.binding = -1;
+		if (block.name == SHADER_FRAME_BLOCK)
+			block.binding = SHADER_FRAME_BINDING;
+		else if (block.name == SHADER_MATERIAL_BLOCK)
+			block.binding = SHADER_MATERIAL_BINDING;
+		if (block.binding >= 0)
+			glUniformBlockBinding(program, block.index, GLuint(block.binding));
+
+		out.blocks.push_back(block);
+	}
+
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	if (count <= 0)
+		return;
+	name.resize(size_t(std::max(max_length, 1)));
+
+	// Block layout of all uniforms in one query per property
+	size_t num_uniforms = size_t(count);
+	std::vector<GLuint> indices(num_uniforms);
+	for (GLint i = 0; i < count; i++)
+		indices[i] = GLuint(i);
+	std::vector<GLint> block(num_uniforms), offset(num_uniforms), array_stride(num_uniforms), matrix_stride(num_uniforms);
+	glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_BLOCK_INDEX, block.data());
+	glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_OFFSET, offset.data());
+	glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_ARRAY_STRIDE, array_stride.data());
+	glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_MATRIX_STRIDE, matrix_stride.data());
+
+	out.uniforms.resize(num_uniforms);
+	for (GLint i = 0; i < count; i++)
+	{
+		ShaderUniformInfo& u = out.uniforms[i];
+		glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), nullptr, &u.size, &u.type, name.data());
+		u.name = name.data();
+		u.block = block[i];
+		u.offset = offset[i];
+		u.array_stride = array_stride[i];
+		u.matrix_stride = matrix_stride[i];
+		u.location = u.block < 0 ? glGetUniformLocation(program, name.data()) : -1;
+	}
+}
+
+// SHADER LOCATION CACHE
+// Per-program uniform locations and reflection, resolved on first use (draws then only use integer locations)
+// Call reflect() after linking and invalidate() after deleting a program.
+class ShaderLocationCache
+{
+private:
+	struct Program
+	{
+		ShaderLocations locations;
+		ShaderReflection reflection;
+	};
+	std::unordered_map<GLuint, Program> programs;
+	GLuint last_program = 0;					// Consecutive draws with the same program skip the lookup
+	const ShaderLocations* last = nullptr;
+
+	ShaderLocationCache() {}
+	Program& find(GLuint program);
+public:
+	static ShaderLocationCache& get()
+	{
+		static ShaderLocationCache instance;
+		return instance;
+	}
+
+	const ShaderLocations& getLocations(GLuint program);
+	const ShaderReflection& getReflection(GLuint program) { return find(program).reflection; }
+	void reflect(GLuint program);
+	void invalidate(GLuint program);
+};
+
+// Return: cache entry of a program (resolved once)
+ShaderLocationCache::Program& ShaderLocationCache::find(GLuint program)
+{
+	auto it = this->programs.find(program);
+	if (it == this->programs.end())
+	{
+		it = this->programs.emplace(program, Program()).first;
+		ShaderResolveLocations(program, it->second.locations);
+		ShaderReflect(program, it->second.reflection);
+	}
+	return it->second;
+}
+
+// Get uniform locations of a program (resolved once)
+const ShaderLocations& ShaderLocationCache::getLocations(GLuint program)
+{
+	if (this->last && this->last_program == program)
+		return *this->last;
+
+	// Map nodes are stable, so the pointer survives later insertions
+	this->last_program = program;
+	this->last = &this->find(program).locations;
+	return *this->last;
+}
+
+// Resolve a newly linked program (replaces entries of a previous program with the same name)
+void ShaderLocationCache::reflect(GLuint program)
+{
+	this->invalidate(program);
+	this->find(program);
+}
+
+// Drop cached locations of a program
+void ShaderLocationCache::invalidate(GLuint program)
+{
+	if (this->last_program == program)
+		this->last = nullptr;
+	this->programs.erase(program);
+}
+
+// Delete a program through the state cache (clears it as the bound program) and drop its cached locations
+void DeleteShaderProgram(GLuint program)
+{
+	ShaderLocationCache::get().invalidate(program);
+	StateCache::get().deleteProgram(program);
+}
+
+// Program binary cache file layout (native endianness):
+//   ShaderCacheHeader
+//   program binary (binary_size bytes, in the driver's binary_format)
+// Keyed by the stage sources and the driver strings: a driver update changes the key, so stale entries are never loaded.
+
+#define SHADER_CACHE_MAGIC 0x43504C47		// "GLPC"
+#define SHADER_CACHE_VERSION 1
+
+struct ShaderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t binary_format;
+	uint32_t binary_size;
+	uint64_t key;				// Full key (file names only hold the key, collisions are rejected)
+	uint64_t binary_hash;		// Detects truncated / corrupt files
+};
+
+// SHADER PROGRAM STATS
+// Build report of one program
+struct ShaderProgramStats
+{
+	std::string name;			// Source paths (MakeShaderProgram) or the name passed to BuildShaderProgram
+	GLuint program = 0;
+	bool cache_hit = false;		// Loaded from a program binary
+	double compile_ms = 0;		// Both stages (0 on a cache hit)
+	double link_ms = 0;			// Link, or binary load on a cache hit
+};
+
+// SHADER PROGRAM CACHE
+// On-disk program binaries (GL 4.1 / ARB_get_program_binary), used by BuildShaderProgram when a directory is set.
+// Entries that fail to load (corrupt file, driver rejects the binary) are deleted and the program is built from source.
+class ShaderProgramCache
+{
+private:
+	std::string directory;			// Empty: disabled
+	int supported = -1;				// Binary support of the current context (-1: not queried)
+	uint64_t driver_hash = 0;		// Vendor / renderer / version strings
+	std::vector<ShaderProgramStats> stats;
+
+	ShaderProgramCache() {}
+	std::string getPath(uint64_t key) const;
+public:
+	static ShaderProgramCache& get()
+	{
+		static ShaderProgramCache instance;
+		return instance;
+	}
+
+	void setDirectory(const std::string& dir) { directory = dir; }
+	const std::string& getDirectory() const { return directory; }
+	bool isEnabled();
+
+	uint64_t makeKey(const GLchar* vshd_src, const GLchar* fshd_src);
+	GLuint load(uint64_t key);
+	bool store(uint64_t key, GLuint program);
+
+	void addStats(const ShaderProgramStats& program_stats) { stats.push_back(program_stats); }
+	const std::vector<ShaderProgramStats>& getStats() const { return stats; }
+	void printStats() const;
+};
+
+// Return: true if a directory is set and the context can load / save program binaries (needs a current context)
+bool ShaderProgramCache::isEnabled()
+{
+	if (this->directory.empty())
+		return false;
+
+	if (this->supported < 0)
+	{
+		GLint num_formats = 0;
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		this->supported = num_formats > 0;
+
+		// Driver strings are part of every key
+		const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		this->driver_hash = CACHE_HASH_SEED;
+		for (GLenum name : names)
+		{
+			const char* str = reinterpret_cast<const char*>(glGetString(name));
+			if (str)
+				this->driver_hash = CacheHash(str, std::strlen(str) + 1, this->driver_hash);
+		}
+	}
+
+	return this->supported > 0;
+}
+
+// Return: cache key of a program (sources + driver)
+uint64_t ShaderProgramCache::makeKey(const GLchar* vshd_src, const GLchar* fshd_src)
+{
+	uint64_t key = CacheHash(vshd_src, std::strlen(vshd_src) + 1, this->driver_hash);
+	return CacheHash(fshd_src, std::strlen(fshd_src) + 1, key);
+}
+
+// Return: cache file path of a key
+std::string ShaderProgramCache::getPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.pbin", (unsigned long long)key);
+
+	return this->directory + '/' + name;
+}
+
+// Create a program from a cached binary
+// Return: linked program ID, 0 on a miss (invalid entries are removed)
+GLuint ShaderProgramCache::load(uint64_t key)
+{
+	std::string path = this->getPath(key);
+	GLuint program = 0;
+	{
+		MappedFile file;
+		if (!file.open(path))
+			return 0;
+
+		ShaderCacheHeader header;
+		bool valid = file.size() >= sizeof(header);
+		if (valid)
+		{
+			std::memcpy(&header, file.data(), sizeof(header));
+			const unsigned char* binary = file.data() + sizeof(header);
+			valid = header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION && header.key == key &&
+				header.binary_size == file.size() - sizeof(header) &&
+				CacheHash(binary, header.binary_size) == header.binary_hash;
+		}
+
+		if (valid)
+		{
+			program = glCreateProgram();
+			glProgramBinary(program, header.binary_format, file.data() + sizeof(header), GLsizei(header.binary_size));
+
+			GLint status = GL_FALSE;
+			glGetProgramiv(program, GL_LINK_STATUS, &status);
+			if (status != GL_TRUE)
+			{
+				DeleteShaderProgram(program);
+				program = 0;
+			}
+		}
+	}
+
+	if (!program)
+	{
+		fprintf(stderr, "Discarding stale shader cache entry %s\n", path.c_str());
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+	return program;
+}
+
+// Save the binary of a linked program (program must be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT)
+// Return: true on success
+bool ShaderProgramCache::store(uint64_t key, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+
+	std::vector<unsigned char> data(sizeof(ShaderCacheHeader) + size_t(length));
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &format, data.data() + sizeof(ShaderCacheHeader));
+	if (written <= 0)
+		return false;
+	data.resize(sizeof(ShaderCacheHeader) + size_t(written));
+
+	ShaderCacheHeader header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.binary_format = format;
+	header.binary_size = uint32_t(written);
+	header.key = key;
+	header.binary_hash = CacheHash(data.data() + sizeof(header), size_t(written));
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	std::error_code ec;
+	std::filesystem::create_directories(this->directory, ec);
+	return CacheWriteFile(this->getPath(key), data.data(), data.size());
+}
+
+// Print per-program build report
+void ShaderProgramCache::printStats() const
+{
+	for (const ShaderProgramStats& s : this->stats)
+	{
+		printf("Shader program %u (%s): %s, compile %.2f ms, %s %.2f ms\n", s.program, s.name.c_str(),
+			s.cache_hit ? "cache hit" : "cache miss", s.compile_ms, s.cache_hit ? "load" : "link", s.link_ms);
+	}
+}
+
+// Return: elapsed milliseconds since start
+double ShaderElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 // Check shader compile
 bool CheckShaderCompile(GLuint shader)
 {
@@ -53,10 +500,10 @@ bool CheckShaderProgram(GLuint program)
 	}
 }
 
-// User Shader Program
+// User Shader Program (skipped if already current)
 void UseShaderProgram(GLuint shader_prog_id)
 {
-	glUseProgram(shader_prog_id);
+	StateCache::get().useProgram(shader_prog_id);
 
 	//// Specify the layout of the vertex data
 	//GLint posAttrib = glGetAttribLocation(shader_prog_id, "pos");
@@ -75,12 +522,39 @@ void UseShaderProgram(GLuint shader_prog_id)
 }
 
 // Build Shader Program from vertex shader and fragment shader source
+// Loads the program binary instead when ShaderProgramCache has a matching entry
+// name = label for the build report (ShaderProgramCache::getStats)
 // Return: Shader Program ID created
-GLuint BuildShaderProgram(const GLchar* vshd_src, const GLchar* fshd_src)
+GLuint BuildShaderProgram(const GLchar* vshd_src, const GLchar* fshd_src, const char* name = "")
 {
 	GLuint vshd_id, fshd_id;
 	GLuint shader_prog_id = 0;
 
+	ShaderProgramCache& cache = ShaderProgramCache::get();
+	ShaderProgramStats stats;
+	stats.name = name;
+
+	// Cached Binary
+	// **************
+	bool use_cache = cache.isEnabled();
+	uint64_t key = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (use_cache)
+	{
+		key = cache.makeKey(vshd_src, fshd_src);
+		shader_prog_id = cache.load(key);
+		if (shader_prog_id)
+		{
+			ShaderLocationCache::get().reflect(shader_prog_id);
+			stats.program = shader_prog_id;
+			stats.cache_hit = true;
+			stats.link_ms = ShaderElapsedMs(start);
+			cache.addStats(stats);
+			return shader_prog_id;
+		}
+		start = std::chrono::steady_clock::now();
+	}
+
 	// Compile Vertex Shader
 	// **************
 	vshd_id = glCreateShader(GL_VERTEX_SHADER);
@@ -97,20 +571,31 @@ GLuint BuildShaderProgram(const GLchar* vshd_src, const GLchar* fshd_src)
 	glCompileShader(fshd_id);
 	if (!CheckShaderCompile(fshd_id))
 		return 0;
+	stats.compile_ms = ShaderElapsedMs(start);
 
 
 	// Link Shader
 	// **************
+	start = std::chrono::steady_clock::now();
 	shader_prog_id = glCreateProgram();
 	glAttachShader(shader_prog_id, vshd_id);
 	glAttachShader(shader_prog_id, fshd_id);
+	if (use_cache)
+		glProgramParameteri(shader_prog_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(shader_prog_id);
 	if (!CheckShaderProgram(shader_prog_id))
 		return 0;
+	ShaderLocationCache::get().reflect(shader_prog_id);	// Program name may be reused
+	stats.link_ms = ShaderElapsedMs(start);
 
 	glDeleteShader(vshd_id);
 	glDeleteShader(fshd_id);
 
+	if (use_cache && !cache.store(key, shader_prog_id))
+		fprintf(stderr, "Could not write shader cache entry for program %u\n", shader_prog_id);
+
+	stats.program = shader_prog_id;
+	cache.addStats(stats);
 	return shader_prog_id;
 }
 
@@ -137,11 +622,209 @@ GLuint MakeShaderProgram(const char* vshd_path, const char* fshd_path)
 	}
 
 	// Build Shader program
-	shader_prog_id = BuildShaderProgram(vshd_src, fshd_src);
+	std::string name = std::string(vshd_path) + " + " + fshd_path;
+	shader_prog_id = BuildShaderProgram(vshd_src, fshd_src, name.c_str());
 	if (!shader_prog_id)
 		return 0;
 
 	return shader_prog_id;
 }
 
+// Return: true if the driver compiles and links in the background (GL_COMPLETION_STATUS_KHR can be polled)
+bool ShaderParallelCompileSupported()
+{
+	return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+enum ShaderBuildState
+{
+	SHADER_BUILD_PENDING,
+	SHADER_BUILD_READY,
+	SHADER_BUILD_FAILED
+};
+
+// SHADER BATCH
+// Submits many programs up front and lets the driver compile / link them in parallel (KHR_parallel_shader_compile).
+// Status is only queried once GL_COMPLETION_STATUS_KHR reports completion, so poll() never stalls; call it once per
+// frame and use each program as soon as getProgram() returns non-zero. Without the extension, poll() finishes one
+// program per call (blocking), spreading the cost over frames.
+// Ready programs belong to the caller; programs still pending when the batch is destroyed are deleted.
+class ShaderBatch
+{
+private:
+	struct Entry
+	{
+		GLuint vshd = 0, fshd = 0;
+		GLuint program = 0;
+		uint64_t key = 0;			// Cache key (cache enabled)
+		ShaderBuildState state = SHADER_BUILD_PENDING;
+		std::chrono::steady_clock::time_point start;
+		ShaderProgramStats stats;
+	};
+	std::vector<Entry> entries;
+	size_t num_pending = 0;
+	bool parallel = false;
+
+	void complete(Entry& entry);
+public:
+	ShaderBatch();
+	ShaderBatch(const ShaderBatch&) = delete;
+	ShaderBatch& operator=(const ShaderBatch&) = delete;
+	~ShaderBatch();
+
+	size_t add(const GLchar* vshd_src, const GLchar* fshd_src, const char* name = "");
+	size_t poll();
+	bool finish();
+
+	ShaderBuildState getState(size_t handle) const { return entries[handle].state; }
+	GLuint getProgram(size_t handle) const { return entries[handle].state == SHADER_BUILD_READY ? entries[handle].program : 0; }
+	size_t numPending() const { return num_pending; }
+	size_t size() const { return entries.size(); }
+};
+
+// Constructor (needs a current context; lets the driver use all its compiler threads)
+ShaderBatch::ShaderBatch()
+{
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	this->parallel = ShaderParallelCompileSupported();
+}
+
+// Destructor (deletes unfinished programs)
+ShaderBatch::~ShaderBatch()
+{
+	for (Entry& entry : this->entries)
+	{
+		if (entry.state != SHADER_BUILD_PENDING)
+			continue;
+		glDeleteShader(entry.vshd);
+		glDeleteShader(entry.fshd);
+		DeleteShaderProgram(entry.program);
+	}
+}
+
+// Submit a program: compile and link are issued without waiting (cache hits are ready immediately)
+// name = label for the build report (ShaderProgramCache::getStats)
+// Return: handle for getState / getProgram
+size_t ShaderBatch::add(const GLchar* vshd_src, const GLchar* fshd_src, const char* name)
+{
+	ShaderProgramCache& cache = ShaderProgramCache::get();
+	this->entries.emplace_back();
+	Entry& entry = this->entries.back();
+	entry.stats.name = name;
+	entry.start = std::chrono::steady_clock::now();
+
+	if (cache.isEnabled())
+	{
+		entry.key = cache.makeKey(vshd_src, fshd_src);
+		entry.program = cache.load(entry.key);
+		if (entry.program)
+		{
+			ShaderLocationCache::get().reflect(entry.program);
+			entry.state = SHADER_BUILD_READY;
+			entry.stats.program = entry.program;
+			entry.stats.cache_hit = true;
+			entry.stats.link_ms = ShaderElapsedMs(entry.start);
+			cache.addStats(entry.stats);
+			return this->entries.size() - 1;
+		}
+	}
+
+	// Link right after compile: a failed stage only makes the link fail, logs are read when the program completes
+	entry.vshd = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(entry.vshd, 1, &vshd_src, NULL);
+	glCompileShader(entry.vshd);
+	entry.fshd = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(entry.fshd, 1, &fshd_src, NULL);
+	glCompileShader(entry.fshd);
+
+	entry.program = glCreateProgram();
+	glAttachShader(entry.program, entry.vshd);
+	glAttachShader(entry.program, entry.fshd);
+	if (cache.isEnabled())
+		glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(entry.program);
+
+	this->num_pending++;
+	return this->entries.size() - 1;
+}
+
+// Check link status of a finished program, report errors and save the binary
+void ShaderBatch::complete(Entry& entry)
+{
+	GLint status = GL_FALSE;
+	glGetProgramiv(entry.program, GL_LINK_STATUS, &status);
+	if (status == GL_TRUE)
+	{
+		ShaderLocationCache::get().reflect(entry.program);	// Program name may be reused
+		entry.state = SHADER_BUILD_READY;
+
+		// Compile and link overlap: compile_ms is the submit-to-ready latency
+		entry.stats.program = entry.program;
+		entry.stats.compile_ms = ShaderElapsedMs(entry.start);
+
+		ShaderProgramCache& cache = ShaderProgramCache::get();
+		if (cache.isEnabled() && !cache.store(entry.key, entry.program))
+			fprintf(stderr, "Could not write shader cache entry for program %u\n", entry.program);
+		cache.addStats(entry.stats);
+	}
+	else
+	{
+		std::cout << "Shader program " << entry.stats.name << " failed to build." << std::endl;
+		if (CheckShaderCompile(entry.vshd) && CheckShaderCompile(entry.fshd))
+			CheckShaderProgram(entry.program);
+		DeleteShaderProgram(entry.program);
+		entry.program = 0;
+		entry.state = SHADER_BUILD_FAILED;
+	}
+
+	glDeleteShader(entry.vshd);
+	glDeleteShader(entry.fshd);
+	entry.vshd = entry.fshd = 0;
+	this->num_pending--;
+}
+
+// Complete programs the driver has finished (call once per frame)
+// Return: number of programs still pending
+size_t ShaderBatch::poll()
+{
+	for (Entry& entry : this->entries)
+	{
+		if (entry.state != SHADER_BUILD_PENDING)
+			continue;
+
+		if (this->parallel)
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(entry.program, GL_COMPLETION_STATUS_KHR, &done);
+			if (done == GL_TRUE)
+				this->complete(entry);
+		}
+		else
+		{
+			this->complete(entry);
+			break;
+		}
+	}
+
+	return this->num_pending;
+}
+
+// Wait for all programs
+// Return: true if every program built
+bool ShaderBatch::finish()
+{
+	bool ok = true;
+	for (Entry& entry : this->entries)
+	{
+		if (entry.state == SHADER_BUILD_PENDING)
+			this->complete(entry);
+		ok = ok && entry.state == SHADER_BUILD_READY;
+	}
+
+	return ok;
+}
+
 #endif
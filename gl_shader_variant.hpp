@@ -0,0 +1,211 @@
+// *****************************************************************************************************************************
+// gl_shader_variant.hpp
+// OpenGL Rendering
+// Shader variants: #include resolution, #define injection and a cache of specialized programs
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_SHADER_VARIANT_HPP
+#define GL_SHADER_VARIANT_HPP
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "gl_shader.hpp"
+#include "gl_state.hpp"
+
+#define SHADER_MAX_INCLUDE_DEPTH 16
+
+// Preprocessor definitions of a variant (name, value; empty value: #define NAME)
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+// Return: directory part of a path, with trailing separator (empty for a bare file name)
+std::string ShaderDirectory(const std::string& path)
+{
+	size_t pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
+
+// Read a shader file and expand #include "file" directives (paths relative to the including file)
+// Each file is included at most once per expansion, so shared headers need no include guards.
+// Included text is wrapped in #line directives: GLSL source string N is included[N] (0: the top file), so compile
+// errors report the file and line they came from. #version must be in the top file.
+// out = expanded source (appended)
+// included = files already expanded (pass empty)
+// Return: true on success (errors are printed)
+bool ShaderPreprocess(const std::string& path, std::string& out, std::vector<std::string>& included, int depth = 0)
+{
+	if (depth > SHADER_MAX_INCLUDE_DEPTH)
+	{
+		std::cout << "Shader include depth exceeded at " << path << std::endl;
+		return false;
+	}
+	if (std::find(included.begin(), included.end(), path) != included.end())
+		return true;
+	const std::string index = std::to_string(included.size());
+	included.push_back(path);
+
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cout << "Could not load shader source at " << path << std::endl;
+		return false;
+	}
+
+	if (depth > 0)
+		out += "#line 1 " + index + '\n';
+
+	std::string line;
+	int line_num = 0;
+	while (std::getline(file, line))
+	{
+		line_num++;
+
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+		{
+			out += line;
+			out += '\n';
+			continue;
+		}
+
+		size_t open = line.find('"', start + 8);
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if (close == std::string::npos)
+		{
+			std::cout << path << "(" << line_num << "): malformed #include" << std::endl;
+			return false;
+		}
+
+		std::string include_path = ShaderDirectory(path) + line.substr(open + 1, close - open - 1);
+		if (!ShaderPreprocess(include_path, out, included, depth + 1))
+		{
+			std::cout << "  included from " << path << "(" << line_num << ")" << std::endl;
+			return false;
+		}
+		out += "#line " + std::to_string(line_num + 1) + ' ' + index + '\n';
+	}
+
+	return true;
+}
+
+// Insert #define lines after the #version directive (or at the start if there is none)
+// A #line directive after the defines keeps the line numbers of the top file.
+// Return: specialized source
+std::string ShaderInjectDefines(const std::string& source, const ShaderDefines& defines)
+{
+	if (defines.empty())
+		return source;
+
+	std::string block;
+	for (const auto& define : defines)
+	{
+		block += "#define " + define.first;
+		if (!define.second.empty())
+			block += ' ' + define.second;
+		block += '\n';
+	}
+
+	size_t version = source.find("#version");
+	if (version == std::string::npos)
+		return block + "#line 1 0\n" + source;
+
+	size_t line_end = source.find('\n', version);
+	if (line_end == std::string::npos)
+		return source + '\n' + block;
+	size_t next_line = std::count(source.begin(), source.begin() + line_end, '\n') + 2;
+	return source.substr(0, line_end + 1) + block + "#line " + std::to_string(next_line) + " 0\n" +
+		source.substr(line_end + 1);
+}
+
+// SHADER VARIANT CACHE
+// Programs built from a vertex / fragment file pair specialized by a define set. Each permutation is compiled
+// the first time it is requested (with the binary cache, see ShaderProgramCache) and reused afterwards.
+// Define order does not matter. Failed builds are remembered too (clear() retries them, e.g. after editing files).
+class ShaderVariantCache
+{
+private:
+	std::unordered_map<std::string, GLuint> variants;		// Program per permutation description (0: failed)
+	std::unordered_map<std::string, std::string> sources;	// Expanded source per file
+
+	ShaderVariantCache() {}
+	const std::string* getSource(const std::string& path);
+public:
+	static ShaderVariantCache& get()
+	{
+		static ShaderVariantCache instance;
+		return instance;
+	}
+
+	GLuint getProgram(const std::string& vshd_path, const std::string& fshd_path, ShaderDefines defines = ShaderDefines());
+	void clear();
+	size_t size() const { return variants.size(); }
+};
+
+// Return: expanded source of a file (read once), nullptr on error
+const std::string* ShaderVariantCache::getSource(const std::string& path)
+{
+	auto it = this->sources.find(path);
+	if (it != this->sources.end())
+		return &it->second;
+
+	std::string source;
+	std::vector<std::string> included;
+	if (!ShaderPreprocess(path, source, included))
+		return nullptr;
+	return &this->sources.emplace(path, std::move(source)).first->second;
+}
+
+// Get the program of a permutation (built on first request)
+// defines = variant definitions (e.g. { "HAS_SPECULAR", "" }, { "NUM_LIGHTS", "4" })
+// Return: program ID, 0 if the variant failed to build
+GLuint ShaderVariantCache::getProgram(const std::string& vshd_path, const std::string& fshd_path, ShaderDefines defines)
+{
+	std::sort(defines.begin(), defines.end());
+
+	std::string desc = vshd_path + " + " + fshd_path;
+	for (const auto& define : defines)
+		desc += define.second.empty() ? " " + define.first : " " + define.first + "=" + define.second;
+
+	auto it = this->variants.find(desc);
+	if (it != this->variants.end())
+		return it->second;
+
+	const std::string* vshd_src = this->getSource(vshd_path);
+	const std::string* fshd_src = this->getSource(fshd_path);
+	GLuint program = 0;
+	if (vshd_src && fshd_src)
+	{
+		std::string vshd = ShaderInjectDefines(*vshd_src, defines);
+		std::string fshd = ShaderInjectDefines(*fshd_src, defines);
+		program = BuildShaderProgram(vshd.c_str(), fshd.c_str(), desc.c_str());
+	}
+
+	this->variants.emplace(std::move(desc), program);
+	return program;
+}
+
+// Delete all variant programs and forget expanded sources
+void ShaderVariantCache::clear()
+{
+	for (auto& variant : this->variants)
+	{
+		if (variant.second)
+			DeleteShaderProgram(variant.second);
+	}
+	this->variants.clear();
+	this->sources.clear();
+}
+
+#endif
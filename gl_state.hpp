@@ -0,0 +1,448 @@
+// *****************************************************************************************************************************
+// gl_state.hpp
+// OpenGL Rendering
+// GL state cache: filters redundant binds, program switches and enable / blend / depth changes
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include <cstdint>
+#include <cstdio>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "gl_stats.hpp"
+
+#define STATE_MAX_TEXTURE_UNITS 32
+#define STATE_UNKNOWN 0xFFFFFFFFu		// Cached value not known (issue the next call)
+
+// Validation: define RENDER_VALIDATE_STATE to compare every elided call against glGet* (slow, debug only);
+// can also be toggled at run time with StateCache::setValidation()
+#ifdef RENDER_VALIDATE_STATE
+#define STATE_VALIDATE_DEFAULT true
+#else
+#define STATE_VALIDATE_DEFAULT false
+#endif
+
+// STATE CACHE
+// Shadow copy of the GL state set through it. All library code binds through the cache;
+// code calling GL directly must call invalidate() (or the matching delete*) afterwards.
+// GL_ELEMENT_ARRAY_BUFFER is VAO state and is always issued.
+class StateCache
+{
+private:
+	enum BufferTarget { BUF_ARRAY, BUF_COPY_READ, BUF_COPY_WRITE, BUF_DRAW_INDIRECT, BUF_SHADER_STORAGE, BUF_UNIFORM,
+		BUF_PIXEL_PACK, BUF_PIXEL_UNPACK, BUF_COUNT };
+	enum TextureTarget { TEX_2D, TEX_2D_ARRAY, TEX_CUBE_MAP, TEX_COUNT };
+	enum Capability { CAP_DEPTH_TEST, CAP_BLEND, CAP_CULL_FACE, CAP_SCISSOR_TEST, CAP_STENCIL_TEST,
+		CAP_POLYGON_OFFSET_FILL, CAP_MULTISAMPLE, CAP_FRAMEBUFFER_SRGB, CAP_COUNT };
+
+	GLuint program;
+	GLuint vao;
+	GLuint buffers[BUF_COUNT];
+	GLuint active_unit;
+	GLuint textures[STATE_MAX_TEXTURE_UNITS][TEX_COUNT];
+	GLuint caps[CAP_COUNT];				// 0 / 1 / STATE_UNKNOWN
+	GLenum blend_src, blend_dst;
+	GLenum depth_func;
+	GLuint depth_mask;
+	bool validate_state = STATE_VALIDATE_DEFAULT;
+
+	StateCache() { invalidate(); }
+
+	static int bufferIndex(GLenum target);
+	static GLenum bufferBinding(int index);
+	static int textureIndex(GLenum target);
+	static GLenum textureBinding(int index);
+	static int capIndex(GLenum cap);
+
+	bool elide(bool cached_matches, GLenum pname, GLint expected, const char* what);
+	void issued() { FrameStats::get().counters().state_issued++; }
+public:
+	static StateCache& get()
+	{
+		static StateCache instance;
+		return instance;
+	}
+
+	void invalidate();
+	void setValidation(bool enable) { validate_state = enable; }
+	bool validate();
+
+	void useProgram(GLuint id);
+	void bindVertexArray(GLuint id);
+	void bindBuffer(GLenum target, GLuint id);
+	void bindBufferBase(GLenum target, GLuint index, GLuint id);
+	void bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size);
+	void activeTexture(GLuint unit);
+	void bindTexture(GLenum target, GLuint id);
+	void bindTextureUnit(GLuint unit, GLenum target, GLuint id);
+	void setEnabled(GLenum cap, bool enable);
+	void blendFunc(GLenum src, GLenum dst);
+	void depthFunc(GLenum func);
+	void depthMask(bool enable);
+
+	void deleteProgram(GLuint id);
+	void deleteVertexArray(GLuint id);
+	void deleteBuffer(GLuint id);
+	void deleteTexture(GLuint id);
+
+	GLuint getProgram() const { return program; }
+	GLuint getVertexArray() const { return vao; }
+};
+
+// Forget all cached state (next call of each kind is issued)
+void StateCache::invalidate()
+{
+	this->program = STATE_UNKNOWN;
+	this->vao = STATE_UNKNOWN;
+	for (GLuint& b : this->buffers)
+		b = STATE_UNKNOWN;
+	this->active_unit = STATE_UNKNOWN;
+	for (auto& unit : this->textures)
+	{
+		for (GLuint& t : unit)
+			t = STATE_UNKNOWN;
+	}
+	for (GLuint& c : this->caps)
+		c = STATE_UNKNOWN;
+	this->blend_src = this->blend_dst = STATE_UNKNOWN;
+	this->depth_func = STATE_UNKNOWN;
+	this->depth_mask = STATE_UNKNOWN;
+}
+
+int StateCache::bufferIndex(GLenum target)
+{
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: return BUF_ARRAY;
+	case GL_COPY_READ_BUFFER: return BUF_COPY_READ;
+	case GL_COPY_WRITE_BUFFER: return BUF_COPY_WRITE;
+	case GL_DRAW_INDIRECT_BUFFER: return BUF_DRAW_INDIRECT;
+	case GL_SHADER_STORAGE_BUFFER: return BUF_SHADER_STORAGE;
+	case GL_UNIFORM_BUFFER: return BUF_UNIFORM;
+	case GL_PIXEL_PACK_BUFFER: return BUF_PIXEL_PACK;
+	case GL_PIXEL_UNPACK_BUFFER: return BUF_PIXEL_UNPACK;
+	default: return -1;
+	}
+}
+
+GLenum StateCache::bufferBinding(int index)
+{
+	static const GLenum bindings[BUF_COUNT] = { GL_ARRAY_BUFFER_BINDING, GL_COPY_READ_BUFFER_BINDING,
+		GL_COPY_WRITE_BUFFER_BINDING, GL_DRAW_INDIRECT_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_BINDING,
+		GL_UNIFORM_BUFFER_BINDING, GL_PIXEL_PACK_BUFFER_BINDING, GL_PIXEL_UNPACK_BUFFER_BINDING };
+	return bindings[index];
+}
+
+int StateCache::textureIndex(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return TEX_2D;
+	case GL_TEXTURE_2D_ARRAY: return TEX_2D_ARRAY;
+	case GL_TEXTURE_CUBE_MAP: return TEX_CUBE_MAP;
+	default: return -1;
+	}
+}
+
+GLenum StateCache::textureBinding(int index)
+{
+	static const GLenum bindings[TEX_COUNT] = { GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_2D_ARRAY,
+		GL_TEXTURE_BINDING_CUBE_MAP };
+	return bindings[index];
+}
+
+int StateCache::capIndex(GLenum cap)
+{
+	switch (cap)
+	{
+	case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+	case GL_BLEND: return CAP_BLEND;
+	case GL_CULL_FACE: return CAP_CULL_FACE;
+	case GL_SCISSOR_TEST: return CAP_SCISSOR_TEST;
+	case GL_STENCIL_TEST: return CAP_STENCIL_TEST;
+	case GL_POLYGON_OFFSET_FILL: return CAP_POLYGON_OFFSET_FILL;
+	case GL_MULTISAMPLE: return CAP_MULTISAMPLE;
+	case GL_FRAMEBUFFER_SRGB: return CAP_FRAMEBUFFER_SRGB;
+	default: return -1;
+	}
+}
+
+// Decide whether a call can be skipped and count it
+// cached_matches = cache says the call would not change anything
+// pname, expected = glGet* query and value checked in validation mode (pname 0: not checked)
+// Return: true if the call should be skipped
+bool StateCache::elide(bool cached_matches, GLenum pname, GLint expected, const char* what)
+{
+	if (!cached_matches)
+	{
+		this->issued();
+		return false;
+	}
+
+	if (this->validate_state && pname)
+	{
+		GLint actual = 0;
+		glGetIntegerv(pname, &actual);
+		if (actual != expected)
+		{
+			fprintf(stderr, "StateCache: stale %s (cached %d, GL %d)\n", what, expected, actual);
+			this->issued();
+			return false;
+		}
+	}
+
+	FrameStats::get().counters().state_elided++;
+	return true;
+}
+
+// Compare all known cached state against glGet*
+// Return: true if the cache matches GL
+bool StateCache::validate()
+{
+	bool valid = true;
+	GLint value = 0;
+
+	auto check = [&](GLuint cached, GLenum pname, const char* what)
+	{
+		if (cached == STATE_UNKNOWN)
+			return;
+		glGetIntegerv(pname, &value);
+		if (GLuint(value) != cached)
+		{
+			fprintf(stderr, "StateCache: stale %s (cached %u, GL %d)\n", what, cached, value);
+			valid = false;
+		}
+	};
+
+	check(this->program, GL_CURRENT_PROGRAM, "program");
+	check(this->vao, GL_VERTEX_ARRAY_BINDING, "vertex array");
+	for (int i = 0; i < BUF_COUNT; i++)
+		check(this->buffers[i], bufferBinding(i), "buffer binding");
+	check(this->blend_src, GL_BLEND_SRC_RGB, "blend source");
+	check(this->blend_dst, GL_BLEND_DST_RGB, "blend destination");
+	check(this->depth_func, GL_DEPTH_FUNC, "depth function");
+	check(this->depth_mask, GL_DEPTH_WRITEMASK, "depth mask");
+
+	static const GLenum cap_names[CAP_COUNT] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+		GL_POLYGON_OFFSET_FILL, GL_MULTISAMPLE, GL_FRAMEBUFFER_SRGB };
+	for (int i = 0; i < CAP_COUNT; i++)
+	{
+		if (this->caps[i] != STATE_UNKNOWN && GLuint(glIsEnabled(cap_names[i])) != this->caps[i])
+		{
+			fprintf(stderr, "StateCache: stale capability 0x%04X (cached %u)\n", cap_names[i], this->caps[i]);
+			valid = false;
+		}
+	}
+
+	// Texture units (restores the active unit afterwards)
+	GLint active = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+	check(this->active_unit == STATE_UNKNOWN ? STATE_UNKNOWN : GL_TEXTURE0 + this->active_unit, GL_ACTIVE_TEXTURE,
+		"active texture unit");
+	for (GLuint unit = 0; unit < STATE_MAX_TEXTURE_UNITS; unit++)
+	{
+		bool known = false;
+		for (int t = 0; t < TEX_COUNT; t++)
+			known |= this->textures[unit][t] != STATE_UNKNOWN;
+		if (!known)
+			continue;
+
+		glActiveTexture(GL_TEXTURE0 + unit);
+		for (int t = 0; t < TEX_COUNT; t++)
+			check(this->textures[unit][t], textureBinding(t), "texture binding");
+	}
+	glActiveTexture(GLenum(active));
+
+	return valid;
+}
+
+void StateCache::useProgram(GLuint id)
+{
+	if (this->elide(this->program == id, GL_CURRENT_PROGRAM, GLint(id), "program"))
+		return;
+	glUseProgram(id);
+	this->program = id;
+}
+
+void StateCache::bindVertexArray(GLuint id)
+{
+	if (this->elide(this->vao == id, GL_VERTEX_ARRAY_BINDING, GLint(id), "vertex array"))
+		return;
+	glBindVertexArray(id);
+	this->vao = id;
+}
+
+void StateCache::bindBuffer(GLenum target, GLuint id)
+{
+	int index = bufferIndex(target);
+	if (index < 0)
+	{
+		this->issued();
+		glBindBuffer(target, id);
+		return;
+	}
+
+	if (this->elide(this->buffers[index] == id, bufferBinding(index), GLint(id), "buffer binding"))
+		return;
+	glBindBuffer(target, id);
+	this->buffers[index] = id;
+}
+
+// Indexed binding (always issued; also sets the generic binding of target)
+void StateCache::bindBufferBase(GLenum target, GLuint index, GLuint id)
+{
+	this->issued();
+	glBindBufferBase(target, index, id);
+
+	int b = bufferIndex(target);
+	if (b >= 0)
+		this->buffers[b] = id;
+}
+
+// Indexed binding of a buffer range (always issued; also sets the generic binding of target)
+void StateCache::bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size)
+{
+	this->issued();
+	glBindBufferRange(target, index, id, offset, size);
+
+	int b = bufferIndex(target);
+	if (b >= 0)
+		this->buffers[b] = id;
+}
+
+void StateCache::activeTexture(GLuint unit)
+{
+	if (this->elide(this->active_unit == unit, GL_ACTIVE_TEXTURE, GLint(GL_TEXTURE0 + unit), "active texture unit"))
+		return;
+	glActiveTexture(GL_TEXTURE0 + unit);
+	this->active_unit = unit;
+}
+
+// Bind texture on the active unit
+void StateCache::bindTexture(GLenum target, GLuint id)
+{
+	int t = textureIndex(target);
+	if (t < 0 || this->active_unit >= STATE_MAX_TEXTURE_UNITS)
+	{
+		this->issued();
+		glBindTexture(target, id);
+		if (t >= 0)
+		{
+			// Unit not known: forget this target on all units
+			for (auto& unit : this->textures)
+				unit[t] = STATE_UNKNOWN;
+		}
+		return;
+	}
+
+	GLuint& cached = this->textures[this->active_unit][t];
+	if (this->elide(cached == id, textureBinding(t), GLint(id), "texture binding"))
+		return;
+	glBindTexture(target, id);
+	cached = id;
+}
+
+// Bind texture on a unit (activates the unit only if the binding changes)
+void StateCache::bindTextureUnit(GLuint unit, GLenum target, GLuint id)
+{
+	int t = textureIndex(target);
+	if (t >= 0 && unit < STATE_MAX_TEXTURE_UNITS && this->textures[unit][t] == id && !this->validate_state)
+	{
+		FrameStats::get().counters().state_elided++;
+		return;
+	}
+
+	this->activeTexture(unit);
+	this->bindTexture(target, id);
+}
+
+void StateCache::setEnabled(GLenum cap, bool enable)
+{
+	int index = capIndex(cap);
+	if (index >= 0)
+	{
+		// glIsEnabled is not a glGetIntegerv query; checked by validate()
+		if (this->elide(this->caps[index] == GLuint(enable), 0, 0, "capability"))
+			return;
+		this->caps[index] = GLuint(enable);
+	}
+	else
+		this->issued();
+
+	if (enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void StateCache::blendFunc(GLenum src, GLenum dst)
+{
+	if (this->elide(this->blend_src == src && this->blend_dst == dst, GL_BLEND_SRC_RGB, GLint(src), "blend function"))
+		return;
+	glBlendFunc(src, dst);
+	this->blend_src = src;
+	this->blend_dst = dst;
+}
+
+void StateCache::depthFunc(GLenum func)
+{
+	if (this->elide(this->depth_func == func, GL_DEPTH_FUNC, GLint(func), "depth function"))
+		return;
+	glDepthFunc(func);
+	this->depth_func = func;
+}
+
+void StateCache::depthMask(bool enable)
+{
+	if (this->elide(this->depth_mask == GLuint(enable), GL_DEPTH_WRITEMASK, GLint(enable), "depth mask"))
+		return;
+	glDepthMask(enable ? GL_TRUE : GL_FALSE);
+	this->depth_mask = GLuint(enable);
+}
+
+// Delete objects (GL unbinds deleted objects; names may be reused, so cached bindings are reset)
+// A current program stays in use until replaced, so it becomes unknown rather than 0
+void StateCache::deleteProgram(GLuint id)
+{
+	glDeleteProgram(id);
+	if (this->program == id)
+		this->program = STATE_UNKNOWN;
+}
+
+void StateCache::deleteVertexArray(GLuint id)
+{
+	glDeleteVertexArrays(1, &id);
+	if (this->vao == id)
+		this->vao = 0;
+}
+
+void StateCache::deleteBuffer(GLuint id)
+{
+	glDeleteBuffers(1, &id);
+	for (GLuint& b : this->buffers)
+	{
+		if (b == id)
+			b = 0;
+	}
+}
+
+void StateCache::deleteTexture(GLuint id)
+{
+	glDeleteTextures(1, &id);
+	for (auto& unit : this->textures)
+	{
+		for (GLuint& t : unit)
+		{
+			if (t == id)
+				t = 0;
+		}
+	}
+}
+
+#endif
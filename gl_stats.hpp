@@ -0,0 +1,147 @@
+// *****************************************************************************************************************************
+// gl_stats.hpp
+// OpenGL Rendering
+// Per-frame render statistics (draw calls, heap allocations, CPU time)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_STATS_HPP
+#define GL_STATS_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+// Allocation counting: define RENDER_COUNT_ALLOCATIONS before including any library header to replace the global
+// operator new/delete with counting versions (like the rest of the library, this assumes a single translation unit)
+std::atomic<uint64_t> rend_allocation_count{ 0 };
+
+#ifdef RENDER_COUNT_ALLOCATIONS
+void* operator new(std::size_t size)
+{
+	rend_allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = std::malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	rend_allocation_count.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+#endif
+
+// FRAME STATS DATA
+struct RendFrameStats
+{
+	uint64_t frame = 0;
+	uint64_t allocations = 0;		// Global operator new calls (always 0 without RENDER_COUNT_ALLOCATIONS)
+	uint64_t draw_calls = 0;		// glDraw* calls issued by Mesh / Model
+	uint64_t instances = 0;			// Instances drawn by instanced draw calls
+	uint64_t visible = 0;			// Meshes passing frustum culling
+	uint64_t culled = 0;			// Meshes rejected by frustum culling
+	uint64_t state_issued = 0;		// GL state calls made through StateCache
+	uint64_t state_elided = 0;		// Redundant GL state calls skipped by StateCache
+	uint64_t indirect_draws = 0;	// Draw commands submitted through multi-draw indirect (each multi-draw is one draw call)
+	double cpu_ms = 0;				// beginFrame() to endFrame()
+	double submit_ms = 0;			// CPU time spent in Model draw submission
+};
+
+// SUBMIT TIMER
+// Adds the lifetime of the timer to the frame's submit_ms
+class RendSubmitTimer
+{
+private:
+	std::chrono::steady_clock::time_point start;
+public:
+	RendSubmitTimer() : start(std::chrono::steady_clock::now()) {}
+	~RendSubmitTimer();
+};
+
+// FRAME STATS
+// Counters for the frame in progress; call beginFrame()/endFrame() around each frame
+class FrameStats
+{
+private:
+	RendFrameStats current;
+	RendFrameStats last;
+	uint64_t allocation_base = 0;
+	std::chrono::steady_clock::time_point start;
+
+	FrameStats() {}
+public:
+	static FrameStats& get()
+	{
+		static FrameStats instance;
+		return instance;
+	}
+
+	RendFrameStats& counters() { return current; }
+	const RendFrameStats& lastFrame() const { return last; }
+
+	void beginFrame();
+	void endFrame();
+	void print() const;
+};
+
+RendSubmitTimer::~RendSubmitTimer()
+{
+	FrameStats::get().counters().submit_ms +=
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+}
+
+// Reset counters for a new frame
+void FrameStats::beginFrame()
+{
+	uint64_t frame = this->last.frame + 1;
+	this->current = RendFrameStats();
+	this->current.frame = frame;
+	this->allocation_base = rend_allocation_count.load(std::memory_order_relaxed);
+	this->start = std::chrono::steady_clock::now();
+}
+
+// Publish the frame's counters (available through lastFrame() until the next endFrame())
+void FrameStats::endFrame()
+{
+	this->current.allocations = rend_allocation_count.load(std::memory_order_relaxed) - this->allocation_base;
+	this->current.cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+	this->last = this->current;
+}
+
+// Print last frame's counters
+void FrameStats::print() const
+{
+	printf("Frame %llu: %.3f ms (submit %.3f ms), %llu draw calls (%llu indirect draws), %llu instances, %llu allocations\n",
+		(unsigned long long)this->last.frame, this->last.cpu_ms, this->last.submit_ms,
+		(unsigned long long)this->last.draw_calls, (unsigned long long)this->last.indirect_draws,
+		(unsigned long long)this->last.instances, (unsigned long long)this->last.allocations);
+	printf("Frame %llu: %llu state calls issued, %llu elided, %llu meshes visible, %llu culled\n",
+		(unsigned long long)this->last.frame, (unsigned long long)this->last.state_issued,
+		(unsigned long long)this->last.state_elided, (unsigned long long)this->last.visible,
+		(unsigned long long)this->last.culled);
+}
+
+#endif
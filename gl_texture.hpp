@@ -0,0 +1,463 @@
+// *****************************************************************************************************************************
+// gl_texture.hpp
+// OpenGL Rendering
+// Process-wide texture registry (shared, reference counted textures) and asynchronous texture streaming
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_TEXTURE_HPP
+#define GL_TEXTURE_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <system_error>
+
+#include "gl_render.hpp"
+#include "gl_threads.hpp"
+
+#define TEXTURE_STREAM_PBO_COUNT 4
+#define TEXTURE_STREAM_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+// TEXTURE STREAMER
+// Decodes images on worker threads and uploads them through a ring of pixel buffer objects,
+// limited to a byte budget per frame. load() returns immediately with a texture that holds a
+// 1x1 placeholder until the real image is resident. GL calls only happen on the GL thread
+// (load, update, cancel).
+class TextureStreamer
+{
+public:
+	// Called on the GL thread once the texture is resident (success) or decode failed
+	typedef std::function<void(GLuint id, bool success, const TextureInfo& info)> Callback;
+private:
+	struct Job
+	{
+		GLuint id = 0;
+		uint64_t serial = 0;
+		std::string path;
+		TextureOptions options;
+		Callback callback;
+		TextureImage image;		// Decoded pixels, or KTX file contents
+		bool ktx = false;
+		unsigned int error = 0;
+	};
+
+	// Shared with worker tasks so they never touch a destroyed streamer
+	struct DoneQueue
+	{
+		std::mutex mutex;
+		std::deque<std::shared_ptr<Job>> jobs;
+	};
+
+	std::shared_ptr<DoneQueue> done = std::make_shared<DoneQueue>();
+	std::deque<std::shared_ptr<Job>> ready;				// Decoded, waiting for upload budget (GL thread only)
+	std::unordered_map<GLuint, uint64_t> pending;		// Texture ID -> job serial
+	uint64_t next_serial = 1;
+
+	GLuint pbos[TEXTURE_STREAM_PBO_COUNT] = {};
+	GLsync fences[TEXTURE_STREAM_PBO_COUNT] = {};
+	unsigned int next_pbo = 0;
+	size_t frame_budget = TEXTURE_STREAM_DEFAULT_BUDGET;
+	size_t uploaded_bytes = 0;		// Total since start
+
+	TextureStreamer() {}
+	void decode(std::shared_ptr<Job> job, bool try_ktx);
+	bool upload(Job& job, TextureInfo& info);
+	void complete(Job& job, bool success, const TextureInfo& info);
+public:
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	static TextureStreamer& get();
+
+	GLuint load(const std::string& path, const TextureOptions& options = TextureOptions(), Callback callback = nullptr);
+	void update();
+	void finish();
+	void cancel(GLuint id);
+
+	bool isResident(GLuint id) const { return pending.find(id) == pending.end(); }
+	size_t getNumPending() const { return pending.size(); }
+	size_t getUploadedBytes() const { return uploaded_bytes; }
+	void setFrameBudget(size_t bytes) { frame_budget = bytes; }
+};
+
+// Get process-wide instance
+TextureStreamer& TextureStreamer::get()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+// Start loading a texture asynchronously
+// callback = optional completion callback (GL thread, from update())
+// Return: texture ID, bound to a placeholder until resident
+GLuint TextureStreamer::load(const std::string& path, const TextureOptions& options, Callback callback)
+{
+	static const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+	GLuint id;
+
+	// Placeholder (a 1x1 level 0 is a complete mip chain, so any filter works)
+	glGenTextures(1, &id);
+	StateCache::get().bindTexture(GL_TEXTURE_2D, id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	RendSetTextureParams(options);
+	StateCache::get().bindTexture(GL_TEXTURE_2D, 0);
+
+	auto job = std::make_shared<Job>();
+	job->id = id;
+	job->serial = next_serial++;
+	job->path = path;
+	job->options = options;
+	job->callback = std::move(callback);
+	pending[id] = job->serial;
+
+	this->decode(job, options.prefer_compressed);
+
+	return id;
+}
+
+// Queue file read / decode on the worker pool
+// try_ktx = read the compressed <name>.ktx version if present and up to date (uploaded as-is)
+void TextureStreamer::decode(std::shared_ptr<Job> job, bool try_ktx)
+{
+	std::shared_ptr<DoneQueue> queue = done;
+	RendGetThreadPool().submit([job, queue, try_ktx]()
+	{
+		job->ktx = false;
+		if (try_ktx && KTXIsCurrent(job->path))
+		{
+			KTXHeader header;
+			std::vector<KTXLevel> levels;
+			job->ktx = lodepng::load_file(job->image.pixels, KTXGetPath(job->path)) == 0 &&
+				KTXParse(job->image.pixels.data(), job->image.pixels.size(), header, levels);
+		}
+		if (!job->ktx)
+		{
+			job->image = TextureImage();
+			job->error = RendDecodeTextureImage(job->path.c_str(), job->image, job->options.compact_format);
+		}
+
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->jobs.push_back(job);
+	});
+}
+
+// Upload decoded images within the frame budget and fire completion callbacks
+// Call once per frame on the GL thread
+void TextureStreamer::update()
+{
+	{
+		std::lock_guard<std::mutex> lock(done->mutex);
+		while (!done->jobs.empty())
+		{
+			ready.push_back(std::move(done->jobs.front()));
+			done->jobs.pop_front();
+		}
+	}
+
+	size_t frame_bytes = 0;
+	while (!ready.empty())
+	{
+		std::shared_ptr<Job> job = ready.front();
+
+		// Cancelled (texture deleted, ID possibly reused)
+		auto it = pending.find(job->id);
+		if (it == pending.end() || it->second != job->serial)
+		{
+			ready.pop_front();
+			continue;
+		}
+
+		TextureInfo info;
+		if (job->error != 0)
+		{
+			std::cout << "lodepng error " << job->error << ": " << lodepng_error_text(job->error) << std::endl;
+			ready.pop_front();
+			this->complete(*job, false, info);
+			continue;
+		}
+
+		// Budget (always allow one upload per frame so large images still progress)
+		size_t bytes = job->image.pixels.size();
+		if (frame_bytes > 0 && frame_bytes + bytes > frame_budget)
+			break;
+
+		if (job->ktx)
+		{
+			// Compressed: small, upload directly; fall back to the image if the format is unsupported
+			ready.pop_front();
+			StateCache::get().bindTexture(GL_TEXTURE_2D, job->id);
+			bool loaded = RendTexImageKTX(job->image.pixels.data(), bytes, job->options, &info);
+			StateCache::get().bindTexture(GL_TEXTURE_2D, 0);
+			if (loaded)
+			{
+				frame_bytes += bytes;
+				uploaded_bytes += bytes;
+				this->complete(*job, true, info);
+			}
+			else
+				this->decode(job, false);
+			continue;
+		}
+
+		if (!this->upload(*job, info))
+			break;	// Staging ring busy, retry next frame
+
+		frame_bytes += bytes;
+		ready.pop_front();
+		this->complete(*job, true, info);
+	}
+}
+
+// Copy image into the next staging buffer and re-specify the texture from it
+// Return: false if the staging buffer is still in use by the GPU
+bool TextureStreamer::upload(Job& job, TextureInfo& info)
+{
+	unsigned int slot = next_pbo;
+
+	if (pbos[0] == 0)
+		glGenBuffers(TEXTURE_STREAM_PBO_COUNT, pbos);
+
+	if (fences[slot])
+	{
+		// Flush so the fence is submitted: otherwise it may never signal and a waiting finish() would spin forever
+		if (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(fences[slot]);
+		fences[slot] = nullptr;
+	}
+
+	const TextureImage& image = job.image;
+	size_t bytes = image.pixels.size();
+	StateCache::get().bindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[slot]);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);	// Orphan / resize
+	void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dst)
+	{
+		std::memcpy(dst, image.pixels.data(), bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+	StateCache::get().bindTexture(GL_TEXTURE_2D, job.id);
+	if (dst)
+		RendTexImage(image, (GLvoid*)0, job.options, &info);
+	StateCache::get().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!dst)	// Mapping failed, upload from client memory instead
+		RendTexImage(image, image.pixels.data(), job.options, &info);
+	StateCache::get().bindTexture(GL_TEXTURE_2D, 0);
+
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	next_pbo = (slot + 1) % TEXTURE_STREAM_PBO_COUNT;
+
+	uploaded_bytes += bytes;
+
+	return true;
+}
+
+void TextureStreamer::complete(Job& job, bool success, const TextureInfo& info)
+{
+	pending.erase(job.id);
+	job.image.pixels.clear();
+	job.image.pixels.shrink_to_fit();
+
+	if (job.callback)
+		job.callback(job.id, success, info);
+}
+
+// Block until every pending texture is resident (e.g. loading screens, batch rendering)
+void TextureStreamer::finish()
+{
+	while (!pending.empty())
+	{
+		size_t before = pending.size();
+		this->update();
+		if (pending.size() == before)
+			std::this_thread::yield();
+	}
+}
+
+// Stop tracking a texture (call before deleting it)
+void TextureStreamer::cancel(GLuint id)
+{
+	pending.erase(id);
+}
+
+// TEXTURE CACHE
+// Textures keyed by canonical path + options, shared by every Model that references them.
+// A failed async load is evicted, so the next acquire retries it. GL thread only.
+class TextureCache
+{
+private:
+	struct Entry
+	{
+		GLuint id = 0;
+		unsigned int refs = 0;
+		TextureInfo info;		// Valid once resident
+	};
+
+	std::unordered_map<std::string, Entry> entries;		// Key -> texture
+	std::unordered_map<GLuint, std::string> keys;		// Texture ID -> key (for release)
+	std::unordered_map<GLuint, Entry> failed;			// Failed async loads, out of entries until released
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t resident_bytes = 0;
+
+	TextureCache() {}
+public:
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	static TextureCache& get();
+	static std::string makeKey(const std::string& path, const TextureOptions& options);
+
+	GLuint acquire(const std::string& path, const TextureOptions& options = TextureOptions(), bool async = false);
+	void release(GLuint id);
+	void evict(GLuint id);
+
+	size_t getHits() const { return hits; }
+	size_t getMisses() const { return misses; }
+	size_t getResidentBytes() const { return resident_bytes; }
+	size_t getNumTextures() const { return entries.size(); }
+	const TextureInfo* getInfo(GLuint id) const;
+	void resetCounters() { hits = misses = 0; }
+};
+
+// Get process-wide instance
+TextureCache& TextureCache::get()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+// Build lookup key from canonical path and options
+std::string TextureCache::makeKey(const std::string& path, const TextureOptions& options)
+{
+	std::error_code ec;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+	if (ec)
+		canonical = std::filesystem::path(path).lexically_normal();
+
+	char opt[64];
+	snprintf(opt, sizeof(opt), "|%x|%x|%x|%x|%d|%d|%d", options.wrap_s, options.wrap_t, options.min_filter,
+		options.mag_filter, options.mipmap ? 1 : 0, options.prefer_compressed ? 1 : 0, options.compact_format ? 1 : 0);
+
+	return canonical.generic_string() + opt;
+}
+
+// Get texture, loading it on first use (adds a reference)
+// async = stream through TextureStreamer (returns placeholder texture until resident)
+// Return: texture ID (0 if load failed)
+GLuint TextureCache::acquire(const std::string& path, const TextureOptions& options, bool async)
+{
+	std::string key = makeKey(path, options);
+
+	auto it = entries.find(key);
+	if (it != entries.end())
+	{
+		hits++;
+		it->second.refs++;
+		return it->second.id;
+	}
+
+	misses++;
+	TextureInfo info;
+	GLuint id;
+	if (async)
+	{
+		// Bytes are accounted once the real image is resident
+		id = TextureStreamer::get().load(path, options, [this](GLuint tex_id, bool success, const TextureInfo& tex_info)
+		{
+			auto key_it = keys.find(tex_id);
+			if (key_it == keys.end())
+				return;
+			if (success)
+			{
+				entries[key_it->second].info = tex_info;
+				resident_bytes += tex_info.bytes;
+			}
+			else
+				this->evict(tex_id);
+		});
+	}
+	else
+	{
+		id = RendLoadTexture(path.c_str(), options, &info);
+		if (id == 0)
+			return 0;	// Not cached, so a later attempt can retry
+	}
+
+	Entry& entry = entries[key];
+	entry.id = id;
+	entry.refs = 1;
+	entry.info = info;
+	keys[id] = key;
+	resident_bytes += info.bytes;
+
+	return id;
+}
+
+// Get description of a cached texture
+// Return: nullptr if the ID is not in the cache
+const TextureInfo* TextureCache::getInfo(GLuint id) const
+{
+	auto key_it = keys.find(id);
+	if (key_it == keys.end())
+	{
+		auto failed_it = failed.find(id);
+		return failed_it == failed.end() ? nullptr : &failed_it->second.info;
+	}
+
+	return &entries.find(key_it->second)->second.info;
+}
+
+// Remove a texture from lookup, so the next acquire loads it again (users keep the ID until they release it)
+void TextureCache::evict(GLuint id)
+{
+	auto key_it = keys.find(id);
+	if (key_it == keys.end())
+		return;
+
+	auto it = entries.find(key_it->second);
+	failed[id] = it->second;
+	entries.erase(it);
+	keys.erase(key_it);
+}
+
+// Drop a reference, deleting the GL texture when the last user goes away
+void TextureCache::release(GLuint id)
+{
+	auto failed_it = failed.find(id);
+	if (failed_it != failed.end())
+	{
+		if (--failed_it->second.refs == 0)
+		{
+			StateCache::get().deleteTexture(id);
+			failed.erase(failed_it);
+		}
+		return;
+	}
+
+	auto key_it = keys.find(id);
+	if (key_it == keys.end())
+		return;
+
+	auto it = entries.find(key_it->second);
+	if (--it->second.refs == 0)
+	{
+		TextureStreamer::get().cancel(id);
+		StateCache::get().deleteTexture(id);
+		resident_bytes -= it->second.info.bytes;
+		entries.erase(it);
+		keys.erase(key_it);
+	}
+}
+
+#endif
@@ -0,0 +1,150 @@
+// *****************************************************************************************************************************
+// gl_threads.hpp
+// OpenGL Rendering
+// Worker thread pool for CPU-side loading work (no OpenGL calls on workers)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_THREADS_HPP
+#define GL_THREADS_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+// THREAD POOL
+class ThreadPool
+{
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping = false;
+
+	void workerLoop();
+	static ThreadPool*& currentPool() { thread_local ThreadPool* pool = nullptr; return pool; }
+public:
+	ThreadPool(unsigned int num_threads = 0);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	unsigned int numThreads() const { return static_cast<unsigned int>(workers.size()); }
+	bool isWorkerThread() const { return currentPool() == this; }
+
+	template <typename F>
+	std::future<void> submit(F&& task);
+	template <typename F>
+	void parallelFor(size_t count, F&& fn);
+};
+
+// Constructor
+// num_threads = number of worker threads (0: hardware concurrency)
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	workers.reserve(num_threads);
+	for (unsigned int i = 0; i < num_threads; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+// Destructor (finishes queued tasks, then joins workers)
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::workerLoop()
+{
+	currentPool() = this;
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty())
+				return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+// Queue task for a worker thread
+// Return: future that becomes ready when the task has run
+template <typename F>
+std::future<void> ThreadPool::submit(F&& task)
+{
+	auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+	std::future<void> result = packaged->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.emplace_back([packaged] { (*packaged)(); });
+	}
+	cv.notify_one();
+
+	return result;
+}
+
+// Run fn(i) for i in [0, count) across the pool and the calling thread, then wait
+// Items are claimed dynamically so uneven work sizes balance out
+// Called from one of this pool's workers (nested), the loop runs inline: waiting on helpers queued behind
+// the calling task could deadlock once every worker is blocked the same way
+template <typename F>
+void ThreadPool::parallelFor(size_t count, F&& fn)
+{
+	if (count == 0)
+		return;
+	if (count == 1 || workers.empty() || isWorkerThread())
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto run = [&]()
+	{
+		for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+			fn(i);
+	};
+
+	size_t num_helpers = std::min(count - 1, workers.size());
+	std::vector<std::future<void>> helpers;
+	helpers.reserve(num_helpers);
+	for (size_t i = 0; i < num_helpers; i++)
+		helpers.push_back(submit(run));
+
+	run();
+	for (std::future<void>& helper : helpers)
+		helper.get();
+}
+
+// Get shared process-wide loader pool
+ThreadPool& RendGetThreadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+#endif
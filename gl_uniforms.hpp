@@ -0,0 +1,298 @@
+// *****************************************************************************************************************************
+// gl_uniforms.hpp
+// OpenGL Rendering
+// Shared uniform blocks (std140 frame / material data in uniform buffer objects)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+#ifndef GL_UNIFORMS_HPP
+#define GL_UNIFORMS_HPP
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL\glew.h>
+
+#include "vec.hpp"
+#include "mat.hpp"
+
+#include "gl_camera.hpp"
+#include "gl_hierarchy.hpp"
+#include "gl_shader.hpp"
+#include "gl_state.hpp"
+
+#define SHADER_MAX_LIGHTS 4		// Array size of FrameData.lights in UNIFORMS_GLSL
+
+// Stringize a macro's value (for sizes shared by C++ and GLSL source)
+#define UNIFORMS_STR(x) #x
+#define UNIFORMS_XSTR(x) UNIFORMS_STR(x)
+
+// std140 mirrors of the GLSL blocks in UNIFORMS_GLSL (vec3 members are padded to vec4, arrays use 16-byte strides)
+struct ShaderLight
+{
+	GLfloat position[4];		// xyz: world position, w = 1 (w = 0: xyz is a direction)
+	GLfloat color[4];			// rgb: color * intensity
+};
+
+struct ShaderFrameData
+{
+	GLfloat view[16];
+	GLfloat projection[16];
+	GLfloat view_projection[16];
+	GLfloat view_pos[4];		// xyz: camera position
+	ShaderLight lights[SHADER_MAX_LIGHTS];
+	GLint num_lights;
+	GLfloat time;
+	GLfloat pad[2];
+};
+
+struct ShaderMaterialData
+{
+	GLfloat diffuse[4];			// Color multiplied with the diffuse textures
+	GLfloat specular[4];
+	GLfloat shininess;
+	GLuint num_tex_diffuse;
+	GLuint num_tex_specular;
+	GLuint pad;
+};
+
+static_assert(sizeof(ShaderFrameData) % 16 == 0, "std140 block size must be a multiple of 16");
+static_assert(sizeof(ShaderMaterialData) % 16 == 0, "std140 block size must be a multiple of 16");
+
+// GLSL declarations of the shared blocks (insert after the #version line)
+// Bindings are assigned by ShaderReflect, so the blocks only need to keep these names.
+const char UNIFORMS_GLSL[] =
+	"struct Light\n"
+	"{\n"
+	"	vec4 position;\n"
+	"	vec4 color;\n"
+	"};\n"
+	"layout(std140) uniform FrameData\n"
+	"{\n"
+	"	mat4 view;\n"
+	"	mat4 projection;\n"
+	"	mat4 view_projection;\n"
+	"	vec4 view_pos;\n"
+	"	Light lights[" UNIFORMS_XSTR(SHADER_MAX_LIGHTS) "];\n"
+	"	int num_lights;\n"
+	"	float time;\n"
+	"};\n"
+	"layout(std140) uniform MaterialData\n"
+	"{\n"
+	"	vec4 material_diffuse;\n"
+	"	vec4 material_specular;\n"
+	"	float material_shininess;\n"
+	"	uint material_num_tex_diffuse;\n"
+	"	uint material_num_tex_specular;\n"
+	"};\n";
+
+// Return: block size reported by the driver, padded to a whole vec4 (drivers may leave out the trailing padding)
+GLint UniformsBlockSize(const ShaderBlockInfo& block)
+{
+	return (block.data_size + 15) & ~15;
+}
+
+// Compare the shared blocks of a program with the C++ structs (catches layout drift between GLSL and C++)
+// Return: true if every shared block the program uses has the expected size
+bool UniformsCheckLayout(GLuint program)
+{
+	const ShaderReflection& reflection = ShaderLocationCache::get().getReflection(program);
+	bool ok = true;
+
+	const ShaderBlockInfo* frame = reflection.findBlock(SHADER_FRAME_BLOCK);
+	if (frame && UniformsBlockSize(*frame) != GLint(sizeof(ShaderFrameData)))
+	{
+		std::cout << "Program " << program << ": " << SHADER_FRAME_BLOCK << " is " << frame->data_size << " bytes, expected "
+			<< sizeof(ShaderFrameData) << std::endl;
+		ok = false;
+	}
+	const ShaderBlockInfo* material = reflection.findBlock(SHADER_MATERIAL_BLOCK);
+	if (material && UniformsBlockSize(*material) != GLint(sizeof(ShaderMaterialData)))
+	{
+		std::cout << "Program " << program << ": " << SHADER_MATERIAL_BLOCK << " is " << material->data_size <<
+			" bytes, expected " << sizeof(ShaderMaterialData) << std::endl;
+		ok = false;
+	}
+
+	return ok;
+}
+
+// UNIFORM BUFFER
+// Uniform buffer object, re-specified on every upload (the driver orphans the old storage instead of stalling)
+class UniformBuffer
+{
+private:
+	GLuint ubo = 0;
+	size_t capacity = 0;
+public:
+	UniformBuffer() {}
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer(UniformBuffer&& other) noexcept : ubo(other.ubo), capacity(other.capacity) { other.ubo = 0; other.capacity = 0; }
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(UniformBuffer&&) = delete;
+	~UniformBuffer() { StateCache::get().deleteBuffer(ubo); }
+
+	void upload(const void* data, size_t size);
+	void bind(GLuint binding) { StateCache::get().bindBufferBase(GL_UNIFORM_BUFFER, binding, ubo); }
+	void bindRange(GLuint binding, size_t offset, size_t size)
+	{
+		StateCache::get().bindBufferRange(GL_UNIFORM_BUFFER, binding, ubo, GLintptr(offset), GLsizeiptr(size));
+	}
+	GLuint getID() const { return ubo; }
+	size_t size() const { return capacity; }
+};
+
+// Replace buffer contents (creates the buffer on first use)
+void UniformBuffer::upload(const void* data, size_t size)
+{
+	if (!this->ubo)
+		glGenBuffers(1, &this->ubo);
+
+	StateCache::get().bindBuffer(GL_UNIFORM_BUFFER, this->ubo);
+	glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(size), data, GL_DYNAMIC_DRAW);
+	this->capacity = size;
+}
+
+// FRAME UNIFORMS
+// Camera and lights shared by every program: uploaded once per frame and bound to SHADER_FRAME_BINDING,
+// so switching programs does not re-upload view / projection uniforms
+template <typename T = float>
+class FrameUniforms
+{
+private:
+	UniformBuffer buffer;
+	ShaderFrameData data;
+public:
+	FrameUniforms() { std::memset(&data, 0, sizeof(data)); }
+
+	void setLight(size_t index, const Vec3<T>& position, const Vec3<T>& color, bool directional = false);
+	void setNumLights(size_t count) { data.num_lights = GLint(count < SHADER_MAX_LIGHTS ? count : SHADER_MAX_LIGHTS); }
+	void setTime(float seconds) { data.time = seconds; }
+	void update(Camera<T>& camera, Mat4<T> projection);
+
+	const ShaderFrameData& getData() const { return data; }
+	UniformBuffer& getBuffer() { return buffer; }
+};
+
+// Set a light (index < SHADER_MAX_LIGHTS; lights at or above the light count are ignored by shaders)
+// directional = position is the direction towards the light
+template <typename T>
+void FrameUniforms<T>::setLight(size_t index, const Vec3<T>& position, const Vec3<T>& color, bool directional)
+{
+	if (index >= SHADER_MAX_LIGHTS)
+		return;
+
+	ShaderLight& light = this->data.lights[index];
+	light.position[0] = GLfloat(position.x);
+	light.position[1] = GLfloat(position.y);
+	light.position[2] = GLfloat(position.z);
+	light.position[3] = directional ? 0.0f : 1.0f;
+	light.color[0] = GLfloat(color.x);
+	light.color[1] = GLfloat(color.y);
+	light.color[2] = GLfloat(color.z);
+	light.color[3] = 1.0f;
+}
+
+// Upload camera matrices and lights, then bind the block (call once per frame, before drawing)
+// projection = projection matrix used with getLookAt()
+template <typename T>
+void FrameUniforms<T>::update(Camera<T>& camera, Mat4<T> projection)
+{
+	Mat4<T> view = camera.getLookAt();
+	NodeTransform<T> v = NodeTransformFromMat4(view);
+	NodeTransform<T> p = NodeTransformFromMat4(projection);
+	NodeTransform<T> vp = NodeTransformFromMat4(projection * view);
+	for (int i = 0; i < 16; i++)
+	{
+		this->data.view[i] = GLfloat(v.m[i]);
+		this->data.projection[i] = GLfloat(p.m[i]);
+		this->data.view_projection[i] = GLfloat(vp.m[i]);
+	}
+
+	Vec3<T> pos = camera.getPos();
+	this->data.view_pos[0] = GLfloat(pos.x);
+	this->data.view_pos[1] = GLfloat(pos.y);
+	this->data.view_pos[2] = GLfloat(pos.z);
+	this->data.view_pos[3] = 1.0f;
+
+	this->buffer.upload(&this->data, sizeof(this->data));
+	this->buffer.bind(SHADER_FRAME_BINDING);
+}
+
+// MATERIAL UNIFORMS
+// Per-material constants in one uniform buffer (one aligned slot per material); bind() selects a material's slot
+// with glBindBufferRange, so drawing a material needs no glUniform calls for its constants
+class MaterialUniforms
+{
+private:
+	UniformBuffer buffer;
+	std::vector<unsigned char> staging;
+	size_t stride = 0;				// sizeof(ShaderMaterialData) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	size_t count = 0;
+	bool dirty = false;
+
+	void setStride();
+public:
+	uint32_t add(const ShaderMaterialData& material);
+	void set(uint32_t index, const ShaderMaterialData& material);
+	void upload();
+	void bind(uint32_t index);
+	void clear() { staging.clear(); count = 0; dirty = true; }
+	size_t size() const { return count; }
+};
+
+// Slot stride from the context's offset alignment (needs a current context)
+void MaterialUniforms::setStride()
+{
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (alignment <= 0)
+		alignment = 256;
+	this->stride = (sizeof(ShaderMaterialData) + size_t(alignment) - 1) / size_t(alignment) * size_t(alignment);
+}
+
+// Add a material
+// Return: material index for set / bind
+uint32_t MaterialUniforms::add(const ShaderMaterialData& material)
+{
+	if (!this->stride)
+		this->setStride();
+
+	this->staging.resize((this->count + 1) * this->stride);
+	this->count++;
+	this->set(uint32_t(this->count - 1), material);
+	return uint32_t(this->count - 1);
+}
+
+// Replace a material (uploaded with the next upload / bind)
+void MaterialUniforms::set(uint32_t index, const ShaderMaterialData& material)
+{
+	if (index >= this->count)
+		return;
+	std::memcpy(&this->staging[index * this->stride], &material, sizeof(material));
+	this->dirty = true;
+}
+
+// Upload changed materials (all slots in one call)
+void MaterialUniforms::upload()
+{
+	if (!this->dirty || this->staging.empty())
+		return;
+	this->buffer.upload(this->staging.data(), this->staging.size());
+	this->dirty = false;
+}
+
+// Bind a material's slot to SHADER_MATERIAL_BINDING
+void MaterialUniforms::bind(uint32_t index)
+{
+	if (index >= this->count)
+		return;
+	this->upload();
+	this->buffer.bindRange(SHADER_MATERIAL_BINDING, index * this->stride, sizeof(ShaderMaterialData));
+}
+
+#endif
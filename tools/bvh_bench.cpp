@@ -0,0 +1,188 @@
+// *****************************************************************************************************************************
+// bvh_bench.cpp
+// OpenGL Rendering
+// Benchmark: InstanceBVH build / refit / frustum culling vs linear culling of every instance
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+// Usage: bvh_bench [queries]
+//   Scatters 10k, 100k and 1M random instance boxes over a 1000-unit cube and, at each size, times the BVH build,
+//   a refit after moving every instance, and frustum queries (default 20 per size, camera rotating about the origin)
+//   against two linear passes: the same box test on every instance, and RendCullSpheres on bounding spheres.
+//   The BVH visible set must match the linear box test exactly (returns 1 if it does not).
+//   No OpenGL context is needed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+#include "gl_bvh.hpp"
+#include "gl_cull.hpp"
+
+#define BENCH_WORLD_SIZE 1000.0f
+#define BENCH_FOV_TAN 0.577f		// tan(30 deg): 60 deg horizontal and vertical field of view
+#define BENCH_NEAR 0.1f
+#define BENCH_FAR 300.0f
+
+typedef std::chrono::steady_clock BenchClock;
+
+double BenchMs(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// Set a plane (normal pointing into the frustum, normalized)
+void BenchSetPlane(float* plane, float a, float b, float c, float d)
+{
+	float len = std::sqrt(a * a + b * b + c * c);
+	plane[0] = a / len;
+	plane[1] = b / len;
+	plane[2] = c / len;
+	plane[3] = d / len;
+}
+
+// Perspective frustum of a camera at the origin looking along (sin(yaw), 0, -cos(yaw))
+Frustum<float> BenchFrustum(float yaw)
+{
+	// Camera space planes (looking down -z), then rotated about y into world space
+	float cam[6][4] = {
+		{ 1.0f, 0.0f, -BENCH_FOV_TAN, 0.0f },	// Left:   x >= z * tan
+		{ -1.0f, 0.0f, -BENCH_FOV_TAN, 0.0f },	// Right:  x <= -z * tan
+		{ 0.0f, 1.0f, -BENCH_FOV_TAN, 0.0f },	// Bottom
+		{ 0.0f, -1.0f, -BENCH_FOV_TAN, 0.0f },	// Top
+		{ 0.0f, 0.0f, -1.0f, -BENCH_NEAR },		// Near:   -z >= near
+		{ 0.0f, 0.0f, 1.0f, BENCH_FAR }			// Far:    -z <= far
+	};
+
+	float s = std::sin(yaw), c = std::cos(yaw);
+	Frustum<float> frustum;
+	for (int p = 0; p < 6; p++)
+	{
+		// Plane normals rotate with the camera: world = R * cam, R rotating -z onto the view direction
+		float wx = c * cam[p][0] - s * cam[p][2];
+		float wz = s * cam[p][0] + c * cam[p][2];
+		BenchSetPlane(frustum.planes[p], wx, cam[p][1], wz, cam[p][3]);
+	}
+	return frustum;
+}
+
+// Linear reference: the BVH's box / plane test on every instance
+size_t CullLinear(const Frustum<float>& frustum, const std::vector<float>& mins, const std::vector<float>& maxs,
+	std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	const size_t count = mins.size() / 3;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* lo = &mins[i * 3];
+		const float* hi = &maxs[i * 3];
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			const float* pl = frustum.planes[p];
+			float far_d = pl[3];
+			for (int k = 0; k < 3; k++)
+				far_d += pl[k] * (pl[k] > 0 ? hi[k] : lo[k]);
+			inside = far_d >= 0;
+		}
+		if (inside)
+			visible.push_back(uint32_t(i));
+	}
+	return visible.size();
+}
+
+// Run every size
+// Return: false if a BVH query differed from the linear reference
+bool RunSize(size_t count, int queries, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> coord(-0.5f * BENCH_WORLD_SIZE, 0.5f * BENCH_WORLD_SIZE);
+	std::uniform_real_distribution<float> extent(0.25f, 2.0f);
+	std::uniform_real_distribution<float> move(-1.0f, 1.0f);
+
+	std::vector<float> mins(count * 3), maxs(count * 3);
+	for (size_t i = 0; i < count * 3; i++)
+	{
+		float center = coord(rng), half = extent(rng);
+		mins[i] = center - half;
+		maxs[i] = center + half;
+	}
+
+	InstanceBVH bvh;
+	auto start = BenchClock::now();
+	bvh.build(mins.data(), maxs.data(), count);
+	double build_ms = BenchMs(start);
+
+	// Move every instance a little (what a per-frame refit sees)
+	for (size_t i = 0; i < count * 3; i++)
+	{
+		float d = move(rng);
+		mins[i] += d;
+		maxs[i] += d;
+	}
+	start = BenchClock::now();
+	bvh.refit(mins.data(), maxs.data());
+	double refit_ms = BenchMs(start);
+
+	CullSpheres spheres;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* lo = &mins[i * 3];
+		const float* hi = &maxs[i * 3];
+		float hx = 0.5f * (hi[0] - lo[0]), hy = 0.5f * (hi[1] - lo[1]), hz = 0.5f * (hi[2] - lo[2]);
+		spheres.push(lo[0] + hx, lo[1] + hy, lo[2] + hz, std::sqrt(hx * hx + hy * hy + hz * hz));
+	}
+	std::vector<uint8_t> sphere_visible(count);
+
+	std::vector<uint32_t> bvh_visible, linear_visible;
+	double bvh_ms = 0, linear_ms = 0, sphere_ms = 0;
+	size_t bvh_total = 0, sphere_total = 0;
+	bool same = true;
+	for (int q = 0; q < queries; q++)
+	{
+		Frustum<float> frustum = BenchFrustum(6.2831853f * float(q) / float(queries));
+
+		start = BenchClock::now();
+		bvh_total += bvh.cullFrustum(frustum, bvh_visible);
+		bvh_ms += BenchMs(start);
+
+		start = BenchClock::now();
+		CullLinear(frustum, mins, maxs, linear_visible);
+		linear_ms += BenchMs(start);
+
+		start = BenchClock::now();
+		sphere_total += RendCullSpheres(frustum, spheres, sphere_visible.data());
+		sphere_ms += BenchMs(start);
+
+		std::sort(bvh_visible.begin(), bvh_visible.end());
+		same = same && bvh_visible == linear_visible;
+	}
+
+	printf("%8zu instances, %8zu nodes: build %8.2f ms, refit %7.2f ms\n", count, bvh.numNodes(), build_ms, refit_ms);
+	printf("    per query: bvh %7.3f ms, linear boxes %7.3f ms (%.1fx), linear spheres %7.3f ms (%.1fx), "
+		"%zu visible (spheres %zu)\n", bvh_ms / queries, linear_ms / queries, linear_ms / bvh_ms, sphere_ms / queries,
+		sphere_ms / bvh_ms, bvh_total / size_t(queries), sphere_total / size_t(queries));
+	if (!same)
+		fprintf(stderr, "    BVH visible set differs from the linear box test\n");
+	return same;
+}
+
+int main(int argc, char* argv[])
+{
+	int queries = argc > 1 ? std::atoi(argv[1]) : 20;
+	if (queries < 1)
+	{
+		fprintf(stderr, "Usage: %s [queries >= 1]\n", argv[0]);
+		return 1;
+	}
+
+	std::mt19937 rng(1234);
+	bool ok = true;
+	for (size_t count : { size_t(10000), size_t(100000), size_t(1000000) })
+		ok = RunSize(count, queries, rng) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+// *****************************************************************************************************************************
+// import_bench.cpp
+// OpenGL Rendering
+// Benchmark: per-element processMesh conversion (original) vs sized / bulk-gathered conversion (ModelConvertGeometry)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+// Usage: import_bench [vertices] [runs]
+//   Converts a synthetic grid aiMesh (default ~1M vertices, normals and UVs) with both paths and prints the best
+//   and average time of each. Both paths end with the buffers owned by a mesh, as Model::loadModel does.
+//   No OpenGL context is needed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <assimp/scene.h>
+
+#include "gl_model.hpp"
+
+// Mesh storage as built by the import path (stands in for Mesh<T>, which needs a context to upload)
+struct BenchMesh
+{
+	std::vector<Vertex<float>> vertices;
+	std::vector<GLuint> indices;
+};
+
+// Original conversion: per-element push_back into unreserved vectors, face copies, Mesh constructor copy
+BenchMesh ConvertOriginal(const aiMesh* mesh)
+{
+	std::vector<Vertex<float>> vertices;
+	std::vector<GLuint> indices;
+
+	for (GLuint i = 0; i < mesh->mNumVertices; i++)
+	{
+		Vertex<float> vertex;
+		Vec3<float> vector;
+		vector.x = mesh->mVertices[i].x;
+		vector.y = mesh->mVertices[i].y;
+		vector.z = mesh->mVertices[i].z;
+		vertex.pos = vector;
+
+		vector.x = mesh->mNormals[i].x;
+		vector.y = mesh->mNormals[i].y;
+		vector.z = mesh->mNormals[i].z;
+		vertex.norm = vector;
+
+		if (mesh->mTextureCoords[0])
+		{
+			Vec2<float> vec;
+			vec.x = mesh->mTextureCoords[0][i].x;
+			vec.y = mesh->mTextureCoords[0][i].y;
+			vertex.uv = vec;
+		}
+		else
+			vertex.uv = Vec2<float>();
+
+		vertices.push_back(vertex);
+	}
+	for (GLuint i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+		for (GLuint j = 0; j < face.mNumIndices; j++)
+			indices.push_back(face.mIndices[j]);
+	}
+
+	// Mesh<T> took its vectors by value
+	BenchMesh out;
+	out.vertices = vertices;
+	out.indices = indices;
+	return out;
+}
+
+// Current conversion: ModelConvertGeometry, then buffers moved into the mesh
+BenchMesh ConvertCurrent(const aiMesh* mesh)
+{
+	MeshData<float> data;
+	ModelConvertGeometry(mesh, data.vertices, data.indices);
+
+	BenchMesh out;
+	out.vertices = std::move(data.vertices);
+	out.indices = std::move(data.indices);
+	return out;
+}
+
+// Build a side x side vertex grid with normals, UVs and two triangles per cell
+void MakeGrid(aiMesh& mesh, unsigned int side)
+{
+	mesh.mNumVertices = side * side;
+	mesh.mVertices = new aiVector3D[mesh.mNumVertices];
+	mesh.mNormals = new aiVector3D[mesh.mNumVertices];
+	mesh.mTextureCoords[0] = new aiVector3D[mesh.mNumVertices];
+	for (unsigned int y = 0; y < side; y++)
+	{
+		for (unsigned int x = 0; x < side; x++)
+		{
+			unsigned int i = y * side + x;
+			float u = float(x) / float(side - 1), v = float(y) / float(side - 1);
+			float h = 0.1f * std::sin(u * 20.0f) * std::cos(v * 20.0f);
+			mesh.mVertices[i].x = u;
+			mesh.mVertices[i].y = h;
+			mesh.mVertices[i].z = v;
+			mesh.mNormals[i].x = 0.0f;
+			mesh.mNormals[i].y = 1.0f;
+			mesh.mNormals[i].z = 0.0f;
+			mesh.mTextureCoords[0][i].x = u;
+			mesh.mTextureCoords[0][i].y = v;
+			mesh.mTextureCoords[0][i].z = 0.0f;
+		}
+	}
+
+	mesh.mNumFaces = (side - 1) * (side - 1) * 2;
+	mesh.mFaces = new aiFace[mesh.mNumFaces];
+	unsigned int f = 0;
+	for (unsigned int y = 0; y + 1 < side; y++)
+	{
+		for (unsigned int x = 0; x + 1 < side; x++)
+		{
+			unsigned int i = y * side + x;
+			const unsigned int tris[2][3] = { { i, i + side, i + 1 }, { i + 1, i + side, i + side + 1 } };
+			for (const auto& tri : tris)
+			{
+				aiFace& face = mesh.mFaces[f++];
+				face.mNumIndices = 3;
+				face.mIndices = new unsigned int[3];
+				face.mIndices[0] = tri[0];
+				face.mIndices[1] = tri[1];
+				face.mIndices[2] = tri[2];
+			}
+		}
+	}
+}
+
+// Time a conversion path
+// Return: best time in ms (avg_ms = average time)
+template <typename F>
+double TimeRuns(F&& convert, const aiMesh* mesh, int runs, double& avg_ms, BenchMesh& result)
+{
+	double best = 1e30, total = 0;
+	for (int i = 0; i < runs; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		result = convert(mesh);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		best = ms < best ? ms : best;
+		total += ms;
+	}
+	avg_ms = total / runs;
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned long vertices = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	int runs = argc > 2 ? std::atoi(argv[2]) : 10;
+	unsigned int side = unsigned(std::sqrt(double(vertices)));
+	if (side < 2 || runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [vertices >= 4] [runs >= 1]\n", argv[0]);
+		return 1;
+	}
+
+	std::unique_ptr<aiMesh> mesh(new aiMesh());
+	MakeGrid(*mesh, side);
+	printf("Synthetic mesh: %u vertices, %u triangles, %d runs\n", mesh->mNumVertices, mesh->mNumFaces, runs);
+
+	BenchMesh original, current;
+	double original_avg, current_avg;
+	double original_best = TimeRuns(ConvertOriginal, mesh.get(), runs, original_avg, original);
+	double current_best = TimeRuns(ConvertCurrent, mesh.get(), runs, current_avg, current);
+
+	bool same = original.indices == current.indices && original.vertices.size() == current.vertices.size();
+	for (size_t i = 0; same && i < original.vertices.size(); i++)
+	{
+		const Vertex<float>& a = original.vertices[i];
+		const Vertex<float>& b = current.vertices[i];
+		same = a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z && a.norm.x == b.norm.x &&
+			a.norm.y == b.norm.y && a.norm.z == b.norm.z && a.uv.x == b.uv.x && a.uv.y == b.uv.y;
+	}
+
+	printf("original: best %8.2f ms, avg %8.2f ms\n", original_best, original_avg);
+	printf("current:  best %8.2f ms, avg %8.2f ms (%.2fx)\n", current_best, current_avg, original_best / current_best);
+	if (!same)
+	{
+		fprintf(stderr, "Outputs differ\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+// *****************************************************************************************************************************
+// ktx_transcode.cpp
+// OpenGL Rendering
+// Offline tool: compress the textures referenced by a model (or given directly) to KTX (BC1/BC3, full mip chain)
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+// Usage: ktx_transcode [-f] <model or image> [...]
+//   Writes <texture>.ktx next to each source image; RendLoadTexture picks it up automatically.
+//   -f = overwrite existing .ktx files (default: skip when newer than the image)
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <filesystem>
+#include <system_error>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "lodepng.h"
+
+#include "gl_ktx.hpp"
+
+// Collect texture paths referenced by a model's materials
+// Return: false if the model could not be imported
+bool GetModelTextures(const std::string& path, std::set<std::string>& textures)
+{
+	static const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_NORMALS,
+		aiTextureType_HEIGHT, aiTextureType_EMISSIVE, aiTextureType_OPACITY };
+
+	Assimp::Importer import;
+	const aiScene* scene = import.ReadFile(path, 0);
+	if (!scene)
+	{
+		fprintf(stderr, "ERROR::ASSIMP::%s\n", import.GetErrorString());
+		return false;
+	}
+
+	std::string directory = path.substr(0, path.find_last_of('/'));
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+	{
+		for (aiTextureType type : types)
+		{
+			for (unsigned int j = 0; j < scene->mMaterials[i]->GetTextureCount(type); j++)
+			{
+				aiString str;
+				scene->mMaterials[i]->GetTexture(type, j, &str);
+				if (str.C_Str()[0] != '*')	// Skip embedded textures
+					textures.insert(directory + '/' + str.C_Str());
+			}
+		}
+	}
+
+	return true;
+}
+
+// Compress one image to KTX
+// Return: true on success (or already up to date)
+bool TranscodeImage(const std::string& path, bool force)
+{
+	std::string ktx_path = KTXGetPath(path);
+
+	if (!force && KTXIsCurrent(path))
+	{
+		printf("%s: up to date\n", ktx_path.c_str());
+		return true;
+	}
+
+	std::vector<unsigned char> image;
+	unsigned int width, height;
+	unsigned int error = lodepng::decode(image, width, height, path);
+	if (error)
+	{
+		fprintf(stderr, "%s: lodepng error %u: %s\n", path.c_str(), error, lodepng_error_text(error));
+		return false;
+	}
+
+	std::vector<unsigned char> ktx = KTXCompressImage(image, width, height);
+	if (lodepng::save_file(ktx, ktx_path) != 0)
+	{
+		fprintf(stderr, "%s: could not write\n", ktx_path.c_str());
+		return false;
+	}
+
+	printf("%s: %ux%u, %zu -> %zu bytes\n", ktx_path.c_str(), width, height, image.size() + image.size() / 3, ktx.size());
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	bool force = false;
+	std::set<std::string> textures;
+	bool ok = true;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s [-f] <model or image> [...]\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		std::string ext = std::filesystem::path(arg).extension().string();
+
+		if (arg == "-f")
+			force = true;
+		else if (ext == ".png" || ext == ".PNG")
+			textures.insert(arg);
+		else if (!GetModelTextures(arg, textures))
+			ok = false;
+	}
+
+	for (const std::string& texture : textures)
+	{
+		if (!TranscodeImage(texture, force))
+			ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
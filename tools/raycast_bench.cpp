@@ -0,0 +1,242 @@
+// *****************************************************************************************************************************
+// raycast_bench.cpp
+// OpenGL Rendering
+// Check and benchmark: TriangleBVH ray casts vs brute force over every triangle
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+// Usage: raycast_bench [triangles] [rays]
+//   Checks TriangleBVH::intersect against a brute-force loop on small meshes: 8 triangles split into leaves [0, 6) and
+//   [6, 8) (a leaf ending at the last triangle, whose group of four reads past the end), then random soups of 1 to 64
+//   triangles. Then times the build and the rays (default 1M triangles and 10000 rays) separately, the build being
+//   what the first Model::raycast pays unless buildRaycast was called.
+//   Returns 1 if any hit differs from brute force. No OpenGL context is needed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "gl_raycast.hpp"
+
+#define BENCH_CHECK_RAYS 64
+#define BENCH_MAX_SOUP 64
+
+typedef std::chrono::steady_clock BenchClock;
+
+double BenchMs(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// Triangle soup (3 positions per triangle, indices 0..n-1)
+struct BenchTriangles
+{
+	std::vector<float> positions;
+	std::vector<uint32_t> indices;
+
+	void push(const float p0[3], const float p1[3], const float p2[3])
+	{
+		const float* p[3] = { p0, p1, p2 };
+		for (int v = 0; v < 3; v++)
+		{
+			indices.push_back(uint32_t(positions.size() / 3));
+			positions.insert(positions.end(), p[v], p[v] + 3);
+		}
+	}
+	size_t size() const { return indices.size() / 3; }
+};
+
+// Brute force closest hit (Moller-Trumbore, double-sided, as the scalar TriangleBVH kernel)
+// Return: true on a hit closer than t_max
+bool IntersectBrute(const BenchTriangles& tris, const float o[3], const float d[3], float t_max, RayHit& hit)
+{
+	bool found = false;
+	for (size_t t = 0; t < tris.size(); t++)
+	{
+		const float* p0 = &tris.positions[tris.indices[t * 3] * 3];
+		const float* p1 = &tris.positions[tris.indices[t * 3 + 1] * 3];
+		const float* p2 = &tris.positions[tris.indices[t * 3 + 2] * 3];
+		float e1[3], e2[3], tv[3];
+		for (int k = 0; k < 3; k++)
+		{
+			e1[k] = p1[k] - p0[k];
+			e2[k] = p2[k] - p0[k];
+			tv[k] = o[k] - p0[k];
+		}
+		float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (std::fabs(det) <= RAYCAST_EPSILON)
+			continue;
+		float inv_det = 1.0f / det;
+		float u = (tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2]) * inv_det;
+		float q[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0] };
+		float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+		float dist = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+		if (u < 0 || v < 0 || u + v > 1 || dist <= 0 || dist >= t_max)
+			continue;
+
+		t_max = dist;
+		hit.triangle = uint32_t(t);
+		hit.u = u;
+		hit.v = v;
+		hit.distance = dist;
+		found = true;
+	}
+	return found;
+}
+
+// Random ray from a point in [-2, 2]^3 towards a point on a random triangle (most rays hit)
+void RandomRay(const BenchTriangles& tris, std::mt19937& rng, float o[3], float d[3])
+{
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	size_t t = rng() % tris.size();
+	float a = unit(rng), b = unit(rng) * (1.0f - a);
+	for (int k = 0; k < 3; k++)
+	{
+		float p0 = tris.positions[tris.indices[t * 3] * 3 + k];
+		float p1 = tris.positions[tris.indices[t * 3 + 1] * 3 + k];
+		float p2 = tris.positions[tris.indices[t * 3 + 2] * 3 + k];
+		o[k] = unit(rng) * 4.0f - 2.0f;
+		d[k] = p0 + a * (p1 - p0) + b * (p2 - p0) - o[k];
+	}
+}
+
+// Cast rays at a mesh with the BVH and brute force
+// Return: number of rays whose results differ
+int CheckMesh(const char* name, const BenchTriangles& tris, int rays, std::mt19937& rng)
+{
+	TriangleBVH bvh;
+	bvh.build(tris.positions.data(), sizeof(float) * 3, tris.indices.data(), tris.indices.size());
+
+	int errors = 0;
+	for (int r = 0; r < rays; r++)
+	{
+		float o[3], d[3];
+		RandomRay(tris, rng, o, d);
+		RayHit a, b;
+		bool hit_a = bvh.intersect(o, d, FLT_MAX, a);
+		bool hit_b = IntersectBrute(tris, o, d, FLT_MAX, b);
+		// The same triangle, or a different one at the same distance (shared edges, coplanar overlaps)
+		if (hit_a != hit_b || (hit_a && a.triangle != b.triangle && std::fabs(a.distance - b.distance) > 1e-5f * b.distance))
+			errors++;
+	}
+	if (errors)
+		fprintf(stderr, "%s: %d of %d rays differ from brute force\n", name, errors, rays);
+	return errors;
+}
+
+// Triangle of half size s facing +z at (x, y, z)
+void PushQuadTri(BenchTriangles& tris, float x, float y, float z, float s)
+{
+	const float p0[3] = { x - s, y - s, z }, p1[3] = { x + s, y - s, z }, p2[3] = { x, y + s, z };
+	tris.push(p0, p1, p2);
+}
+
+// Grid of side x side cells (two triangles each) over [-1, 1]^2, displaced in z
+BenchTriangles MakeTerrain(unsigned int side)
+{
+	BenchTriangles tris;
+	tris.positions.reserve(size_t(side + 1) * (side + 1) * 3);
+	for (unsigned int y = 0; y <= side; y++)
+	{
+		for (unsigned int x = 0; x <= side; x++)
+		{
+			float u = float(x) / side * 2.0f - 1.0f, v = float(y) / side * 2.0f - 1.0f;
+			tris.positions.push_back(u);
+			tris.positions.push_back(v);
+			tris.positions.push_back(0.1f * std::sin(u * 9.0f) * std::cos(v * 7.0f));
+		}
+	}
+	tris.indices.reserve(size_t(side) * side * 6);
+	for (unsigned int y = 0; y < side; y++)
+	{
+		for (unsigned int x = 0; x < side; x++)
+		{
+			uint32_t i = y * (side + 1) + x;
+			uint32_t quad[6] = { i, i + 1, i + side + 1, i + 1, i + side + 2, i + side + 1 };
+			tris.indices.insert(tris.indices.end(), quad, quad + 6);
+		}
+	}
+	return tris;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned long triangles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	int rays = argc > 2 ? std::atoi(argv[2]) : 10000;
+	unsigned int side = unsigned(std::sqrt(double(triangles) / 2.0));
+	if (side < 1 || rays < 1)
+	{
+		fprintf(stderr, "Usage: %s [triangles >= 2] [rays >= 1]\n", argv[0]);
+		return 1;
+	}
+
+	std::mt19937 rng(1234);
+	int errors = 0;
+
+	// 8 triangles: a cluster of 6 and a far pair, so the SAH split leaves the pair as leaf [6, 8)
+	{
+		BenchTriangles tris;
+		for (int i = 0; i < 6; i++)
+			PushQuadTri(tris, 0.1f * float(i % 3), 0.1f * float(i / 3), 0.01f * float(i), 0.05f);
+		PushQuadTri(tris, 1.5f, 0.0f, 0.0f, 0.05f);
+		PushQuadTri(tris, 1.5f, 0.1f, 0.01f, 0.05f);
+		errors += CheckMesh("8 triangles", tris, BENCH_CHECK_RAYS, rng);
+	}
+
+	// Random soups of every size up to BENCH_MAX_SOUP (every leaf / padding alignment)
+	std::uniform_real_distribution<float> coord(-1.0f, 1.0f);
+	for (int n = 1; n <= BENCH_MAX_SOUP; n++)
+	{
+		BenchTriangles tris;
+		for (int t = 0; t < n; t++)
+		{
+			float p[3][3];
+			for (int v = 0; v < 3; v++)
+			{
+				for (int k = 0; k < 3; k++)
+					p[v][k] = coord(rng);
+			}
+			tris.push(p[0], p[1], p[2]);
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "soup of %d", n);
+		errors += CheckMesh(name, tris, BENCH_CHECK_RAYS, rng);
+	}
+	printf("Checked %d small meshes against brute force: %s\n", BENCH_MAX_SOUP + 1, errors ? "FAILED" : "ok");
+
+	// Timing: build, then rays (the first ray is timed on its own, as a pick right after building would be)
+	BenchTriangles terrain = MakeTerrain(side);
+	TriangleBVH bvh;
+	auto start = BenchClock::now();
+	bvh.build(terrain.positions.data(), sizeof(float) * 3, terrain.indices.data(), terrain.indices.size());
+	double build_ms = BenchMs(start);
+
+	std::vector<float> ray_data(size_t(rays) * 6);
+	for (int r = 0; r < rays; r++)
+		RandomRay(terrain, rng, &ray_data[r * 6], &ray_data[r * 6 + 3]);
+
+	int hits = 0;
+	RayHit hit;
+	start = BenchClock::now();
+	hits += bvh.intersect(&ray_data[0], &ray_data[3], FLT_MAX, hit);
+	double first_ms = BenchMs(start);
+	start = BenchClock::now();
+	for (int r = 1; r < rays; r++)
+		hits += bvh.intersect(&ray_data[r * 6], &ray_data[r * 6 + 3], FLT_MAX, hit);
+	double rays_ms = BenchMs(start);
+
+	int brute_rays = rays < 20 ? rays : 20;
+	start = BenchClock::now();
+	for (int r = 0; r < brute_rays; r++)
+		IntersectBrute(terrain, &ray_data[r * 6], &ray_data[r * 6 + 3], FLT_MAX, hit);
+	double brute_ms = BenchMs(start) / brute_rays;
+
+	printf("%zu triangles: build %.2f ms, first ray %.4f ms, %d rays avg %.4f ms (%d hits), brute force %.3f ms / ray\n",
+		bvh.numTriangles(), build_ms, first_ms, rays, rays > 1 ? rays_ms / (rays - 1) : first_ms, hits, brute_ms);
+	return errors ? 1 : 0;
+}
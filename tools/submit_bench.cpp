@@ -0,0 +1,383 @@
+// *****************************************************************************************************************************
+// submit_bench.cpp
+// OpenGL Rendering
+// Benchmark: CPU draw submission cost of a naive per-draw loop vs the state-sorted RenderQueue vs multi-draw indirect,
+// headless
+// Author: Cory Douthat
+// Copyright (c) 2017 Cory Douthat, All Rights Reserved.
+// *****************************************************************************************************************************
+
+// Usage: submit_bench [draws] [frames]
+//   Renders a synthetic scene (default 4000 draws over 4 programs, 32 meshes and 16 textures) into a headless target,
+//   once in record order with one Mesh::draw per draw, once through RenderQueue (sorted by program / VAO / material),
+//   and once with IndirectBatch over pooled meshes and INDIRECT_GLSL programs (one glMultiDrawElementsIndirect per
+//   program, geometry buffer and material). Without RendIsIndirectSupported() the indirect mode runs the per-draw
+//   fallback on the pooled meshes instead, as Model::drawIndirect does.
+//   Prints CPU submission time per frame (before glFinish), frame time and StateCache call counts for each.
+//   Returns 1 if the indirect (or fallback) frame differs from the naive frame.
+//   Runs on Mesa llvmpipe: configure with OPENGL_HEADLESS_EGL=ON (no display server), or use the hidden GLFW window
+//   with LIBGL_ALWAYS_SOFTWARE=1.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <assimp/scene.h>
+
+#include "gl_render.hpp"
+#include "gl_shader.hpp"
+#include "gl_mesh.hpp"
+#include "gl_indirect.hpp"
+#include "gl_queue.hpp"
+#include "gl_stats.hpp"
+
+#define BENCH_PROGRAMS 4
+#define BENCH_MESHES 32
+#define BENCH_TEXTURES 16
+#define BENCH_WARMUP_FRAMES 5
+#define BENCH_SIZE 512
+#define BENCH_MAX_DIFF 0.001		// Fraction of pixels allowed to differ between modes (rasterization ties)
+
+const char BENCH_VSHD[] =
+	"#version 330 core\n"
+	"layout(location = 0) in vec3 pos;\n"
+	"layout(location = 2) in vec2 uv;\n"
+	"uniform mat4 model;\n"
+	"uniform mat4 view_projection;\n"
+	"out vec2 tex_coord;\n"
+	"void main()\n"
+	"{\n"
+	"	tex_coord = uv;\n"
+	"	gl_Position = view_projection * model * vec4(pos, 1.0);\n"
+	"}\n";
+
+// Vertex shader of the indirect programs (INDIRECT_GLSL is inserted after the #version line)
+const char BENCH_INDIRECT_VSHD[] =
+	"layout(location = 0) in vec3 pos;\n"
+	"layout(location = 2) in vec2 uv;\n"
+	"uniform mat4 view_projection;\n"
+	"out vec2 tex_coord;\n"
+	"void main()\n"
+	"{\n"
+	"	tex_coord = uv;\n"
+	"	gl_Position = view_projection * indirectDraw().model * vec4(pos, 1.0);\n"
+	"}\n";
+
+// %s: GLSL version, %d: program number (makes every program distinct)
+const char BENCH_FSHD[] =
+	"#version %s core\n"
+	"struct Material\n"
+	"{\n"
+	"	sampler2D texture_diffuse[2];\n"
+	"	uint num_tex_diffuse;\n"
+	"};\n"
+	"uniform Material material;\n"
+	"in vec2 tex_coord;\n"
+	"out vec4 color;\n"
+	"void main()\n"
+	"{\n"
+	"	color = texture(material.texture_diffuse[1], tex_coord) * %d.0 / 4.0;\n"
+	"}\n";
+
+// One recorded draw
+struct BenchDraw
+{
+	uint32_t program;		// Index into the program lists
+	uint32_t mesh;			// Index into the mesh lists (material: mesh % BENCH_TEXTURES)
+	NodeTransform<float> world;
+};
+
+// Meshes and programs of one submission mode
+struct BenchScene
+{
+	std::vector<GLuint> programs;
+	std::vector<Mesh<float>>* meshes;
+};
+
+// Per-mode results (per measured frame)
+struct BenchResult
+{
+	double submit_ms = 0;
+	double frame_ms = 0;
+	double state_issued = 0;
+	double state_elided = 0;
+	double draw_calls = 0;
+};
+
+// Build a grid mesh of side x side vertices in [-0.5, 0.5] with one diffuse texture
+// pooled = allocate from the GeometryPool (required by the indirect path)
+Mesh<float> MakeGridMesh(unsigned int side, GLuint texture, bool pooled)
+{
+	std::vector<Vertex<float>> vertices(side * side);
+	for (unsigned int y = 0; y < side; y++)
+	{
+		for (unsigned int x = 0; x < side; x++)
+		{
+			Vertex<float>& v = vertices[y * side + x];
+			v.pos = Vec3<float>(float(x) / (side - 1) - 0.5f, float(y) / (side - 1) - 0.5f, 0.0f);
+			v.norm = Vec3<float>(0.0f, 0.0f, 1.0f);
+			v.uv.x = float(x) / (side - 1);
+			v.uv.y = float(y) / (side - 1);
+		}
+	}
+
+	std::vector<GLuint> indices;
+	indices.reserve((side - 1) * (side - 1) * 6);
+	for (unsigned int y = 0; y + 1 < side; y++)
+	{
+		for (unsigned int x = 0; x + 1 < side; x++)
+		{
+			GLuint i = y * side + x;
+			GLuint quad[6] = { i, i + 1, i + side, i + 1, i + side + 1, i + side };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	Texture tex;
+	tex.id = texture;
+	tex.type = "texture_diffuse";
+	return Mesh<float>(std::move(vertices), std::move(indices), std::vector<Texture>(1, tex), std::vector<MeshLOD>(),
+		MESH_VERTEX_FLOAT, pooled);
+}
+
+// Draw every recorded draw in record order (program, transform and material set per draw)
+void SubmitNaive(const std::vector<BenchDraw>& draws, const BenchScene& scene)
+{
+	for (const BenchDraw& draw : draws)
+	{
+		GLuint program = scene.programs[draw.program];
+		UseShaderProgram(program);
+		GLfloat m[16];
+		for (int i = 0; i < 16; i++)
+			m[i] = draw.world.m[i];
+		glUniformMatrix4fv(ShaderLocationCache::get().getLocations(program).model, 1, GL_FALSE, m);
+		(*scene.meshes)[draw.mesh].draw(program);
+	}
+}
+
+// Record every draw in the queue, then sort and submit
+void SubmitQueue(const std::vector<BenchDraw>& draws, const BenchScene& scene, RenderQueue<float>& queue)
+{
+	queue.begin(Vec3<float>(0.0f, 0.0f, 0.0f));
+	for (const BenchDraw& draw : draws)
+		queue.add(scene.programs[draw.program], (*scene.meshes)[draw.mesh], 0, draw.world);
+	queue.submit();
+}
+
+// Batch every draw per program, then issue one multi-draw per geometry buffer and material
+// by_program = draws bucketed by program (bucketing is part of recording, so it is timed)
+void SubmitIndirect(const std::vector<BenchDraw>& draws, const BenchScene& scene, IndirectBatch& batch,
+	std::vector<std::vector<const BenchDraw*>>& by_program)
+{
+	for (std::vector<const BenchDraw*>& bucket : by_program)
+		bucket.clear();
+	for (const BenchDraw& draw : draws)
+		by_program[draw.program].push_back(&draw);
+
+	RendFrameStats& stats = FrameStats::get().counters();
+	IndirectDrawData data;
+	for (size_t p = 0; p < by_program.size(); p++)
+	{
+		GLuint program = scene.programs[p];
+		UseShaderProgram(program);
+		for (const BenchDraw* draw : by_program[p])
+		{
+			for (int i = 0; i < 16; i++)
+				data.model[i] = draw->world.m[i];
+			(*scene.meshes)[draw->mesh].addIndirect(batch, 0, draw->mesh % BENCH_TEXTURES, data);
+		}
+
+		stats.indirect_draws += batch.size();
+		stats.draw_calls += batch.submit(ShaderLocationCache::get().getLocations(program).indirect_draw_base,
+			[&](uint32_t material) { (*scene.meshes)[material].bindMaterial(program); });
+	}
+}
+
+// Run frames of one submission mode
+// Return: averages over the measured frames
+template <typename F>
+BenchResult RunFrames(int frames, F&& submit)
+{
+	BenchResult result;
+	for (int frame = 0; frame < BENCH_WARMUP_FRAMES + frames; frame++)
+	{
+		FrameStats::get().beginFrame();
+		auto start = std::chrono::steady_clock::now();
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		submit();
+		auto submitted = std::chrono::steady_clock::now();
+		glFinish();
+		auto finished = std::chrono::steady_clock::now();
+		FrameStats::get().endFrame();
+
+		if (frame < BENCH_WARMUP_FRAMES)
+			continue;
+		const RendFrameStats& stats = FrameStats::get().lastFrame();
+		result.submit_ms += std::chrono::duration<double, std::milli>(submitted - start).count();
+		result.frame_ms += std::chrono::duration<double, std::milli>(finished - start).count();
+		result.state_issued += double(stats.state_issued);
+		result.state_elided += double(stats.state_elided);
+		result.draw_calls += double(stats.draw_calls);
+	}
+
+	result.submit_ms /= frames;
+	result.frame_ms /= frames;
+	result.state_issued /= frames;
+	result.state_elided /= frames;
+	result.draw_calls /= frames;
+	return result;
+}
+
+void PrintResult(const char* name, const BenchResult& result)
+{
+	printf("%-9s submit %8.3f ms, frame %8.3f ms, %6.0f draw calls, %7.0f state calls issued, %7.0f elided\n", name,
+		result.submit_ms, result.frame_ms, result.draw_calls, result.state_issued, result.state_elided);
+}
+
+int main(int argc, char* argv[])
+{
+	int num_draws = argc > 1 ? std::atoi(argv[1]) : 4000;
+	int frames = argc > 2 ? std::atoi(argv[2]) : 50;
+	if (num_draws < 1 || frames < 1)
+	{
+		fprintf(stderr, "Usage: %s [draws >= 1] [frames >= 1]\n", argv[0]);
+		return 1;
+	}
+
+	RendHeadlessContext context;
+	RendTarget target;
+	if (!RendInitHeadless(context, target, BENCH_SIZE, BENCH_SIZE))
+		return 1;
+	bool indirect = RendIsIndirectSupported();
+	printf("%s | %s | indirect %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION),
+		indirect ? "supported" : "not supported (per-draw fallback)");
+
+	// Programs (view_projection: orthographic, z in [-1, 1] maps to depth)
+	const GLfloat view_projection[16] = { 0.1f, 0, 0, 0, 0, 0.1f, 0, 0, 0, 0, -0.1f, 0, 0, 0, 0, 1 };
+	std::string indirect_vshd = std::string("#version 430 core\n") + INDIRECT_GLSL + BENCH_INDIRECT_VSHD;
+	std::vector<GLuint> programs, indirect_programs;
+	for (int i = 0; i < BENCH_PROGRAMS; i++)
+	{
+		char fshd[sizeof(BENCH_FSHD) + 16];
+		snprintf(fshd, sizeof(fshd), BENCH_FSHD, "330", i + 1);
+		GLuint program = BuildShaderProgram(BENCH_VSHD, fshd, ("bench" + std::to_string(i)).c_str());
+		if (!program)
+			return 1;
+		programs.push_back(program);
+
+		if (indirect)
+		{
+			snprintf(fshd, sizeof(fshd), BENCH_FSHD, "430", i + 1);
+			program = BuildShaderProgram(indirect_vshd.c_str(), fshd, ("bench_indirect" + std::to_string(i)).c_str());
+			if (!program)
+				return 1;
+			indirect_programs.push_back(program);
+		}
+	}
+	for (GLuint program : programs)
+	{
+		UseShaderProgram(program);
+		glUniformMatrix4fv(glGetUniformLocation(program, "view_projection"), 1, GL_FALSE, view_projection);
+	}
+	for (GLuint program : indirect_programs)
+	{
+		UseShaderProgram(program);
+		glUniformMatrix4fv(glGetUniformLocation(program, "view_projection"), 1, GL_FALSE, view_projection);
+	}
+
+	// Textures (4x4 RGBA, one color each)
+	std::vector<GLuint> textures(BENCH_TEXTURES);
+	glGenTextures(BENCH_TEXTURES, textures.data());
+	for (int i = 0; i < BENCH_TEXTURES; i++)
+	{
+		std::vector<unsigned char> pixels(4 * 4 * 4, (unsigned char)(i * 16));
+		StateCache::get().bindTextureUnit(0, GL_TEXTURE_2D, textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 4, 4, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	// Meshes (own VAOs, so geometry changes cost a bind), and the same meshes in the geometry pool
+	std::vector<Mesh<float>> meshes, pooled_meshes;
+	meshes.reserve(BENCH_MESHES);
+	pooled_meshes.reserve(BENCH_MESHES);
+	for (int i = 0; i < BENCH_MESHES; i++)
+	{
+		meshes.push_back(MakeGridMesh(4 + i % 8, textures[i % BENCH_TEXTURES], false));
+		pooled_meshes.push_back(MakeGridMesh(4 + i % 8, textures[i % BENCH_TEXTURES], true));
+	}
+
+	// Draws in random order, scattered over the view volume
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> coord(-9.0f, 9.0f);
+	std::vector<BenchDraw> draws(num_draws);
+	for (BenchDraw& draw : draws)
+	{
+		draw.program = rng() % BENCH_PROGRAMS;
+		draw.mesh = rng() % BENCH_MESHES;
+		draw.world = NodeTransformIdentity<float>();
+		draw.world.m[12] = coord(rng);
+		draw.world.m[13] = coord(rng);
+		draw.world.m[14] = coord(rng);
+	}
+
+	glEnable(GL_DEPTH_TEST);
+	StateCache::get().invalidate();
+	RenderQueue<float> queue;
+	IndirectBatch batch;
+	std::vector<std::vector<const BenchDraw*>> by_program(BENCH_PROGRAMS);
+	BenchScene scene = { programs, &meshes };
+	BenchScene pooled_scene = { indirect ? indirect_programs : programs, &pooled_meshes };
+
+	auto submit_indirect = [&]()
+	{
+		if (indirect)
+			SubmitIndirect(draws, pooled_scene, batch, by_program);
+		else
+			SubmitNaive(draws, pooled_scene);
+	};
+
+	// The indirect (or fallback) frame must match the reference frame
+	std::vector<unsigned char> reference, image;
+	RunFrames(1, [&]() { SubmitNaive(draws, scene); });
+	RendReadPixels(target, reference);
+	RunFrames(1, submit_indirect);
+	RendReadPixels(target, image);
+	size_t differ = 0;
+	for (size_t i = 0; i < reference.size(); i += 4)
+		differ += std::memcmp(&reference[i], &image[i], 4) != 0;
+	double differ_fraction = double(differ) / double(BENCH_SIZE * BENCH_SIZE);
+
+	printf("%d draws, %d programs, %d meshes, %d textures, %d frames\n", num_draws, BENCH_PROGRAMS, BENCH_MESHES,
+		BENCH_TEXTURES, frames);
+	BenchResult naive = RunFrames(frames, [&]() { SubmitNaive(draws, scene); });
+	BenchResult sorted = RunFrames(frames, [&]() { SubmitQueue(draws, scene, queue); });
+	BenchResult multi = RunFrames(frames, submit_indirect);
+	PrintResult("naive", naive);
+	PrintResult("sorted", sorted);
+	PrintResult(indirect ? "indirect" : "fallback", multi);
+	printf("sorted / naive submit time: %.2f, %s / naive: %.2f\n", sorted.submit_ms / naive.submit_ms,
+		indirect ? "indirect" : "fallback", multi.submit_ms / naive.submit_ms);
+	printf("%s frame vs naive frame: %zu pixels differ\n", indirect ? "indirect" : "fallback", differ);
+
+	meshes.clear();
+	pooled_meshes.clear();
+	glDeleteTextures(BENCH_TEXTURES, textures.data());
+	for (GLuint program : programs)
+		DeleteShaderProgram(program);
+	for (GLuint program : indirect_programs)
+		DeleteShaderProgram(program);
+	RendTerminateHeadless(context, target);
+
+	if (differ_fraction > BENCH_MAX_DIFF)
+	{
+		fprintf(stderr, "%s frame differs from the naive frame\n", indirect ? "Indirect" : "Fallback");
+		return 1;
+	}
+	return 0;
+}